@@ -6,7 +6,9 @@
 #include <util.h>
 #include <validation.h>
 #include <checkqueue.h>
+#include <crypto/sha256.h>
 #include <prevector.h>
+#include <uint256.h>
 #include <vector>
 #include <boost/thread/thread.hpp>
 #include <random.h>
@@ -17,6 +19,9 @@ static const size_t BATCHES = 101;
 static const size_t BATCH_SIZE = 30;
 static const int PREVECTOR_SIZE = 28;
 static const unsigned int QUEUE_BATCH_SIZE = 128;
+/* Transactions per block in the scaling benchmarks, and inputs, so checks, per transaction. */
+static const size_t SCALING_TXS = 1000;
+static const size_t SCALING_INPUTS = 2;
 
 // This Benchmark tests the CheckQueue with a slightly realistic workload,
 // where checks all contain a prevector that is indirect 50% of the time
@@ -60,3 +65,59 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     tg.join_all();
 }
 BENCHMARK(CCheckQueueSpeedPrevectorJob, 1400);
+
+/* A check costing a few microseconds, as a stand-in for a signature check. */
+struct HashJob {
+    uint256 data;
+    bool operator()()
+    {
+        for (int i = 0; i < 16; ++i) {
+            CSHA256().Write(data.begin(), data.size()).Finalize(data.begin());
+        }
+        return true;
+    }
+    void swap(HashJob& x) { std::swap(data, x.data); }
+};
+
+// How verifying a block scales with the threads verifying it (the master
+// counted), adding its checks a transaction at a time as ConnectBlock does.
+// Thread counts beyond the cores of the host are skipped: they would only
+// measure the scheduler.
+template <int THREADS>
+static void CCheckQueueScaling(benchmark::State& state)
+{
+    if (THREADS > GetNumCores()) {
+        return;
+    }
+    CCheckQueue<HashJob> queue {QUEUE_BATCH_SIZE};
+    boost::thread_group tg;
+    for (auto x = 0; x < THREADS - 1; ++x) {
+       tg.create_thread([&]{queue.Thread();});
+    }
+    while (state.KeepRunning()) {
+        CCheckQueueControl<HashJob> control(&queue);
+        for (size_t tx = 0; tx < SCALING_TXS; ++tx) {
+            std::vector<HashJob> vChecks(SCALING_INPUTS);
+            control.Add(vChecks);
+        }
+        control.Wait();
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+static void CCheckQueueScaling1(benchmark::State& state) { CCheckQueueScaling<1>(state); }
+static void CCheckQueueScaling2(benchmark::State& state) { CCheckQueueScaling<2>(state); }
+static void CCheckQueueScaling4(benchmark::State& state) { CCheckQueueScaling<4>(state); }
+static void CCheckQueueScaling8(benchmark::State& state) { CCheckQueueScaling<8>(state); }
+static void CCheckQueueScaling16(benchmark::State& state) { CCheckQueueScaling<16>(state); }
+static void CCheckQueueScaling32(benchmark::State& state) { CCheckQueueScaling<32>(state); }
+static void CCheckQueueScaling64(benchmark::State& state) { CCheckQueueScaling<64>(state); }
+
+BENCHMARK(CCheckQueueScaling1, 50);
+BENCHMARK(CCheckQueueScaling2, 100);
+BENCHMARK(CCheckQueueScaling4, 200);
+BENCHMARK(CCheckQueueScaling8, 400);
+BENCHMARK(CCheckQueueScaling16, 400);
+BENCHMARK(CCheckQueueScaling32, 400);
+BENCHMARK(CCheckQueueScaling64, 400);
@@ -0,0 +1,92 @@
+// Copyright (c) 2020 The Earthcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <coins.h>
+#include <random.h>
+
+#include <unordered_map>
+#include <vector>
+
+/* Transactions per block in the IBD benchmark; each spends two older outputs and creates two. */
+static const int IBD_BLOCK_TXS = 500;
+/* Blocks connected per flush of the chainstate cache to its base. */
+static const int IBD_FLUSH_INTERVAL = 20;
+/* Entries in the map benchmarks. */
+static const int MAP_ENTRIES = 100000;
+
+/** The chainstate database as far as the cache sees it: empty, and writes are only consumed. */
+class CoinsViewSink : public CCoinsView
+{
+public:
+    uint64_t m_written = 0;
+
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) override
+    {
+        for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = mapCoins.erase(it)) {
+            if (it->second.flags & CCoinsCacheEntry::DIRTY) m_written++;
+        }
+        return true;
+    }
+};
+
+/* The coins cache traffic of initial block download or -reindex-chainstate: every block is
+ * connected in a cache of its own, which is merged into the chainstate cache, which is
+ * flushed to the (here simulated) database every few blocks. */
+static void CoinsCacheIBD(benchmark::State& state)
+{
+    FastRandomContext rng(true);
+    CTxOut txout(50 * CENT, CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 0x42) << OP_EQUALVERIFY << OP_CHECKSIG);
+    std::vector<COutPoint> unspent;
+    int height = 0;
+
+    CoinsViewSink db;
+    CCoinsViewCache tip(&db);
+    while (state.KeepRunning()) {
+        CCoinsViewCache view(&tip);
+        for (int i = 0; i < IBD_BLOCK_TXS; ++i) {
+            const uint256 txid = rng.rand256();
+            for (int j = 0; j < 2 && unspent.size() > 1000; ++j) {
+                const size_t pos = rng.randrange(unspent.size());
+                view.SpendCoin(unspent[pos]);
+                unspent[pos] = unspent.back();
+                unspent.pop_back();
+            }
+            for (uint32_t n = 0; n < 2; ++n) {
+                view.AddCoin(COutPoint(txid, n), Coin(txout, height, false), false);
+                unspent.emplace_back(txid, n);
+            }
+        }
+        view.Flush();
+        if (++height % IBD_FLUSH_INTERVAL == 0) tip.Flush();
+    }
+}
+
+/* Insert, look up and erase-while-iterating through a map as the coins cache does. */
+template <typename Map>
+static void CoinsMapCycle(benchmark::State& state)
+{
+    FastRandomContext rng(true);
+    std::vector<COutPoint> outpoints;
+    for (int i = 0; i < MAP_ENTRIES; ++i) {
+        outpoints.emplace_back(rng.rand256(), i & 3);
+    }
+    while (state.KeepRunning()) {
+        Map map;
+        for (const COutPoint& outpoint : outpoints) {
+            map.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::tuple<>());
+        }
+        for (const COutPoint& outpoint : outpoints) {
+            map.find(outpoint)->second.flags = CCoinsCacheEntry::DIRTY;
+        }
+        for (auto it = map.begin(); it != map.end(); it = map.erase(it)) {}
+    }
+}
+
+static void CoinsMapPooled(benchmark::State& state) { CoinsMapCycle<CCoinsMap>(state); }
+static void CoinsMapUnordered(benchmark::State& state) { CoinsMapCycle<std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher>>(state); }
+
+BENCHMARK(CoinsCacheIBD, 200);
+BENCHMARK(CoinsMapPooled, 10);
+BENCHMARK(CoinsMapUnordered, 10);
@@ -0,0 +1,93 @@
+// Copyright (c) 2020 The Earthcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <policy/policy.h>
+#include <txmempool.h>
+
+#include <limits>
+#include <string>
+#include <vector>
+
+static const int CHAINS = 10;
+static const int CHAIN_LENGTH = 100;
+
+/** Transactions spending each other in CHAINS chains of CHAIN_LENGTH, the second output of each spent by a side transaction. */
+static std::vector<CTransactionRef> CreateChains()
+{
+    std::vector<CTransactionRef> txs;
+    for (int chain = 0; chain < CHAINS; ++chain) {
+        COutPoint prevout;
+        for (int i = 0; i < CHAIN_LENGTH; ++i) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout = prevout;
+            tx.vin[0].scriptSig = CScript() << chain << i;
+            tx.vout.resize(2);
+            tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+            tx.vout[0].nValue = 10 * COIN;
+            tx.vout[1].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+            tx.vout[1].nValue = COIN;
+            txs.push_back(MakeTransactionRef(tx));
+            prevout = COutPoint(tx.GetHash(), 0);
+
+            if (i % 4 == 3) {
+                CMutableTransaction side;
+                side.vin.resize(1);
+                side.vin[0].prevout = COutPoint(tx.GetHash(), 1);
+                side.vout.resize(1);
+                side.vout[0].scriptPubKey = CScript() << OP_3 << OP_EQUAL;
+                side.vout[0].nValue = COIN;
+                txs.push_back(MakeTransactionRef(side));
+            }
+        }
+    }
+    return txs;
+}
+
+static void AddTxs(const std::vector<CTransactionRef>& txs, CTxMemPool& pool) EXCLUSIVE_LOCKS_REQUIRED(pool.cs)
+{
+    LockPoints lp;
+    CAmount fee = 1000;
+    for (const CTransactionRef& tx : txs) {
+        pool.addUnchecked(tx->GetHash(), CTxMemPoolEntry(tx, fee, 0, 1, false, 4, lp));
+        fee = fee * 7 % 10007;
+    }
+}
+
+// Add long chains of transactions, each of which walks all its ancestors, and
+// then evict them all again, package by package.
+static void MempoolChainEviction(benchmark::State& state)
+{
+    const std::vector<CTransactionRef> txs = CreateChains();
+    CTxMemPool pool;
+    LOCK(pool.cs);
+
+    while (state.KeepRunning()) {
+        AddTxs(txs, pool);
+        pool.TrimToSize(0);
+    }
+}
+
+// Walk the ancestors and descendants of every transaction in long chains.
+static void MempoolChainAncestors(benchmark::State& state)
+{
+    const std::vector<CTransactionRef> txs = CreateChains();
+    CTxMemPool pool;
+    LOCK(pool.cs);
+    AddTxs(txs, pool);
+
+    const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+    while (state.KeepRunning()) {
+        for (CTxMemPool::txiter it = pool.mapTx.begin(); it != pool.mapTx.end(); ++it) {
+            CTxMemPool::setEntries ancestors, descendants;
+            pool.CalculateMemPoolAncestors(*it, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+            pool.CalculateDescendants(it, descendants);
+        }
+    }
+}
+
+BENCHMARK(MempoolChainEviction, 5);
+BENCHMARK(MempoolChainAncestors, 2);
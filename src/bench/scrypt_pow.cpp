@@ -0,0 +1,172 @@
+// Copyright (c) 2020 The Earthcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include <arith_uint256.h>
+#include <chain.h>
+#include <chainparams.h>
+#include <crypto/scrypt.h>
+#include <pow.h>
+#include <primitives/block.h>
+#include <utilstrencodings.h>
+
+#include <vector>
+
+/* Headers in the chain hashed by the header verification benchmarks */
+static const int HEADER_CHAIN_LENGTH = 2000;
+/* Blocks in the chain walked by the difficulty retarget benchmark */
+static const int RETARGET_CHAIN_LENGTH = 100000;
+
+// A header shaped like a recent mainnet one; only the nonce varies between hashes.
+static CBlockHeader BenchHeader()
+{
+    CBlockHeader header;
+    header.nVersion = 0x20000000;
+    header.hashPrevBlock = uint256S("0x6d2b6c1ab5e20a1b3e7f4ec9a11feac4ea1b7c1f3e5e3e01f4bd0a9ae0c5d7a2");
+    header.hashMerkleRoot = uint256S("0x3c8e2ad9e0c4d1e19a3a6f04e1d7f9f1a1e2cbb9d3a5e8f2b1c4d7a9e0f3b6c5");
+    header.nTime = 1530000000;
+    header.nBits = 0x1b0404cb;
+    header.nNonce = 0;
+    return header;
+}
+
+/* A linked chain of headers one target spacing apart, as a node receives them in a headers message. */
+static std::vector<CBlockHeader> BenchHeaderChain()
+{
+    const Consensus::Params& params = CreateChainParams(CBaseChainParams::MAIN)->GetConsensus();
+    std::vector<CBlockHeader> headers(HEADER_CHAIN_LENGTH, BenchHeader());
+    for (int i = 1; i < HEADER_CHAIN_LENGTH; i++) {
+        headers[i].hashPrevBlock = headers[i - 1].GetHash();
+        headers[i].nTime = headers[i - 1].nTime + params.nPowTargetSpacing;
+        headers[i].nNonce = i * 7919;
+    }
+    return headers;
+}
+
+static void ScryptGeneric(benchmark::State& state)
+{
+    CBlockHeader header = BenchHeader();
+    std::vector<char> scratchpad(SCRYPT_SCRATCHPAD_SIZE);
+    uint256 hash;
+    while (state.KeepRunning()) {
+        scrypt_1024_1_1_256_sp_generic(BEGIN(header.nVersion), BEGIN(hash), scratchpad.data());
+        header.nNonce++;
+    }
+}
+
+#if defined(USE_SSE2)
+static void ScryptSSE2(benchmark::State& state)
+{
+    CBlockHeader header = BenchHeader();
+    std::vector<char> scratchpad(SCRYPT_SCRATCHPAD_SIZE);
+    uint256 hash;
+    while (state.KeepRunning()) {
+        scrypt_1024_1_1_256_sp_sse2(BEGIN(header.nVersion), BEGIN(hash), scratchpad.data());
+        header.nNonce++;
+    }
+}
+#endif
+
+/* Single-hash latency as block validation sees it, through GetPoWHash. */
+static void ScryptPoWHash(benchmark::State& state)
+{
+    CBlockHeader header = BenchHeader();
+    while (state.KeepRunning()) {
+        header.GetPoWHash();
+        header.nNonce++;
+    }
+}
+
+/* Throughput of 16 hashes through the multi-buffer kernel with max_lanes lanes. Left without
+ * results on CPUs lacking that kernel, rather than timing the one-lane fallback under its name. */
+static void ScryptBatch(benchmark::State& state, size_t max_lanes)
+{
+    scrypt_detect_multi(max_lanes);
+    if (scrypt_multi_lane_count() != max_lanes) {
+        scrypt_detect_multi();
+        return;
+    }
+    std::vector<CBlockHeader> headers(16, BenchHeader());
+    uint256 hashes[16];
+    const char* inputs[16];
+    char* outputs[16];
+    for (int i = 0; i < 16; i++) {
+        headers[i].nNonce = i;
+        inputs[i] = BEGIN(headers[i].nVersion);
+        outputs[i] = BEGIN(hashes[i]);
+    }
+    while (state.KeepRunning()) {
+        scrypt_1024_1_1_256_multi(inputs, outputs, 16);
+        for (CBlockHeader& header : headers)
+            header.nNonce += 16;
+    }
+    scrypt_detect_multi();
+}
+
+static void ScryptBatch16_Scalar(benchmark::State& state) { ScryptBatch(state, 1); }
+static void ScryptBatch16_AVX2(benchmark::State& state) { ScryptBatch(state, 8); }
+static void ScryptBatch16_AVX512(benchmark::State& state) { ScryptBatch(state, 16); }
+
+static void CheckHeaderChainPoW(benchmark::State& state)
+{
+    const Consensus::Params& params = CreateChainParams(CBaseChainParams::MAIN)->GetConsensus();
+    const std::vector<CBlockHeader> headers = BenchHeaderChain();
+    while (state.KeepRunning()) {
+        for (const CBlockHeader& header : headers)
+            CheckProofOfWork(header.GetPoWHash(), header.nBits, params);
+    }
+}
+
+/* The same chain hashed in batches, as ProcessNewBlockHeaders does. */
+static void CheckHeaderChainPoWBatch(benchmark::State& state)
+{
+    const Consensus::Params& params = CreateChainParams(CBaseChainParams::MAIN)->GetConsensus();
+    const std::vector<CBlockHeader> headers = BenchHeaderChain();
+    std::vector<const char*> inputs;
+    for (const CBlockHeader& header : headers)
+        inputs.push_back(BEGIN(header.nVersion));
+    std::vector<uint256> hashes(headers.size());
+    std::vector<char*> outputs;
+    for (uint256& hash : hashes)
+        outputs.push_back(BEGIN(hash));
+
+    while (state.KeepRunning()) {
+        scrypt_1024_1_1_256_multi(inputs.data(), outputs.data(), inputs.size());
+        for (size_t i = 0; i < headers.size(); i++)
+            CheckProofOfWork(hashes[i], headers[i].nBits, params);
+    }
+}
+
+static void GetNextWorkRequiredChain(benchmark::State& state)
+{
+    const Consensus::Params& params = CreateChainParams(CBaseChainParams::MAIN)->GetConsensus();
+    std::vector<CBlockIndex> blocks(RETARGET_CHAIN_LENGTH);
+    for (int i = 0; i < RETARGET_CHAIN_LENGTH; i++) {
+        blocks[i].pprev = i ? &blocks[i - 1] : nullptr;
+        blocks[i].nHeight = i;
+        // Alternate fast and slow blocks so the retarget clamps in both directions.
+        blocks[i].nTime = i ? blocks[i - 1].nTime + (i % 3 ? params.nPowTargetSpacing / 4 : params.nPowTargetSpacing * 3) : 1386746168;
+        blocks[i].nBits = i ? GetNextWorkRequired(&blocks[i - 1], nullptr, params) : UintToArith256(params.powLimit).GetCompact();
+    }
+
+    while (state.KeepRunning()) {
+        uint64_t nBitsSum = 0;
+        for (const CBlockIndex& block : blocks)
+            nBitsSum += GetNextWorkRequired(&block, nullptr, params);
+        assert(nBitsSum != 0);
+    }
+}
+
+BENCHMARK(ScryptGeneric, 3000);
+#if defined(USE_SSE2)
+BENCHMARK(ScryptSSE2, 3000);
+#endif
+BENCHMARK(ScryptPoWHash, 3000);
+BENCHMARK(ScryptBatch16_Scalar, 180);
+BENCHMARK(ScryptBatch16_AVX2, 400);
+BENCHMARK(ScryptBatch16_AVX512, 700);
+BENCHMARK(CheckHeaderChainPoW, 1);
+BENCHMARK(CheckHeaderChainPoWBatch, 5);
+BENCHMARK(GetNextWorkRequiredChain, 50);
@@ -0,0 +1,75 @@
+// Copyright (c) 2020 The Earthcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockcache.h>
+
+#include <core_memusage.h>
+#include <memusage.h>
+
+/** Bookkeeping of an entry: its list node and its slot in the hash index. */
+static size_t EntryOverhead()
+{
+    return memusage::MallocUsage(sizeof(uint256) + sizeof(std::shared_ptr<const CBlock>) + sizeof(size_t) + 2 * sizeof(void*)) +
+        memusage::MallocUsage(sizeof(uint256) + 2 * sizeof(void*)) + sizeof(void*);
+}
+
+std::shared_ptr<const CBlock> BlockCache::Get(const uint256& hash)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_index.find(hash);
+    if (it == m_index.end()) {
+        ++m_misses;
+        return nullptr;
+    }
+    ++m_hits;
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    return it->second->block;
+}
+
+void BlockCache::Insert(const uint256& hash, std::shared_ptr<const CBlock> block)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_max_usage == 0) return;
+    auto it = m_index.find(hash);
+    if (it != m_index.end()) {
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        return;
+    }
+    const size_t usage = RecursiveDynamicUsage(block) + EntryOverhead();
+    // A block larger than the whole cache would only push everything else out, and then itself.
+    if (usage > m_max_usage) return;
+    m_entries.push_front(Entry{hash, std::move(block), usage});
+    m_index.emplace(hash, m_entries.begin());
+    m_usage += usage;
+    Trim();
+}
+
+void BlockCache::Trim()
+{
+    while (m_usage > m_max_usage) {
+        const Entry& oldest = m_entries.back();
+        m_usage -= oldest.usage;
+        m_index.erase(oldest.hash);
+        m_entries.pop_back();
+    }
+}
+
+void BlockCache::SetMaxUsage(size_t max_usage)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_max_usage = max_usage;
+    Trim();
+}
+
+BlockCacheStats BlockCache::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    BlockCacheStats stats;
+    stats.entries = m_entries.size();
+    stats.usage = m_usage;
+    stats.max_usage = m_max_usage;
+    stats.hits = m_hits;
+    stats.misses = m_misses;
+    return stats;
+}
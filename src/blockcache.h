@@ -0,0 +1,75 @@
+// Copyright (c) 2020 The Earthcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKCACHE_H
+#define BITCOIN_BLOCKCACHE_H
+
+#include <primitives/block.h>
+#include <uint256.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+/** Counters of a BlockCache, as reported by getblockcacheinfo. */
+struct BlockCacheStats
+{
+    size_t entries = 0;
+    size_t usage = 0;
+    size_t max_usage = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+};
+
+/**
+ * Bounded cache of deserialized blocks by hash, shared by everything that
+ * reads blocks back from disk. Once the blocks held use more than
+ * max_usage bytes, the least recently used ones are dropped. Blocks are
+ * handed out as shared pointers, so a block dropped from the cache lives on
+ * as long as its readers hold it. Safe to use from any thread.
+ */
+class BlockCache
+{
+private:
+    struct Entry
+    {
+        uint256 hash;
+        std::shared_ptr<const CBlock> block;
+        size_t usage;
+    };
+    struct EntryHasher
+    {
+        size_t operator()(const uint256& hash) const { return hash.GetCheapHash(); }
+    };
+
+    mutable std::mutex m_mutex;
+    size_t m_max_usage;
+    size_t m_usage = 0;
+    uint64_t m_hits = 0;
+    uint64_t m_misses = 0;
+    /** Most recently used first. */
+    std::list<Entry> m_entries;
+    std::unordered_map<uint256, std::list<Entry>::iterator, EntryHasher> m_index;
+
+    void Trim();
+
+public:
+    explicit BlockCache(size_t max_usage) : m_max_usage(max_usage) {}
+
+    /** Look a block up, counting a hit or a miss. */
+    std::shared_ptr<const CBlock> Get(const uint256& hash);
+    /** Add a block, or mark it as recently used if it is already held. */
+    void Insert(const uint256& hash, std::shared_ptr<const CBlock> block);
+
+    /** Change the memory limit, dropping blocks as needed to meet it. 0 disables the cache. */
+    void SetMaxUsage(size_t max_usage);
+    BlockCacheStats GetStats() const;
+};
+
+#endif // BITCOIN_BLOCKCACHE_H
@@ -0,0 +1,273 @@
+// Copyright (c) 2020 The Earthcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockcompression.h>
+
+#include <crypto/common.h>
+#include <util.h>
+
+#include <algorithm>
+
+#include <string.h>
+
+namespace {
+
+const uint8_t BLOCK_COMPRESSION_MAGIC[4] = {'e', 'b', 'z', '1'};
+/** Magic, frame size and original size, before the frame index. */
+const size_t HEADER_SIZE = 4 + 4 + 8;
+
+/** Matches are found through a hash table of this many bits over the next 4 bytes. */
+const int HASH_LOG = 14;
+const size_t MIN_MATCH = 4;
+/** Offsets are stored in 2 bytes. */
+const size_t MAX_DISTANCE = 65535;
+/** As in LZ4, a match may not start in the last 12 bytes nor run into the last 5, which are always literals. */
+const size_t MFLIMIT = 12;
+const size_t LAST_LITERALS = 5;
+
+inline uint32_t HashSequence(const uint8_t* p)
+{
+    return (ReadLE32(p) * 2654435761U) >> (32 - HASH_LOG);
+}
+
+/** Append a length beyond what fits in its token nibble, in bytes of 255 and a remainder. */
+void WriteLength(std::vector<uint8_t>& dst, size_t length)
+{
+    for (; length >= 255; length -= 255) dst.push_back(255);
+    dst.push_back(length);
+}
+
+bool ReadLength(Span<const uint8_t> src, size_t& pos, size_t& length)
+{
+    uint8_t byte;
+    do {
+        if (pos >= (size_t)src.size()) return false;
+        byte = src[pos++];
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+void WriteSequence(std::vector<uint8_t>& dst, const uint8_t* literals, size_t literal_length, size_t offset, size_t match_length)
+{
+    const size_t match_code = match_length ? match_length - MIN_MATCH : 0;
+    dst.push_back((std::min<size_t>(literal_length, 15) << 4) | std::min<size_t>(match_code, 15));
+    if (literal_length >= 15) WriteLength(dst, literal_length - 15);
+    dst.insert(dst.end(), literals, literals + literal_length);
+    if (!match_length) return;
+    dst.push_back(offset & 0xff);
+    dst.push_back(offset >> 8);
+    if (match_code >= 15) WriteLength(dst, match_code - 15);
+}
+
+struct FrameIndex
+{
+    uint32_t frame_size;
+    uint64_t raw_size;
+    uint64_t frames;
+};
+
+bool ReadFrameIndex(Span<const uint8_t> compressed, FrameIndex& index)
+{
+    if ((size_t)compressed.size() < HEADER_SIZE || memcmp(compressed.data(), BLOCK_COMPRESSION_MAGIC, sizeof(BLOCK_COMPRESSION_MAGIC))) {
+        return false;
+    }
+    index.frame_size = ReadLE32(compressed.data() + 4);
+    index.raw_size = ReadLE64(compressed.data() + 8);
+    if (index.frame_size == 0) return false;
+    index.frames = index.raw_size / index.frame_size + (index.raw_size % index.frame_size != 0);
+    // Every frame takes an index entry, so a header claiming more frames than could fit is corrupt.
+    return index.frames < ((size_t)compressed.size() - HEADER_SIZE) / 8;
+}
+
+/** Find frame i of a compressed file: its stored bytes, and the size of its original. */
+bool GetFrame(Span<const uint8_t> compressed, const FrameIndex& index, uint64_t i, Span<const uint8_t>& stored, size_t& raw_length)
+{
+    const uint64_t begin = ReadLE64(compressed.data() + HEADER_SIZE + i * 8);
+    const uint64_t end = ReadLE64(compressed.data() + HEADER_SIZE + (i + 1) * 8);
+    if (begin < HEADER_SIZE + (index.frames + 1) * 8 || begin > end || end > (size_t)compressed.size()) {
+        return false;
+    }
+    stored = compressed.subspan(begin, end - begin);
+    raw_length = std::min<uint64_t>(index.frame_size, index.raw_size - i * index.frame_size);
+    return (size_t)stored.size() <= raw_length;
+}
+
+/** Decompress a frame into dst, which is as large as its original. */
+bool DecompressFrame(Span<const uint8_t> stored, Span<uint8_t> dst)
+{
+    if (stored.size() == dst.size()) {
+        memcpy(dst.data(), stored.data(), stored.size());
+        return true;
+    }
+    return DecompressBlockData(stored, dst);
+}
+
+bool CompressFile(FILE* in, FILE* out)
+{
+    if (fseek(in, 0, SEEK_END) != 0) return false;
+    const long size = ftell(in);
+    if (size < 0 || fseek(in, 0, SEEK_SET) != 0) return false;
+
+    const uint64_t raw_size = size;
+    const uint64_t frames = (raw_size + BLOCK_COMPRESSION_FRAME_SIZE - 1) / BLOCK_COMPRESSION_FRAME_SIZE;
+    std::vector<uint8_t> header(HEADER_SIZE + (frames + 1) * 8);
+    memcpy(header.data(), BLOCK_COMPRESSION_MAGIC, sizeof(BLOCK_COMPRESSION_MAGIC));
+    WriteLE32(header.data() + 4, BLOCK_COMPRESSION_FRAME_SIZE);
+    WriteLE64(header.data() + 8, raw_size);
+    // The index is filled in as the frames are written, and written over this placeholder at the end.
+    if (fwrite(header.data(), 1, header.size(), out) != header.size()) return false;
+
+    std::vector<uint8_t> raw(BLOCK_COMPRESSION_FRAME_SIZE);
+    std::vector<uint8_t> packed;
+    uint64_t offset = header.size();
+    for (uint64_t i = 0; i < frames; ++i) {
+        const size_t length = std::min<uint64_t>(BLOCK_COMPRESSION_FRAME_SIZE, raw_size - i * BLOCK_COMPRESSION_FRAME_SIZE);
+        if (fread(raw.data(), 1, length, in) != length) return false;
+        WriteLE64(header.data() + HEADER_SIZE + i * 8, offset);
+
+        Span<const uint8_t> frame(raw.data(), length);
+        if (CompressBlockData(frame, packed)) {
+            frame = Span<const uint8_t>(packed.data(), packed.size());
+        }
+        if (fwrite(frame.data(), 1, frame.size(), out) != (size_t)frame.size()) return false;
+        offset += frame.size();
+    }
+    WriteLE64(header.data() + HEADER_SIZE + frames * 8, offset);
+
+    return fseek(out, 0, SEEK_SET) == 0 && fwrite(header.data(), 1, header.size(), out) == header.size();
+}
+
+} // namespace
+
+bool CompressBlockData(Span<const uint8_t> src, std::vector<uint8_t>& dst)
+{
+    const uint8_t* const data = src.data();
+    const size_t size = src.size();
+    dst.clear();
+    dst.reserve(size);
+
+    size_t anchor = 0;
+    if (size > MFLIMIT) {
+        std::vector<uint32_t> table(1 << HASH_LOG, 0);
+        const size_t match_limit = size - LAST_LITERALS;
+        for (size_t pos = 0; pos + MFLIMIT < size;) {
+            const uint32_t hash = HashSequence(data + pos);
+            const size_t candidate = table[hash];
+            table[hash] = pos;
+            if (candidate >= pos || pos - candidate > MAX_DISTANCE || ReadLE32(data + candidate) != ReadLE32(data + pos)) {
+                ++pos;
+                continue;
+            }
+
+            size_t length = MIN_MATCH;
+            while (pos + length < match_limit && data[candidate + length] == data[pos + length]) ++length;
+            WriteSequence(dst, data + anchor, pos - anchor, pos - candidate, length);
+            pos += length;
+            anchor = pos;
+            if (dst.size() >= size) return false;
+        }
+    }
+    WriteSequence(dst, data + anchor, size - anchor, 0, 0);
+    return dst.size() < size;
+}
+
+bool DecompressBlockData(Span<const uint8_t> src, Span<uint8_t> dst)
+{
+    size_t in = 0;
+    size_t out = 0;
+    while (in < (size_t)src.size()) {
+        const uint8_t token = src[in++];
+
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !ReadLength(src, in, literal_length)) return false;
+        if (literal_length > (size_t)src.size() - in || literal_length > (size_t)dst.size() - out) return false;
+        memcpy(dst.data() + out, src.data() + in, literal_length);
+        in += literal_length;
+        out += literal_length;
+        // The last sequence is only literals.
+        if (in == (size_t)src.size()) break;
+
+        if ((size_t)src.size() - in < 2) return false;
+        const size_t offset = src[in] | (src[in + 1] << 8);
+        in += 2;
+        if (offset == 0 || offset > out) return false;
+
+        size_t match_length = token & 15;
+        if (match_length == 15 && !ReadLength(src, in, match_length)) return false;
+        match_length += MIN_MATCH;
+        if (match_length > (size_t)dst.size() - out) return false;
+        // The match may overlap what it produces, repeating its last offset bytes.
+        const uint8_t* match = dst.data() + out - offset;
+        if (offset >= match_length) {
+            memcpy(dst.data() + out, match, match_length);
+        } else {
+            for (size_t i = 0; i < match_length; ++i) dst[out + i] = match[i];
+        }
+        out += match_length;
+    }
+    return out == (size_t)dst.size();
+}
+
+bool CompressBlockFile(const fs::path& src, const fs::path& dst)
+{
+    FILE* in = fsbridge::fopen(src, "rb");
+    if (!in) return false;
+    FILE* out = fsbridge::fopen(dst, "wb");
+    if (!out) {
+        fclose(in);
+        return false;
+    }
+    const bool ok = CompressFile(in, out) && FileCommit(out);
+    fclose(out);
+    fclose(in);
+    return ok;
+}
+
+bool DecompressBlockFile(Span<const uint8_t> compressed, FILE* file)
+{
+    FrameIndex index;
+    if (!ReadFrameIndex(compressed, index)) return false;
+
+    std::vector<uint8_t> raw(index.frame_size);
+    for (uint64_t i = 0; i < index.frames; ++i) {
+        Span<const uint8_t> stored;
+        size_t raw_length;
+        if (!GetFrame(compressed, index, i, stored, raw_length)) return false;
+        if (!DecompressFrame(stored, Span<uint8_t>(raw.data(), raw_length))) return false;
+        if (fwrite(raw.data(), 1, raw_length, file) != raw_length) return false;
+    }
+    return true;
+}
+
+bool ReadCompressedBlockFile(Span<const uint8_t> compressed, uint64_t pos, Span<uint8_t> dst)
+{
+    FrameIndex index;
+    if (!ReadFrameIndex(compressed, index)) return false;
+    if (pos > index.raw_size || (uint64_t)dst.size() > index.raw_size - pos) return false;
+
+    std::vector<uint8_t> raw;
+    size_t done = 0;
+    while (done < (size_t)dst.size()) {
+        const uint64_t i = (pos + done) / index.frame_size;
+        const size_t skip = (pos + done) % index.frame_size;
+        Span<const uint8_t> stored;
+        size_t raw_length;
+        if (!GetFrame(compressed, index, i, stored, raw_length)) return false;
+        const size_t length = std::min(raw_length - skip, (size_t)dst.size() - done);
+
+        if ((size_t)stored.size() == raw_length) {
+            memcpy(dst.data() + done, stored.data() + skip, length);
+        } else if (length == raw_length) {
+            // The whole frame is wanted, decompress it in place.
+            if (!DecompressBlockData(stored, dst.subspan(done, length))) return false;
+        } else {
+            raw.resize(raw_length);
+            if (!DecompressBlockData(stored, MakeSpan(raw))) return false;
+            memcpy(dst.data() + done, raw.data() + skip, length);
+        }
+        done += length;
+    }
+    return true;
+}
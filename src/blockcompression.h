@@ -0,0 +1,51 @@
+// Copyright (c) 2020 The Earthcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKCOMPRESSION_H
+#define BITCOIN_BLOCKCOMPRESSION_H
+
+#include <fs.h>
+#include <span.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+/**
+ * Compressed block and undo files.
+ *
+ * A sealed blk?????.dat or rev?????.dat file can be replaced by a compressed
+ * copy (blkz?????.dat, revz?????.dat). The copy is cut into frames of
+ * BLOCK_COMPRESSION_FRAME_SIZE bytes of the original, each compressed on its
+ * own, behind an index of where every frame starts. Any range of the
+ * original can so be read by decompressing only the frames it covers.
+ *
+ * Layout: magic, frame size (uint32), original size (uint64), the file
+ * offsets of all frames and of the end of the last one (uint64 each), then
+ * the frames. A frame that is as long as its original is stored as is.
+ */
+
+/** Bytes of the original file per frame. */
+static const uint32_t BLOCK_COMPRESSION_FRAME_SIZE = 64 * 1024;
+
+/**
+ * Compress src into dst, with an LZ77 codec in the format of LZ4 blocks.
+ * Return false if that does not make it any smaller.
+ */
+bool CompressBlockData(Span<const uint8_t> src, std::vector<uint8_t>& dst);
+
+/** Decompress src into dst. Fails unless src decompresses to exactly dst.size() bytes. */
+bool DecompressBlockData(Span<const uint8_t> src, Span<uint8_t> dst);
+
+/** Write a compressed copy of the file at src to dst, and commit it to disk. */
+bool CompressBlockFile(const fs::path& src, const fs::path& dst);
+
+/** Write the original of a compressed file to file. */
+bool DecompressBlockFile(Span<const uint8_t> compressed, FILE* file);
+
+/** Read dst.size() bytes at position pos of the original of a compressed file into dst. */
+bool ReadCompressedBlockFile(Span<const uint8_t> compressed, uint64_t pos, Span<uint8_t> dst);
+
+#endif // BITCOIN_BLOCKCOMPRESSION_H
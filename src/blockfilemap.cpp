@@ -0,0 +1,136 @@
+// Copyright (c) 2020 The Earthcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilemap.h>
+
+#include <util.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool BlockFileMapping::Available()
+{
+#ifdef WIN32
+    return false;
+#else
+    // Block files are up to MAX_BLOCKFILE_SIZE each, more than a 32-bit address space can keep mapped.
+    return sizeof(void*) >= 8;
+#endif
+}
+
+std::shared_ptr<const BlockFileMapping> BlockFileMapping::Map(const fs::path& path)
+{
+#ifdef WIN32
+    return nullptr;
+#else
+    if (!Available()) {
+        return nullptr;
+    }
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1) {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return nullptr;
+    }
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        LogPrintf("%s: failed to map %s: %s\n", __func__, path.string(), strerror(errno));
+        return nullptr;
+    }
+    // Blocks are read one at a time from anywhere in the file; read ahead only what WillNeed asks for.
+    posix_madvise(data, st.st_size, POSIX_MADV_RANDOM);
+    return std::shared_ptr<const BlockFileMapping>(new BlockFileMapping(static_cast<const uint8_t*>(data), st.st_size));
+#endif
+}
+
+BlockFileMapping::~BlockFileMapping()
+{
+#ifndef WIN32
+    munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+}
+
+void BlockFileMapping::WillNeed(size_t offset, size_t length) const
+{
+#ifndef WIN32
+    static const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t begin = offset - offset % page_size;
+    posix_madvise(const_cast<uint8_t*>(m_data) + begin, offset + length - begin, POSIX_MADV_WILLNEED);
+#endif
+}
+
+/** Current size of a file, or false if it cannot be had. */
+static bool CurrentFileSize(const fs::path& path, size_t& size)
+{
+#ifdef WIN32
+    return false;
+#else
+    struct stat st;
+    if (stat(path.string().c_str(), &st) != 0 || st.st_size < 0) {
+        return false;
+    }
+    size = st.st_size;
+    return true;
+#endif
+}
+
+BlockFileMapCache::BlockFileMapCache(std::function<fs::path(int)> file_path, size_t max_mappings)
+    : m_file_path(std::move(file_path)), m_max_mappings(max_mappings)
+{
+}
+
+std::shared_ptr<const BlockFileMapping> BlockFileMapCache::Get(int file, size_t min_size)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const fs::path path = m_file_path(file);
+    // Reading a mapped page past the end of a file that was truncated raises
+    // SIGBUS rather than an error, so the range is checked against the size
+    // the file has now, and callers read the file instead if it falls short.
+    size_t file_size = 0;
+    const bool have_size = CurrentFileSize(path, file_size);
+    for (auto it = m_mappings.begin(); it != m_mappings.end(); ++it) {
+        if (it->first != file) continue;
+        const size_t mapped_size = it->second->Data().size();
+        if (have_size && mapped_size >= min_size && mapped_size <= file_size) {
+            m_mappings.splice(m_mappings.begin(), m_mappings, it);
+            return it->second;
+        }
+        // The file has grown or shrunk since it was mapped.
+        m_mappings.erase(it);
+        break;
+    }
+    if (m_max_mappings == 0 || !have_size || file_size < min_size) {
+        return nullptr;
+    }
+
+    std::shared_ptr<const BlockFileMapping> mapping = BlockFileMapping::Map(path);
+    if (!mapping || (size_t)mapping->Data().size() < min_size) {
+        return nullptr;
+    }
+    if (m_mappings.size() >= m_max_mappings) {
+        m_mappings.pop_back();
+    }
+    m_mappings.emplace_front(file, mapping);
+    return mapping;
+}
+
+void BlockFileMapCache::Forget(int file)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_mappings.remove_if([file](const std::pair<int, std::shared_ptr<const BlockFileMapping>>& entry) { return entry.first == file; });
+}
+
+void BlockFileMapCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_mappings.clear();
+}
@@ -0,0 +1,125 @@
+// Copyright (c) 2020 The Earthcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEMAP_H
+#define BITCOIN_BLOCKFILEMAP_H
+
+#include <fs.h>
+#include <span.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/** Read-only memory mapping of a whole block file. */
+class BlockFileMapping
+{
+private:
+    const uint8_t* m_data;
+    size_t m_size;
+
+    BlockFileMapping(const uint8_t* data, size_t size) : m_data(data), m_size(size) {}
+
+public:
+    /** Whether block files can be mapped on this platform at all. */
+    static bool Available();
+
+    /** Map the file, or return null if it cannot be mapped. */
+    static std::shared_ptr<const BlockFileMapping> Map(const fs::path& path);
+
+    ~BlockFileMapping();
+    BlockFileMapping(const BlockFileMapping&) = delete;
+    BlockFileMapping& operator=(const BlockFileMapping&) = delete;
+
+    Span<const uint8_t> Data() const { return Span<const uint8_t>(m_data, m_size); }
+
+    /** Hint that the given range is about to be read, so its pages are read in ahead of the faults. */
+    void WillNeed(size_t offset, size_t length) const;
+};
+
+/**
+ * Serialized block data, viewed in place in its mapped block file.
+ *
+ * Holds on to the mapping, so the view stays valid as long as this object
+ * lives, even if the mapping is dropped from the cache meanwhile. Where block
+ * files cannot be mapped, the data is read into a buffer owned by this
+ * object instead.
+ */
+class MappedBlock
+{
+private:
+    std::shared_ptr<const BlockFileMapping> m_mapping;
+    std::vector<uint8_t> m_buffer;
+    Span<const uint8_t> m_data;
+
+public:
+    MappedBlock() = default;
+    // Moving keeps the buffer, and so the view, in place; a copy would have to point its view at its own buffer.
+    MappedBlock(MappedBlock&&) = default;
+    MappedBlock& operator=(MappedBlock&&) = default;
+    MappedBlock(const MappedBlock&) = delete;
+    MappedBlock& operator=(const MappedBlock&) = delete;
+
+    Span<const uint8_t> Data() const { return m_data; }
+
+    void SetMapped(std::shared_ptr<const BlockFileMapping> mapping, Span<const uint8_t> data)
+    {
+        m_mapping = std::move(mapping);
+        std::vector<uint8_t>().swap(m_buffer);
+        m_data = data;
+    }
+
+    /** Switch to an owned buffer of the given size, to be filled through the returned span. */
+    Span<uint8_t> SetBuffer(size_t size)
+    {
+        m_mapping.reset();
+        m_buffer.assign(size, 0);
+        m_data = Span<const uint8_t>(m_buffer.data(), m_buffer.size());
+        return MakeSpan(m_buffer);
+    }
+};
+
+/**
+ * Bounded cache of block file mappings, by file number. Once it holds
+ * max_mappings, the least recently used mapping is dropped for a new one.
+ * Safe to use from any thread.
+ *
+ * Every lookup checks the mapping against the current size of the file, so a
+ * file truncated since it was mapped is read without the mapping. An I/O
+ * error, or a truncation while a block is being read from the mapping, still
+ * raises SIGBUS, as it would for any other memory-mapped file.
+ */
+class BlockFileMapCache
+{
+private:
+    const std::function<fs::path(int)> m_file_path;
+    const size_t m_max_mappings;
+    std::mutex m_mutex;
+    /** Most recently used first. */
+    std::list<std::pair<int, std::shared_ptr<const BlockFileMapping>>> m_mappings;
+
+public:
+    BlockFileMapCache(std::function<fs::path(int)> file_path, size_t max_mappings);
+
+    /**
+     * Return a mapping of the file covering at least its first min_size
+     * bytes, remapping a cached mapping of the file before it grew or shrank,
+     * or null if the file cannot be mapped or is now shorter than min_size.
+     */
+    std::shared_ptr<const BlockFileMapping> Get(int file, size_t min_size);
+
+    /** Drop the mapping of a file, for when it is deleted. */
+    void Forget(int file);
+
+    /** Drop all mappings, for when the block files they are of are unloaded. */
+    void Clear();
+};
+
+#endif // BITCOIN_BLOCKFILEMAP_H
@@ -12,6 +12,10 @@
 #include <tinyformat.h>
 #include <uint256.h>
 
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 /**
@@ -162,6 +166,9 @@ enum BlockStatus: uint32_t {
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 
     BLOCK_OPT_WITNESS       =   128, //!< block data in blk*.data was received with a witness-enforcing client
+
+    //! at or below a loaded UTXO snapshot and not validated yet; nTx stays 0 until the block is downloaded
+    BLOCK_ASSUMED_VALID     =   256,
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -172,8 +179,11 @@ enum BlockStatus: uint32_t {
 class CBlockIndex
 {
 public:
-    //! pointer to the hash of the block, if any. Memory is owned by this CBlockIndex
-    const uint256* phashBlock;
+    // The fields read by ancestor walks (GetAncestor, LastCommonAncestor) and
+    // chain work comparisons come first. They take 56 bytes, so however the
+    // entry falls on cache lines (the arena packs entries without padding them
+    // to 64 bytes, which would cost a third more memory), reading them touches
+    // at most two lines.
 
     //! pointer to the index of the predecessor of this block
     CBlockIndex* pprev;
@@ -184,6 +194,15 @@ public:
     //! height of the entry in the chain. The genesis block has height 0
     int nHeight;
 
+    //! Verification status of this block. See enum BlockStatus
+    uint32_t nStatus;
+
+    //! (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block
+    arith_uint256 nChainWork;
+
+    //! pointer to the hash of the block, if any. Memory is owned by this CBlockIndex
+    const uint256* phashBlock;
+
     //! Which # file this block is stored in (blk?????.dat)
     int nFile;
 
@@ -193,9 +212,6 @@ public:
     //! Byte offset within rev?????.dat where this block's undo data is stored
     unsigned int nUndoPos;
 
-    //! (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block
-    arith_uint256 nChainWork;
-
     //! Number of transactions in this block.
     //! Note: in a potential headers-first mode, this number cannot be relied upon
     unsigned int nTx;
@@ -205,9 +221,6 @@ public:
     //! Change to 64-bit type when necessary; won't happen before 2030
     unsigned int nChainTx;
 
-    //! Verification status of this block. See enum BlockStatus
-    uint32_t nStatus;
-
     //! block header
     int32_t nVersion;
     uint256 hashMerkleRoot;
@@ -372,6 +385,60 @@ int64_t GetBlockProofEquivalentTime(const CBlockIndex& to, const CBlockIndex& fr
 /** Find the forking point between two chain tips. */
 const CBlockIndex* LastCommonAncestor(const CBlockIndex* pa, const CBlockIndex* pb);
 
+/**
+ * Storage of the block index entries. Entries are never freed one at a time,
+ * only all together when the block index is unloaded, so instead of being
+ * allocated individually they are placed one after another in large chunks.
+ * That saves the allocator's overhead on each of millions of entries, and
+ * keeps entries created together, like a run of headers, on the same pages.
+ */
+class CBlockIndexArena
+{
+private:
+    //! Entries per chunk, a little over 2 MiB.
+    static constexpr size_t CHUNK_ENTRIES = 16384;
+
+    struct ChunkDeleter
+    {
+        void operator()(CBlockIndex* chunk) const { ::operator delete(chunk); }
+    };
+
+    std::vector<std::unique_ptr<CBlockIndex, ChunkDeleter>> m_chunks;
+    size_t m_chunk_used = CHUNK_ENTRIES;
+
+    static_assert(std::is_trivially_destructible<CBlockIndex>::value, "entries are freed without being destroyed");
+
+public:
+    template <typename... Args>
+    CBlockIndex* Create(Args&&... args)
+    {
+        if (m_chunk_used == CHUNK_ENTRIES) {
+            m_chunks.emplace_back(static_cast<CBlockIndex*>(::operator new(CHUNK_ENTRIES * sizeof(CBlockIndex))));
+            m_chunk_used = 0;
+        }
+        return new (m_chunks.back().get() + m_chunk_used++) CBlockIndex(std::forward<Args>(args)...);
+    }
+
+    //! Number of entries created, in order of creation.
+    size_t Size() const
+    {
+        return m_chunks.empty() ? 0 : (m_chunks.size() - 1) * CHUNK_ENTRIES + m_chunk_used;
+    }
+
+    //! The entry created i-th. Its address never changes until Clear().
+    CBlockIndex* operator[](size_t i) const
+    {
+        return m_chunks[i / CHUNK_ENTRIES].get() + i % CHUNK_ENTRIES;
+    }
+
+    //! Free all entries.
+    void Clear()
+    {
+        m_chunks.clear();
+        m_chunk_used = CHUNK_ENTRIES;
+    }
+};
+
 
 /** Used to marshal pointers into hashes for db storage. */
 class CDiskBlockIndex : public CBlockIndex
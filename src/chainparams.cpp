@@ -382,6 +382,11 @@ public:
             }
         };
 
+        // The chain generatetoaddress mines with -mocktime=1388534400 -genproclimit=1 (see feature_utxo_snapshot.py)
+        assumeutxoData = {
+            {150, {uint256S("0xa680622e2c560808c038db64c1b82cfdafe1d9cda976d562b1692cebf3b2f2f6"), uint256S("0x424eea7d450dd4e956bde2be1d65d70cb26ab8cd1f1f7bd726514195fce95880"), 151}},
+        };
+
         chainTxData = ChainTxData{
             1386746170,
             0,
@@ -11,6 +11,7 @@
 #include <primitives/block.h>
 #include <protocol.h>
 
+#include <map>
 #include <memory>
 #include <vector>
 
@@ -25,6 +26,19 @@ struct CCheckpointData {
     MapCheckpoints mapCheckpoints;
 };
 
+/**
+ * A UTXO set snapshot that -loadtxoutset accepts: the block it was taken at,
+ * the hash committing to its coins (see DumpUTXOSnapshot) and the number of
+ * transactions up to and including that block.
+ */
+struct AssumeutxoData {
+    uint256 blockhash;
+    uint256 coins_hash;
+    uint64_t nChainTx;
+};
+
+typedef std::map<int, AssumeutxoData> MapAssumeutxo;
+
 /**
  * Holds various statistics on transactions within a chain. Used to estimate
  * verification progress during chain sync.
@@ -81,6 +95,8 @@ public:
     const std::vector<SeedSpec6>& FixedSeeds() const { return vFixedSeeds; }
     const CCheckpointData& Checkpoints() const { return checkpointData; }
     const ChainTxData& TxData() const { return chainTxData; }
+    /** UTXO set snapshots that can be loaded, by the height of their block */
+    const MapAssumeutxo& Assumeutxo() const { return assumeutxoData; }
     void UpdateVersionBitsParameters(Consensus::DeploymentPos d, int64_t nStartTime, int64_t nTimeout);
 protected:
     CChainParams() {}
@@ -100,6 +116,7 @@ protected:
     bool fMineBlocksOnDemand;
     CCheckpointData checkpointData;
     ChainTxData chainTxData;
+    MapAssumeutxo assumeutxoData;
     bool m_fallback_fee_enabled;
 };
 
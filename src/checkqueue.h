@@ -8,6 +8,9 @@
 #include <sync.h>
 
 #include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 #include <boost/thread/condition_variable.hpp>
@@ -25,12 +28,30 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Every worker has a lane of its own, and the master has one too. The
+  * master spreads the verifications it adds over the lanes; a worker takes
+  * from its own lane, and once that is empty, steals from the others. Lanes
+  * are locked one at a time, so workers only contend when stealing, and
+  * there is no limit to how many workers can be attached.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    struct Lane
+    {
+        std::mutex mutex;
+        //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
+        std::vector<T> checks;
+        //! Size of checks, to skip empty lanes without locking them
+        std::atomic<size_t> size{0};
+        const size_t index;
+
+        explicit Lane(size_t indexIn) : index(indexIn) {}
+    };
+
+    //! Mutex for workers and master to sleep on when out of work
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,122 +60,186 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! Owns all lanes; appended to by attaching workers only, under mutex.
+    std::vector<std::unique_ptr<Lane>> vLaneStorage;
+    //! Every list of lanes that was published; earlier ones may still be in use by workers.
+    std::vector<std::unique_ptr<const std::vector<Lane*>>> vLaneLists;
+    //! The current list of lanes, the master's first.
+    std::atomic<const std::vector<Lane*>*> lanes;
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! The lane the master adds its next verifications to.
+    size_t nNextLane;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The number of workers that are idle.
+    std::atomic<int> nIdle;
 
-    //! The temporary evaluation result.
-    bool fAllOk;
+    //! The evaluation result so far.
+    std::atomic<bool> fAllOk;
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo;
+    std::atomic<int64_t> nTodo;
+
+    /**
+     * Number of verifications in the lanes. Added to after verifications are
+     * queued, so it may dip below zero while they are being taken already.
+     */
+    std::atomic<int64_t> nQueued;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    /**
+     * Take a batch from a lane. Take half of the lane, so the batches
+     * shrink as it empties and the rest is left for thieves.
+     */
+    bool TakeFrom(Lane& lane, std::vector<T>& vChecks)
+    {
+        if (lane.size.load(std::memory_order_relaxed) == 0)
+            return false;
+        std::lock_guard<std::mutex> lock(lane.mutex);
+        if (lane.checks.empty())
+            return false;
+        const size_t nNow = std::max<size_t>(1, std::min<size_t>(nBatchSize, lane.checks.size() / 2));
+        vChecks.resize(nNow);
+        for (size_t i = 0; i < nNow; i++) {
+            // Keep the lane locked as briefly as possible: swap jobs out instead of copying them.
+            vChecks[i].swap(lane.checks.back());
+            lane.checks.pop_back();
+        }
+        lane.size.store(lane.checks.size(), std::memory_order_relaxed);
+        nQueued -= nNow;
+        return true;
+    }
+
+    /** Take a batch from the given lane, or steal one from the next lane that has work. */
+    bool Take(Lane& own, std::vector<T>& vChecks)
+    {
+        if (TakeFrom(own, vChecks))
+            return true;
+        const std::vector<Lane*>& vLanes = *lanes.load(std::memory_order_acquire);
+        for (size_t i = 1; i < vLanes.size(); i++) {
+            if (TakeFrom(*vLanes[(own.index + i) % vLanes.size()], vChecks))
+                return true;
+        }
+        return false;
+    }
+
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    bool Loop(Lane& own, bool fMaster = false)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
         do {
-            {
+            if (!Take(own, vChecks)) {
                 boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if (fMaster && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
+                if (fMaster) {
+                    // No more work gets added while the master waits, so the rest is in the workers' batches.
+                    while (nTodo != 0 && nQueued <= 0)
+                        condMaster.wait(lock);
+                    if (nTodo == 0) {
+                        // return the current status, and reset it for new work later
+                        return fAllOk.exchange(true);
                     }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
+                    continue;
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+                nIdle++;
+                try {
+                    while (nQueued <= 0)
+                        condWorker.wait(lock); // wait
+                } catch (...) {
+                    nIdle--;
+                    throw;
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                nIdle--;
+                continue;
             }
-            // execute work
+            // execute work, unless a verification failed already
+            bool fOk = fAllOk.load(std::memory_order_relaxed);
             for (T& check : vChecks)
                 if (fOk)
                     fOk = check();
+            if (!fOk)
+                fAllOk = false;
+            const int64_t nNow = vChecks.size();
             vChecks.clear();
+            if (nTodo.fetch_sub(nNow) == nNow) {
+                // We processed the last element; inform the master it can exit and return the result
+                boost::lock_guard<boost::mutex> lock(mutex);
+                condMaster.notify_one();
+            }
         } while (true);
     }
 
+    /** Add a lane for a worker to the list. */
+    Lane& AttachWorker()
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        vLaneStorage.emplace_back(new Lane(vLaneStorage.size()));
+        std::unique_ptr<std::vector<Lane*>> vLanes(new std::vector<Lane*>(*lanes.load()));
+        vLanes->push_back(vLaneStorage.back().get());
+        lanes = vLanes.get();
+        vLaneLists.emplace_back(std::move(vLanes));
+        return *vLaneStorage.back();
+    }
+
 public:
     //! Mutex to ensure only one concurrent CCheckQueueControl
     boost::mutex ControlMutex;
 
     //! Create a new check queue
-    explicit CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), nBatchSize(nBatchSizeIn) {}
+    explicit CCheckQueue(unsigned int nBatchSizeIn) : nNextLane(0), nIdle(0), fAllOk(true), nTodo(0), nQueued(0), nBatchSize(nBatchSizeIn)
+    {
+        vLaneStorage.emplace_back(new Lane(0));
+        vLaneLists.emplace_back(new std::vector<Lane*>(1, vLaneStorage.back().get()));
+        lanes = vLaneLists.back().get();
+    }
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        Loop(AttachWorker());
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        return Loop(*(*lanes.load(std::memory_order_acquire))[0], true);
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        for (T& check : vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
+        if (vChecks.empty())
+            return;
         nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
+        // Spread the checks over the lanes, so every worker finds some in its own.
+        const std::vector<Lane*>& vLanes = *lanes.load(std::memory_order_acquire);
+        const size_t nChunk = (vChecks.size() + vLanes.size() - 1) / vLanes.size();
+        for (size_t nBegin = 0; nBegin < vChecks.size(); nBegin += nChunk) {
+            const size_t nEnd = std::min(vChecks.size(), nBegin + nChunk);
+            Lane& lane = *vLanes[nNextLane++ % vLanes.size()];
+            {
+                std::lock_guard<std::mutex> lock(lane.mutex);
+                for (size_t i = nBegin; i < nEnd; i++) {
+                    lane.checks.push_back(T());
+                    vChecks[i].swap(lane.checks.back());
+                }
+                lane.size.store(lane.checks.size(), std::memory_order_relaxed);
+            }
+            nQueued += nEnd - nBegin;
+        }
+        // Idle workers check nQueued after announcing themselves, so either they see the new work or we see them.
+        if (nIdle > 0) {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            if (vChecks.size() == 1)
+                condWorker.notify_one();
+            else
+                condWorker.notify_all();
+        }
     }
 
     ~CCheckQueue()
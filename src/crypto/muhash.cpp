@@ -0,0 +1,165 @@
+// Copyright (c) 2020 The Earthcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <crypto/muhash.h>
+
+#include <crypto/chacha20.h>
+#include <crypto/common.h>
+#include <crypto/sha256.h>
+
+namespace {
+
+/** 2^3072 - 1103717 is the largest 3072-bit prime. */
+const uint32_t MAX_PRIME_DIFF = 1103717;
+
+} // namespace
+
+Num3072::Num3072(const unsigned char (&data)[BYTE_SIZE])
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        limbs[i] = ReadLE32(data + 4 * i);
+    }
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; ++i) {
+        limbs[i] = 0;
+    }
+}
+
+/** Whether the value lies in [p, 2^3072), the only non-canonical range left after FoldCarry. */
+bool Num3072::IsOverflow() const
+{
+    if (limbs[0] <= 0xFFFFFFFF - MAX_PRIME_DIFF) return false;
+    for (int i = 1; i < LIMBS; ++i) {
+        if (limbs[i] != 0xFFFFFFFF) return false;
+    }
+    return true;
+}
+
+void Num3072::FullReduce()
+{
+    // Adding 2^3072 - p and dropping the 2^3072 bit subtracts p.
+    uint64_t c = MAX_PRIME_DIFF;
+    for (int i = 0; i < LIMBS; ++i) {
+        c += limbs[i];
+        limbs[i] = (uint32_t)c;
+        c >>= 32;
+    }
+}
+
+/** Add carry * 2^3072 to the value, using 2^3072 = MAX_PRIME_DIFF (mod p). */
+void Num3072::FoldCarry(uint64_t carry)
+{
+    while (carry) {
+        uint64_t c = carry * MAX_PRIME_DIFF;
+        for (int i = 0; i < LIMBS && c; ++i) {
+            c += limbs[i];
+            limbs[i] = (uint32_t)c;
+            c >>= 32;
+        }
+        carry = c;
+    }
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    uint32_t tmp[2 * LIMBS] = {};
+    for (int i = 0; i < LIMBS; ++i) {
+        uint64_t carry = 0;
+        for (int j = 0; j < LIMBS; ++j) {
+            // At most (2^32-1)^2 + 2 * (2^32-1) = 2^64 - 1, so this cannot overflow.
+            uint64_t cur = (uint64_t)limbs[i] * a.limbs[j] + tmp[i + j] + carry;
+            tmp[i + j] = (uint32_t)cur;
+            carry = cur >> 32;
+        }
+        tmp[i + LIMBS] = (uint32_t)carry;
+    }
+
+    // Fold the upper half onto the lower one.
+    uint64_t carry = 0;
+    for (int i = 0; i < LIMBS; ++i) {
+        uint64_t cur = (uint64_t)tmp[LIMBS + i] * MAX_PRIME_DIFF + tmp[i] + carry;
+        limbs[i] = (uint32_t)cur;
+        carry = cur >> 32;
+    }
+    FoldCarry(carry);
+}
+
+Num3072 Num3072::GetInverse() const
+{
+    // a^(p-2) = a^-1 (mod p) by Fermat. p - 2 has every bit set except in its lowest limb.
+    Num3072 base(*this);
+    if (base.IsOverflow()) base.FullReduce();
+    const uint32_t low_limb = 0xFFFFFFFF - MAX_PRIME_DIFF - 1;
+    Num3072 result;
+    for (int i = LIMBS - 1; i >= 0; --i) {
+        const uint32_t exponent = i == 0 ? low_limb : 0xFFFFFFFF;
+        for (int bit = 31; bit >= 0; --bit) {
+            result.Multiply(result);
+            if ((exponent >> bit) & 1) result.Multiply(base);
+        }
+    }
+    return result;
+}
+
+void Num3072::Divide(const Num3072& a)
+{
+    Multiply(a.GetInverse());
+}
+
+void Num3072::ToBytes(unsigned char (&out)[BYTE_SIZE])
+{
+    if (IsOverflow()) FullReduce();
+    for (int i = 0; i < LIMBS; ++i) {
+        WriteLE32(out + 4 * i, limbs[i]);
+    }
+}
+
+Num3072 MuHash3072::ToNum3072(const unsigned char* data, size_t len)
+{
+    unsigned char key[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(key);
+    unsigned char expanded[Num3072::BYTE_SIZE];
+    ChaCha20(key, sizeof(key)).Output(expanded, sizeof(expanded));
+    return Num3072(expanded);
+}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    m_numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    m_denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& mul)
+{
+    m_numerator.Multiply(mul.m_numerator);
+    m_denominator.Multiply(mul.m_denominator);
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator/=(const MuHash3072& div)
+{
+    m_numerator.Multiply(div.m_denominator);
+    m_denominator.Multiply(div.m_numerator);
+    return *this;
+}
+
+void MuHash3072::Finalize(unsigned char hash[OUTPUT_SIZE])
+{
+    m_numerator.Divide(m_denominator);
+    m_denominator.SetToOne();
+
+    unsigned char data[Num3072::BYTE_SIZE];
+    m_numerator.ToBytes(data);
+    CSHA256().Write(data, sizeof(data)).Finalize(hash);
+}
@@ -0,0 +1,90 @@
+// Copyright (c) 2020 The Earthcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** A number modulo the prime 2^3072 - 1103717, stored as little endian 32-bit limbs. */
+class Num3072
+{
+public:
+    static const int LIMBS = 96;
+    static const size_t BYTE_SIZE = LIMBS * 4;
+
+private:
+    uint32_t limbs[LIMBS];
+
+    bool IsOverflow() const;
+    void FullReduce();
+    void FoldCarry(uint64_t carry);
+    Num3072 GetInverse() const;
+
+public:
+    /** Constructs the number 1. */
+    Num3072() { SetToOne(); }
+    explicit Num3072(const unsigned char (&data)[BYTE_SIZE]);
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    void Divide(const Num3072& a);
+    void ToBytes(unsigned char (&out)[BYTE_SIZE]);
+};
+
+/**
+ * A rolling hash of a multiset of byte strings.
+ *
+ * Every element is expanded to a number modulo a 3072-bit prime and the set
+ * hash is the product of all of them, so elements can be added and removed
+ * in any order and two sets can be combined with a single multiplication.
+ * Removals are kept as a separate denominator so that the expensive modular
+ * inverse is only computed once, in Finalize.
+ */
+class MuHash3072
+{
+private:
+    Num3072 m_numerator;
+    Num3072 m_denominator;
+
+    static Num3072 ToNum3072(const unsigned char* data, size_t len);
+
+public:
+    static const size_t OUTPUT_SIZE = 32;
+
+    /** The hash of the empty set. */
+    MuHash3072() {}
+
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+
+    MuHash3072& operator*=(const MuHash3072& mul);
+    MuHash3072& operator/=(const MuHash3072& div);
+
+    /** Reduce the state to a single number and hash it. */
+    void Finalize(unsigned char hash[OUTPUT_SIZE]);
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        unsigned char data[Num3072::BYTE_SIZE];
+        Num3072(m_numerator).ToBytes(data);
+        s.write((const char*)data, sizeof(data));
+        Num3072(m_denominator).ToBytes(data);
+        s.write((const char*)data, sizeof(data));
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        unsigned char data[Num3072::BYTE_SIZE];
+        s.read((char*)data, sizeof(data));
+        m_numerator = Num3072(data);
+        s.read((char*)data, sizeof(data));
+        m_denominator = Num3072(data);
+    }
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
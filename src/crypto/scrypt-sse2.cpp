@@ -34,7 +34,6 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
-#include <openssl/sha.h>
 
 #include <emmintrin.h>
 
@@ -107,7 +106,8 @@ void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchp
 
 	V = (__m128i *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
 
-	PBKDF2_SHA256((const uint8_t *)input, 80, (const uint8_t *)input, 80, 1, B, 128);
+	CHMAC_SHA256 Pctx((const uint8_t *)input, 80);
+	PBKDF2_SHA256(Pctx, (const uint8_t *)input, 80, 1, B, 128);
 
 	for (k = 0; k < 2; k++) {
 		for (i = 0; i < 16; i++) {
@@ -135,7 +135,7 @@ void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchp
 		}
 	}
 
-	PBKDF2_SHA256((const uint8_t *)input, 80, B, 128, 1, (uint8_t *)output, 32);
+	PBKDF2_SHA256(Pctx, B, 128, 1, (uint8_t *)output, 32);
 }
 
 #endif // USE_SSE2
@@ -28,11 +28,28 @@
  */
 
 #include <crypto/scrypt.h>
+#include <crypto/common.h>
 
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
-#include <openssl/sha.h>
+
+#include <atomic>
+#include <new>
+
+#if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#include <cpuid.h>
+#endif
+
+namespace scrypt_avx2
+{
+void scrypt_1024_1_1_256_sp_8way(const char* const input[8], char* const output[8], char* scratchpad);
+}
+
+namespace scrypt_avx512
+{
+void scrypt_1024_1_1_256_sp_16way(const char* const input[16], char* const output[16], char* scratchpad);
+}
 
 #if defined(USE_SSE2) && !defined(USE_SSE2_ALWAYS)
 #ifdef _MSC_VER
@@ -61,74 +78,6 @@ static inline void be32enc(void *pp, uint32_t x)
 }
 
 #endif
-typedef struct HMAC_SHA256Context {
-	SHA256_CTX ictx;
-	SHA256_CTX octx;
-} HMAC_SHA256_CTX;
-
-/* Initialize an HMAC-SHA256 operation with the given key. */
-static void
-HMAC_SHA256_Init(HMAC_SHA256_CTX *ctx, const void *_K, size_t Klen)
-{
-	unsigned char pad[64];
-	unsigned char khash[32];
-	const unsigned char *K = (const unsigned char *)_K;
-	size_t i;
-
-	/* If Klen > 64, the key is really SHA256(K). */
-	if (Klen > 64) {
-		SHA256_Init(&ctx->ictx);
-		SHA256_Update(&ctx->ictx, K, Klen);
-		SHA256_Final(khash, &ctx->ictx);
-		K = khash;
-		Klen = 32;
-	}
-
-	/* Inner SHA256 operation is SHA256(K xor [block of 0x36] || data). */
-	SHA256_Init(&ctx->ictx);
-	memset(pad, 0x36, 64);
-	for (i = 0; i < Klen; i++)
-		pad[i] ^= K[i];
-	SHA256_Update(&ctx->ictx, pad, 64);
-
-	/* Outer SHA256 operation is SHA256(K xor [block of 0x5c] || hash). */
-	SHA256_Init(&ctx->octx);
-	memset(pad, 0x5c, 64);
-	for (i = 0; i < Klen; i++)
-		pad[i] ^= K[i];
-	SHA256_Update(&ctx->octx, pad, 64);
-
-	/* Clean the stack. */
-	memset(khash, 0, 32);
-}
-
-/* Add bytes to the HMAC-SHA256 operation. */
-static void
-HMAC_SHA256_Update(HMAC_SHA256_CTX *ctx, const void *in, size_t len)
-{
-	/* Feed data to the inner SHA256 operation. */
-	SHA256_Update(&ctx->ictx, in, len);
-}
-
-/* Finish an HMAC-SHA256 operation. */
-static void
-HMAC_SHA256_Final(unsigned char digest[32], HMAC_SHA256_CTX *ctx)
-{
-	unsigned char ihash[32];
-
-	/* Finish the inner SHA256 operation. */
-	SHA256_Final(ihash, &ctx->ictx);
-
-	/* Feed the inner hash to the outer SHA256 operation. */
-	SHA256_Update(&ctx->octx, ihash, 32);
-
-	/* Finish the outer SHA256 operation. */
-	SHA256_Final(digest, &ctx->octx);
-
-	/* Clean the stack. */
-	memset(ihash, 0, 32);
-}
-
 /**
  * PBKDF2_SHA256(passwd, passwdlen, salt, saltlen, c, buf, dkLen):
  * Compute PBKDF2(passwd, salt, c, dkLen) using HMAC-SHA256 as the PRF, and
@@ -138,7 +87,15 @@ void
 PBKDF2_SHA256(const uint8_t *passwd, size_t passwdlen, const uint8_t *salt,
     size_t saltlen, uint64_t c, uint8_t *buf, size_t dkLen)
 {
-	HMAC_SHA256_CTX PShctx, hctx;
+	CHMAC_SHA256 Pctx(passwd, passwdlen);
+
+	PBKDF2_SHA256(Pctx, salt, saltlen, c, buf, dkLen);
+}
+
+void
+PBKDF2_SHA256(const CHMAC_SHA256 &Pctx, const uint8_t *salt, size_t saltlen,
+    uint64_t c, uint8_t *buf, size_t dkLen)
+{
 	size_t i;
 	uint8_t ivec[4];
 	uint8_t U[32];
@@ -148,8 +105,8 @@ PBKDF2_SHA256(const uint8_t *passwd, size_t passwdlen, const uint8_t *salt,
 	size_t clen;
 
 	/* Compute HMAC state after processing P and S. */
-	HMAC_SHA256_Init(&PShctx, passwd, passwdlen);
-	HMAC_SHA256_Update(&PShctx, salt, saltlen);
+	CHMAC_SHA256 PShctx = Pctx;
+	PShctx.Write(salt, saltlen);
 
 	/* Iterate through the blocks. */
 	for (i = 0; i * 32 < dkLen; i++) {
@@ -157,18 +114,18 @@ PBKDF2_SHA256(const uint8_t *passwd, size_t passwdlen, const uint8_t *salt,
 		be32enc(ivec, (uint32_t)(i + 1));
 
 		/* Compute U_1 = PRF(P, S || INT(i)). */
-		memcpy(&hctx, &PShctx, sizeof(HMAC_SHA256_CTX));
-		HMAC_SHA256_Update(&hctx, ivec, 4);
-		HMAC_SHA256_Final(U, &hctx);
+		CHMAC_SHA256 hctx = PShctx;
+		hctx.Write(ivec, 4);
+		hctx.Finalize(U);
 
 		/* T_i = U_1 ... */
 		memcpy(T, U, 32);
 
 		for (j = 2; j <= c; j++) {
 			/* Compute U_j. */
-			HMAC_SHA256_Init(&hctx, passwd, passwdlen);
-			HMAC_SHA256_Update(&hctx, U, 32);
-			HMAC_SHA256_Final(U, &hctx);
+			CHMAC_SHA256 Uctx = Pctx;
+			Uctx.Write(U, 32);
+			Uctx.Finalize(U);
 
 			/* ... xor U_j ... */
 			for (k = 0; k < 32; k++)
@@ -181,9 +138,6 @@ PBKDF2_SHA256(const uint8_t *passwd, size_t passwdlen, const uint8_t *salt,
 			clen = 32;
 		memcpy(&buf[i * 32], T, clen);
 	}
-
-	/* Clean PShctx, since we never called _Final on it. */
-	memset(&PShctx, 0, sizeof(HMAC_SHA256_CTX));
 }
 
 #define ROTL(a, b) (((a) << (b)) | ((a) >> (32 - (b))))
@@ -263,7 +217,9 @@ void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scrat
 
 	V = (uint32_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
 
-	PBKDF2_SHA256((const uint8_t *)input, 80, (const uint8_t *)input, 80, 1, B, 128);
+	/* Both passes are keyed by the input: derive the HMAC pads once. */
+	CHMAC_SHA256 Pctx((const uint8_t *)input, 80);
+	PBKDF2_SHA256(Pctx, (const uint8_t *)input, 80, 1, B, 128);
 
 	for (k = 0; k < 32; k++)
 		X[k] = le32dec(&B[4 * k]);
@@ -284,7 +240,7 @@ void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scrat
 	for (k = 0; k < 32; k++)
 		le32enc(&B[4 * k], X[k]);
 
-	PBKDF2_SHA256((const uint8_t *)input, 80, B, 128, 1, (uint8_t *)output, 32);
+	PBKDF2_SHA256(Pctx, B, 128, 1, (uint8_t *)output, 32);
 }
 
 #if defined(USE_SSE2)
@@ -325,8 +281,209 @@ std::string scrypt_detect_sse2()
 }
 #endif
 
+/** The calling thread's scratchpad, or nullptr if it cannot be allocated. */
+static char *scrypt_try_thread_scratchpad(size_t size)
+{
+	try {
+		return scrypt_thread_scratchpad(size);
+	} catch (const std::bad_alloc&) {
+		return nullptr;
+	}
+}
+
 void scrypt_1024_1_1_256(const char *input, char *output)
 {
-	char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
-    scrypt_1024_1_1_256_sp(input, output, scratchpad);
+	char *scratchpad = scrypt_try_thread_scratchpad(SCRYPT_SCRATCHPAD_SIZE);
+	if (scratchpad == nullptr) {
+		/* Callers such as GetPoWHash, also built into libbitcoinconsensus, have no way
+		 * to report a failure, and a wrong hash would fail a valid block: hash in a
+		 * scratchpad on the stack, as before there were thread scratchpads. */
+		char stack_scratchpad[SCRYPT_SCRATCHPAD_SIZE];
+		scrypt_1024_1_1_256_sp(input, output, stack_scratchpad);
+		return;
+	}
+	scrypt_1024_1_1_256_sp(input, output, scratchpad);
+	scrypt_count_hashes(1);
+}
+
+/* Multi-buffer kernel: hashes "lanes" inputs at once in a lanes * 128 KiB scratchpad. */
+typedef void (*scrypt_multi_kernel)(const char* const input[], char* const output[], char* scratchpad);
+
+struct scrypt_multi_impl
+{
+	scrypt_multi_kernel kernel;
+	size_t lanes;
+};
+
+static const scrypt_multi_impl scrypt_multi_none = {nullptr, 1};
+#if defined(ENABLE_AVX2)
+static const scrypt_multi_impl scrypt_multi_avx2 = {&scrypt_avx2::scrypt_1024_1_1_256_sp_8way, 8};
+#endif
+#if defined(ENABLE_AVX512)
+static const scrypt_multi_impl scrypt_multi_avx512 = {&scrypt_avx512::scrypt_1024_1_1_256_sp_16way, 16};
+#endif
+
+/* Kernel and lane count are swapped together, so hashing threads never see one without the other. */
+static std::atomic<const scrypt_multi_impl*> scrypt_multi(&scrypt_multi_none);
+
+static size_t scrypt_multi_scratchpad_size(const scrypt_multi_impl* impl)
+{
+	return (SCRYPT_SCRATCHPAD_SIZE - 63) * impl->lanes + 63;
+}
+
+size_t scrypt_multi_scratchpad_size()
+{
+	return scrypt_multi_scratchpad_size(scrypt_multi.load());
+}
+
+size_t scrypt_multi_lane_count()
+{
+	return scrypt_multi.load()->lanes;
+}
+
+static void scrypt_multi_hash(const scrypt_multi_impl* impl, const char* const inputs[], char* const outputs[], size_t n, char *scratchpad)
+{
+	size_t i = 0;
+
+	if (impl->kernel != nullptr && n > 1) {
+		const size_t lanes = impl->lanes;
+		const char *in[16];
+		char *out[16];
+		char dummy[16][32];
+
+		/* Leave short tails to the one-lane code, where they are cheaper. */
+		for (; i < n && n - i >= lanes / 2; i += lanes) {
+			/* Pad a partial batch by repeating its first input. */
+			for (size_t l = 0; l < lanes; l++) {
+				in[l] = i + l < n ? inputs[i + l] : inputs[i];
+				out[l] = i + l < n ? outputs[i + l] : dummy[l];
+			}
+			impl->kernel(in, out, scratchpad);
+		}
+	}
+
+	for (; i < n; i++)
+		scrypt_1024_1_1_256_sp(inputs[i], outputs[i], scratchpad);
+	scrypt_count_hashes(n);
+}
+
+void scrypt_1024_1_1_256_multi_sp(const char* const inputs[], char* const outputs[], size_t n, char *scratchpad)
+{
+	scrypt_multi_hash(scrypt_multi.load(), inputs, outputs, n, scratchpad);
+}
+
+void scrypt_1024_1_1_256_multi(const char* const inputs[], char* const outputs[], size_t n)
+{
+	const scrypt_multi_impl* impl = scrypt_multi.load();
+	char *scratchpad = scrypt_try_thread_scratchpad(scrypt_multi_scratchpad_size(impl));
+	if (scratchpad == nullptr) {
+		for (size_t i = 0; i < n; i++)
+			scrypt_1024_1_1_256(inputs[i], outputs[i]);
+		return;
+	}
+	scrypt_multi_hash(impl, inputs, outputs, n, scratchpad);
+}
+
+/** Multi-buffer kernels the CPU runs, each checked once against the generic code. */
+struct scrypt_multi_support
+{
+	bool avx2 = false;
+	bool avx512 = false;
+	bool selftest_failed = false;
+};
+
+#if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__)) && !defined(BUILD_BITCOIN_INTERNAL)
+/** Check whether the OS saves the AVX (mask 0x6) or AVX-512 (mask 0xe6) register state. */
+static bool scrypt_xsave_enabled(uint32_t mask)
+{
+	uint32_t a, d;
+	__asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+	return (a & mask) == mask;
+}
+
+/** Compare a kernel against the generic code on distinct inputs in every lane. */
+static bool scrypt_multi_selftest(const scrypt_multi_impl* impl)
+{
+	char inputs[13][80];
+	char outputs[13][32];
+	char expected[32];
+	const char *in[13];
+	char *out[13];
+
+	/* 13 inputs make the last batch of either kernel a padded one. */
+	for (int i = 0; i < 13; i++) {
+		for (int j = 0; j < 80; j++)
+			inputs[i][j] = (char)(i * 31 + j);
+		in[i] = inputs[i];
+		out[i] = outputs[i];
+	}
+	scrypt_multi_hash(impl, in, out, 13, scrypt_thread_scratchpad(scrypt_multi_scratchpad_size(impl)));
+	for (int i = 0; i < 13; i++) {
+		scrypt_1024_1_1_256(inputs[i], expected);
+		if (memcmp(expected, outputs[i], 32) != 0)
+			return false;
+	}
+	return true;
+}
+#endif
+
+static scrypt_multi_support scrypt_multi_detect_cpu()
+{
+	scrypt_multi_support support;
+#if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__)) && !defined(BUILD_BITCOIN_INTERNAL)
+	uint32_t eax, ebx, ecx, edx;
+	bool have_avx2 = false;
+	bool have_avx512 = false;
+
+	__cpuid(0, eax, ebx, ecx, edx);
+	const uint32_t max_leaf = eax;
+	__cpuid(1, eax, ebx, ecx, edx);
+	/* OSXSAVE and AVX, and leaf 7 for the AVX2 and AVX-512 bits */
+	if (((ecx >> 27) & 1) && ((ecx >> 28) & 1) && scrypt_xsave_enabled(0x6) && max_leaf >= 7) {
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		have_avx2 = (ebx >> 5) & 1;
+		have_avx512 = ((ebx >> 16) & 1) && scrypt_xsave_enabled(0xe6);
+	}
+	(void)have_avx2;
+	(void)have_avx512;
+
+#if defined(ENABLE_AVX2)
+	if (have_avx2) {
+		support.avx2 = scrypt_multi_selftest(&scrypt_multi_avx2);
+		support.selftest_failed |= !support.avx2;
+	}
+#endif
+#if defined(ENABLE_AVX512)
+	if (have_avx512) {
+		support.avx512 = scrypt_multi_selftest(&scrypt_multi_avx512);
+		support.selftest_failed |= !support.avx512;
+	}
+#endif
+#endif
+	return support;
+}
+
+std::string scrypt_detect_multi(size_t max_lanes)
+{
+	static const scrypt_multi_support support = scrypt_multi_detect_cpu();
+	const scrypt_multi_impl* impl = &scrypt_multi_none;
+	std::string ret = support.selftest_failed ? "scrypt: multi-buffer kernel failed self-test, hashing one input at a time"
+	                                          : "scrypt: multi-buffer kernel unavailable, hashing one input at a time";
+	(void)max_lanes;
+
+#if defined(ENABLE_AVX2)
+	if (support.avx2 && max_lanes >= 8) {
+		impl = &scrypt_multi_avx2;
+		ret = "scrypt: using avx2(8way) multi-buffer kernel";
+	}
+#endif
+#if defined(ENABLE_AVX512)
+	if (support.avx512 && max_lanes >= 16) {
+		impl = &scrypt_multi_avx512;
+		ret = "scrypt: using avx512(16way) multi-buffer kernel";
+	}
+#endif
+
+	scrypt_multi.store(impl);
+	return ret;
 }
@@ -1,16 +1,72 @@
 #ifndef BITCOIN_CRYPTO_SCRYPT_H
 #define BITCOIN_CRYPTO_SCRYPT_H
 
+#include <crypto/hmac_sha256.h>
+
 #include <stdlib.h>
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 static const int SCRYPT_SCRATCHPAD_SIZE = 131072 + 63;
 
+/** Hash one 80-byte input. Never throws: without memory for the thread's
+ *  scratchpad, it hashes in one on the stack.
+ */
 void scrypt_1024_1_1_256(const char *input, char *output);
 void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad);
 
+/** Hash n 80-byte inputs, running as many of them side by side as the
+ *  multi-buffer kernel chosen by scrypt_detect_multi() has lanes.
+ *  inputs:  n pointers to 80-byte inputs
+ *  outputs: n pointers to 32-byte output buffers
+ *  Never throws: without memory for the scratchpad, it hashes one input at a time.
+ */
+void scrypt_1024_1_1_256_multi(const char* const inputs[], char* const outputs[], size_t n);
+
+/** Same, using a caller-provided scratchpad of scrypt_multi_scratchpad_size() bytes,
+ *  so that callers hashing in a loop can reuse it.
+ */
+void scrypt_1024_1_1_256_multi_sp(const char* const inputs[], char* const outputs[], size_t n, char *scratchpad);
+size_t scrypt_multi_scratchpad_size();
+
+/** Number of lanes of the multi-buffer kernel in use, 1 when hashing one input at a time. */
+size_t scrypt_multi_lane_count();
+
+/** Return a scratchpad of at least size bytes owned by the calling thread.
+ *  It is page aligned, reused by every later call on the same thread and freed
+ *  when the thread exits, so hashing needs neither a 128 KiB stack frame nor a
+ *  malloc per hash. Throws std::bad_alloc if no memory can be had.
+ */
+char *scrypt_thread_scratchpad(size_t size);
+
+/** Add n to the calling thread's hash counter. */
+void scrypt_count_hashes(uint64_t n);
+
+/** Back scratchpads allocated from now on with huge pages where the OS allows it. */
+void scrypt_set_huge_pages(bool enable);
+
+struct ScryptThreadStats
+{
+    std::string name;  //!< name of the thread when it first hashed
+    uint64_t hashes;   //!< scrypt hashes computed by the thread
+    size_t scratchpad; //!< bytes of scratchpad the thread holds
+    bool huge_pages;   //!< whether that scratchpad is backed by huge pages
+};
+
+/** Counters of the threads that have hashed and are still running. Threads that
+ *  have exited are summed into one last entry named "exited".
+ */
+std::vector<ScryptThreadStats> scrypt_thread_stats();
+
+/** Autodetect the widest multi-buffer scrypt kernel (AVX-512 16-way, AVX2 8-way)
+ *  usable on this CPU with at most max_lanes lanes. Returns the name of the
+ *  implementation. The CPU is only probed on the first call; threads hashing
+ *  meanwhile switch kernels with their next call.
+ */
+std::string scrypt_detect_multi(size_t max_lanes = 16);
+
 #if defined(USE_SSE2)
-#include <string>
 #if defined(_M_X64) || defined(__x86_64__) || defined(_M_AMD64) || (defined(MAC_OSX) && defined(__i386__))
 #define USE_SSE2_ALWAYS 1
 #define scrypt_1024_1_1_256_sp(input, output, scratchpad) scrypt_1024_1_1_256_sp_sse2((input), (output), (scratchpad))
@@ -29,6 +85,12 @@ void
 PBKDF2_SHA256(const uint8_t *passwd, size_t passwdlen, const uint8_t *salt,
     size_t saltlen, uint64_t c, uint8_t *buf, size_t dkLen);
 
+/* Same, with the HMAC already keyed by the password. scrypt runs PBKDF2 twice
+ * with the same 80-byte password, so both passes can share one key schedule. */
+void
+PBKDF2_SHA256(const CHMAC_SHA256 &Pctx, const uint8_t *salt, size_t saltlen,
+    uint64_t c, uint8_t *buf, size_t dkLen);
+
 #ifndef __FreeBSD__
 static inline uint32_t le32dec(const void *pp)
 {
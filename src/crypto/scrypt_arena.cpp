@@ -0,0 +1,196 @@
+// Copyright (c) 2020 The Earthcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include <config/bitcoin-config.h>
+#endif
+
+#include <crypto/scrypt.h>
+
+#ifndef WIN32
+#include <sys/mman.h> // for mmap
+#endif
+#ifdef HAVE_SYS_PRCTL_H
+#include <sys/prctl.h>
+#endif
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <new>
+
+// Some systems (at least OS X) do not define MAP_ANONYMOUS yet and define
+// MAP_ANON which is deprecated
+#if !defined(WIN32) && !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+namespace {
+
+/** Size of the huge pages MAP_HUGETLB hands out by default on x86 and ARM. */
+const size_t SCRYPT_HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+std::atomic<bool> g_huge_pages(false);
+
+/** Scratchpad and counters of one thread. Only the owning thread writes them. */
+struct ScryptThreadState
+{
+    std::string name;
+    std::atomic<uint64_t> hashes{0};
+    std::atomic<size_t> size{0};
+    std::atomic<bool> huge_pages{false};
+    char* base = nullptr;
+    bool mapped = false;
+};
+
+/** All threads that have hashed, plus the totals of those that have exited. */
+struct ScryptRegistry
+{
+    std::mutex mutex;
+    std::list<ScryptThreadState*> threads;
+    uint64_t exited_hashes = 0;
+    uint64_t exited_threads = 0;
+};
+
+// Leaked on purpose: thread_local destructors may still run during static destruction.
+ScryptRegistry& Registry()
+{
+    static ScryptRegistry* registry = new ScryptRegistry();
+    return *registry;
+}
+
+void Release(ScryptThreadState& state)
+{
+    if (state.base == nullptr) return;
+#ifndef WIN32
+    if (state.mapped) {
+        munmap(state.base, state.size);
+    } else
+#endif
+    {
+        free(state.base);
+    }
+    state.base = nullptr;
+    state.size = 0;
+    state.huge_pages = false;
+}
+
+/** Map size bytes of page-aligned (hence cache-line aligned) memory into state. */
+bool Allocate(ScryptThreadState& state, size_t size)
+{
+#ifndef WIN32
+    if (g_huge_pages) {
+#ifdef MAP_HUGETLB
+        // Explicit huge pages only exist if the administrator reserved some; fall through if not.
+        const size_t huge_size = (size + SCRYPT_HUGE_PAGE_SIZE - 1) & ~(SCRYPT_HUGE_PAGE_SIZE - 1);
+        void* addr = mmap(nullptr, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (addr != MAP_FAILED) {
+            state.base = static_cast<char*>(addr);
+            state.size = huge_size;
+            state.mapped = true;
+            state.huge_pages = true;
+            return true;
+        }
+#endif
+    }
+    void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr != MAP_FAILED) {
+        state.base = static_cast<char*>(addr);
+        state.size = size;
+        state.mapped = true;
+#ifdef MADV_HUGEPAGE
+        if (g_huge_pages) state.huge_pages = madvise(addr, size, MADV_HUGEPAGE) == 0;
+#endif
+        return true;
+    }
+#endif
+    state.base = static_cast<char*>(malloc(size));
+    if (state.base == nullptr) return false;
+    state.size = size;
+    state.mapped = false;
+    return true;
+}
+
+/** Registers the calling thread on first use and folds its counters away when it exits. */
+class ScryptThreadHandle
+{
+public:
+    ScryptThreadState state;
+
+    ScryptThreadHandle()
+    {
+#ifdef PR_GET_NAME
+        char name[17] = {};
+        if (::prctl(PR_GET_NAME, name, 0, 0, 0) == 0) state.name = name;
+#endif
+        ScryptRegistry& registry = Registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.threads.push_back(&state);
+    }
+
+    ~ScryptThreadHandle()
+    {
+        ScryptRegistry& registry = Registry();
+        {
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            registry.threads.remove(&state);
+            registry.exited_hashes += state.hashes;
+            ++registry.exited_threads;
+        }
+        Release(state);
+    }
+};
+
+ScryptThreadHandle& ThisThread()
+{
+    static thread_local ScryptThreadHandle handle;
+    return handle;
+}
+
+} // namespace
+
+char* scrypt_thread_scratchpad(size_t size)
+{
+    ScryptThreadState& state = ThisThread().state;
+    if (state.size < size) {
+        Release(state);
+        if (!Allocate(state, size)) throw std::bad_alloc();
+    }
+    return state.base;
+}
+
+void scrypt_count_hashes(uint64_t n)
+{
+    std::atomic<uint64_t>& hashes = ThisThread().state.hashes;
+    hashes.store(hashes.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void scrypt_set_huge_pages(bool enable)
+{
+    g_huge_pages = enable;
+}
+
+std::vector<ScryptThreadStats> scrypt_thread_stats()
+{
+    std::vector<ScryptThreadStats> stats;
+    ScryptRegistry& registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (const ScryptThreadState* state : registry.threads) {
+        ScryptThreadStats entry;
+        entry.name = state->name;
+        entry.hashes = state->hashes;
+        entry.scratchpad = state->size;
+        entry.huge_pages = state->huge_pages;
+        stats.push_back(entry);
+    }
+    if (registry.exited_threads > 0) {
+        ScryptThreadStats entry;
+        entry.name = "exited";
+        entry.hashes = registry.exited_hashes;
+        entry.scratchpad = 0;
+        entry.huge_pages = false;
+        stats.push_back(entry);
+    }
+    return stats;
+}
@@ -0,0 +1,116 @@
+// Copyright (c) 2020 The Earthcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// 8-way interleaved scrypt(1024,1,1,256): lane l of every __m256i belongs to input l.
+
+#ifdef ENABLE_AVX2
+
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+#include <vector>
+
+#include <crypto/scrypt.h>
+
+namespace scrypt_avx2 {
+namespace {
+
+__m256i inline Rotl(__m256i x, int n) { return _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - n)); }
+
+#define QR(a, b, c, n) a = _mm256_xor_si256(a, Rotl(_mm256_add_epi32(b, c), n))
+
+void inline xor_salsa8(__m256i B[16], const __m256i Bx[16])
+{
+    __m256i x[16];
+    for (int i = 0; i < 16; i++)
+        x[i] = B[i] = _mm256_xor_si256(B[i], Bx[i]);
+
+    for (int i = 0; i < 8; i += 2) {
+        /* Operate on columns. */
+        QR(x[ 4], x[ 0], x[12],  7);  QR(x[ 9], x[ 5], x[ 1],  7);
+        QR(x[14], x[10], x[ 6],  7);  QR(x[ 3], x[15], x[11],  7);
+
+        QR(x[ 8], x[ 4], x[ 0],  9);  QR(x[13], x[ 9], x[ 5],  9);
+        QR(x[ 2], x[14], x[10],  9);  QR(x[ 7], x[ 3], x[15],  9);
+
+        QR(x[12], x[ 8], x[ 4], 13);  QR(x[ 1], x[13], x[ 9], 13);
+        QR(x[ 6], x[ 2], x[14], 13);  QR(x[11], x[ 7], x[ 3], 13);
+
+        QR(x[ 0], x[12], x[ 8], 18);  QR(x[ 5], x[ 1], x[13], 18);
+        QR(x[10], x[ 6], x[ 2], 18);  QR(x[15], x[11], x[ 7], 18);
+
+        /* Operate on rows. */
+        QR(x[ 1], x[ 0], x[ 3],  7);  QR(x[ 6], x[ 5], x[ 4],  7);
+        QR(x[11], x[10], x[ 9],  7);  QR(x[12], x[15], x[14],  7);
+
+        QR(x[ 2], x[ 1], x[ 0],  9);  QR(x[ 7], x[ 6], x[ 5],  9);
+        QR(x[ 8], x[11], x[10],  9);  QR(x[13], x[12], x[15],  9);
+
+        QR(x[ 3], x[ 2], x[ 1], 13);  QR(x[ 4], x[ 7], x[ 6], 13);
+        QR(x[ 9], x[ 8], x[11], 13);  QR(x[14], x[13], x[12], 13);
+
+        QR(x[ 0], x[ 3], x[ 2], 18);  QR(x[ 5], x[ 4], x[ 7], 18);
+        QR(x[10], x[ 9], x[ 8], 18);  QR(x[15], x[14], x[13], 18);
+    }
+
+    for (int i = 0; i < 16; i++)
+        B[i] = _mm256_add_epi32(B[i], x[i]);
+}
+
+#undef QR
+
+} // namespace
+
+void scrypt_1024_1_1_256_sp_8way(const char* const input[8], char* const output[8], char* scratchpad)
+{
+    uint8_t B[8][128];
+    uint32_t lanes[8];
+    __m256i X[32];
+    __m256i* V;
+
+    V = (__m256i*)(((uintptr_t)(scratchpad) + 63) & ~(uintptr_t)(63));
+
+    std::vector<CHMAC_SHA256> Pctx;
+    Pctx.reserve(8);
+    for (int l = 0; l < 8; l++) {
+        Pctx.emplace_back((const uint8_t*)input[l], 80);
+        PBKDF2_SHA256(Pctx[l], (const uint8_t*)input[l], 80, 1, B[l], 128);
+    }
+
+    for (int k = 0; k < 32; k++) {
+        for (int l = 0; l < 8; l++)
+            lanes[l] = le32dec(&B[l][4 * k]);
+        X[k] = _mm256_loadu_si256((const __m256i*)lanes);
+    }
+
+    for (int i = 0; i < 1024; i++) {
+        memcpy(&V[i * 32], X, sizeof(X));
+        xor_salsa8(&X[0], &X[16]);
+        xor_salsa8(&X[16], &X[0]);
+    }
+
+    // Every lane picks its own V row; gather word k of row j_l from lane l's column.
+    const __m256i lane_index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i row_mask = _mm256_set1_epi32(1023);
+    for (int i = 0; i < 1024; i++) {
+        __m256i index = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(X[16], row_mask), 8), lane_index);
+        for (int k = 0; k < 32; k++)
+            X[k] = _mm256_xor_si256(X[k], _mm256_i32gather_epi32((const int*)&V[k], index, 4));
+        xor_salsa8(&X[0], &X[16]);
+        xor_salsa8(&X[16], &X[0]);
+    }
+
+    for (int k = 0; k < 32; k++) {
+        _mm256_storeu_si256((__m256i*)lanes, X[k]);
+        for (int l = 0; l < 8; l++)
+            le32enc(&B[l][4 * k], lanes[l]);
+    }
+
+    for (int l = 0; l < 8; l++)
+        PBKDF2_SHA256(Pctx[l], B[l], 128, 1, (uint8_t*)output[l], 32);
+}
+
+} // namespace scrypt_avx2
+
+#endif // ENABLE_AVX2
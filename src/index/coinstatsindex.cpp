@@ -0,0 +1,270 @@
+// Copyright (c) 2020 The Earthcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <index/coinstatsindex.h>
+
+#include <chainparams.h>
+#include <coins.h>
+#include <streams.h>
+#include <undo.h>
+#include <util.h>
+#include <validation.h>
+
+constexpr char DB_BLOCK_STATS = 's';
+constexpr char DB_MUHASH = 'M';
+
+std::unique_ptr<CoinStatsIndex> g_coin_stats_index;
+
+namespace {
+
+/** Serialize a coin the way it is committed to in the UTXO set MuHash. */
+CDataStream TxOutSer(const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << outpoint;
+    ss << static_cast<uint32_t>(coin.nHeight * 2 + coin.fCoinBase);
+    ss << coin.out;
+    return ss;
+}
+
+} // namespace
+
+void ApplyCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss = TxOutSer(outpoint, coin);
+    muhash.Insert((const unsigned char*)ss.data(), ss.size());
+}
+
+void RemoveCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss = TxOutSer(outpoint, coin);
+    muhash.Remove((const unsigned char*)ss.data(), ss.size());
+}
+
+uint64_t GetBogoSize(const CScript& script_pub_key)
+{
+    return 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
+           2 /* scriptPubKey len */ + script_pub_key.size() /* scriptPubKey */;
+}
+
+/**
+ * Access to the coinstats index database (indexes/coinstats/)
+ *
+ * The database stores the Stats of every block, keyed by block hash, the
+ * rolling MuHash of the last block indexed, and the block locator of the
+ * chain the index is synced to.
+ */
+class CoinStatsIndex::DB : public BaseIndex::DB
+{
+public:
+    explicit DB(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    bool ReadStats(const uint256& block_hash, Stats& stats) const;
+
+    bool ReadMuHash(uint256& block_hash, MuHash3072& muhash) const;
+
+    /// Write the statistics of a block and the rolling hash as of it in one batch.
+    bool WriteStats(const uint256& block_hash, const Stats& stats, const MuHash3072& muhash);
+};
+
+CoinStatsIndex::DB::DB(size_t n_cache_size, bool f_memory, bool f_wipe) :
+    BaseIndex::DB(GetDataDir() / "indexes" / "coinstats", n_cache_size, f_memory, f_wipe)
+{}
+
+bool CoinStatsIndex::DB::ReadStats(const uint256& block_hash, Stats& stats) const
+{
+    return Read(std::make_pair(DB_BLOCK_STATS, block_hash), stats);
+}
+
+bool CoinStatsIndex::DB::ReadMuHash(uint256& block_hash, MuHash3072& muhash) const
+{
+    std::pair<uint256, MuHash3072> value;
+    if (!Read(DB_MUHASH, value)) {
+        return false;
+    }
+    block_hash = value.first;
+    muhash = value.second;
+    return true;
+}
+
+bool CoinStatsIndex::DB::WriteStats(const uint256& block_hash, const Stats& stats, const MuHash3072& muhash)
+{
+    CDBBatch batch(*this);
+    batch.Write(std::make_pair(DB_BLOCK_STATS, block_hash), stats);
+    batch.Write(DB_MUHASH, std::make_pair(block_hash, muhash));
+    return WriteBatch(batch);
+}
+
+/**
+ * Add the coins a block creates to the rolling hash and statistics and take
+ * out those it spends, or the other way around to undo the block.
+ */
+static bool ApplyBlock(MuHash3072& muhash, CoinStatsIndex::Stats& stats, const CBlock& block, const CBlockIndex* pindex, bool connect)
+{
+    CBlockUndo block_undo;
+    if (!UndoReadFromDisk(block_undo, pindex)) {
+        return error("%s: cannot read undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+    }
+    if (block_undo.vtxundo.size() + 1 != block.vtx.size()) {
+        return error("%s: undo data of block %s does not match the block", __func__, pindex->GetBlockHash().ToString());
+    }
+
+    auto add_coin = [&muhash, &stats](const COutPoint& outpoint, const Coin& coin) {
+        ApplyCoinHash(muhash, outpoint, coin);
+        stats.transaction_output_count++;
+        stats.bogo_size += GetBogoSize(coin.out.scriptPubKey);
+        stats.total_amount += coin.out.nValue;
+    };
+    auto remove_coin = [&muhash, &stats](const COutPoint& outpoint, const Coin& coin) {
+        RemoveCoinHash(muhash, outpoint, coin);
+        stats.transaction_output_count--;
+        stats.bogo_size -= GetBogoSize(coin.out.scriptPubKey);
+        stats.total_amount -= coin.out.nValue;
+    };
+
+    const CAmount subsidy = GetBlockSubsidy(pindex->nHeight, Params().GetConsensus());
+    stats.total_subsidy += connect ? subsidy : -subsidy;
+
+    for (size_t i = 0; i < block.vtx.size(); ++i) {
+        const CTransaction& tx = *block.vtx[i];
+        const uint256& txid = tx.GetHash();
+        for (uint32_t n = 0; n < tx.vout.size(); ++n) {
+            const CTxOut& out = tx.vout[n];
+            if (out.scriptPubKey.IsUnspendable()) continue;
+            const COutPoint outpoint(txid, n);
+            const Coin coin(out, pindex->nHeight, tx.IsCoinBase());
+            connect ? add_coin(outpoint, coin) : remove_coin(outpoint, coin);
+        }
+
+        if (tx.IsCoinBase()) continue;
+
+        const CTxUndo& tx_undo = block_undo.vtxundo[i - 1];
+        if (tx_undo.vprevout.size() != tx.vin.size()) {
+            return error("%s: undo data of transaction %s does not match it", __func__, txid.ToString());
+        }
+        for (size_t j = 0; j < tx.vin.size(); ++j) {
+            const Coin& coin = tx_undo.vprevout[j];
+            connect ? remove_coin(tx.vin[j].prevout, coin) : add_coin(tx.vin[j].prevout, coin);
+        }
+    }
+    return true;
+}
+
+CoinStatsIndex::CoinStatsIndex(size_t n_cache_size, bool f_memory, bool f_wipe)
+    : m_db(MakeUnique<CoinStatsIndex::DB>(n_cache_size, f_memory, f_wipe))
+{}
+
+CoinStatsIndex::~CoinStatsIndex() {}
+
+bool CoinStatsIndex::Init()
+{
+    const CBlockIndex* genesis;
+    {
+        LOCK(cs_main);
+        genesis = chainActive.Genesis();
+    }
+    if (!genesis) return BaseIndex::Init();
+
+    uint256 block_hash;
+    if (m_db->ReadMuHash(block_hash, m_muhash)) {
+        {
+            LOCK(cs_main);
+            m_muhash_block = LookupBlockIndex(block_hash);
+        }
+        if (!m_muhash_block || !m_db->ReadStats(block_hash, m_stats)) {
+            return error("%s: cannot find block %s the UTXO set hash was last updated for", __func__, block_hash.ToString());
+        }
+        return BaseIndex::Init();
+    }
+
+    // The sync starts after the genesis block, so its entry, which every
+    // later one builds on, is written here. An index without a rolling hash
+    // is synced again from the start.
+    m_muhash = MuHash3072();
+    m_stats = Stats();
+    m_muhash.Finalize(m_stats.muhash.begin());
+    m_muhash_block = genesis;
+    if (!m_db->WriteBestBlock(CBlockLocator()) || !m_db->WriteStats(genesis->GetBlockHash(), m_stats, m_muhash)) {
+        return error("%s: cannot write stats of the genesis block", __func__);
+    }
+    return BaseIndex::Init();
+}
+
+bool CoinStatsIndex::MoveMuHash(const CBlockIndex* block_index)
+{
+    const CBlockIndex* fork = LastCommonAncestor(m_muhash_block, block_index);
+    const Consensus::Params& consensus_params = Params().GetConsensus();
+    MuHash3072 muhash = m_muhash;
+    Stats stats;
+
+    // Reading the blocks back is slow, but only the blocks a reorg or an
+    // unclean shutdown leaves between the two are visited.
+    for (const CBlockIndex* pindex = m_muhash_block; pindex != fork; pindex = pindex->pprev) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, consensus_params) || !ApplyBlock(muhash, stats, block, pindex, false)) {
+            return error("%s: cannot undo block %s", __func__, pindex->GetBlockHash().ToString());
+        }
+    }
+    std::vector<const CBlockIndex*> path;
+    for (const CBlockIndex* pindex = block_index; pindex != fork; pindex = pindex->pprev) {
+        path.push_back(pindex);
+    }
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, *it, consensus_params) || !ApplyBlock(muhash, stats, block, *it, true)) {
+            return error("%s: cannot apply block %s", __func__, (*it)->GetBlockHash().ToString());
+        }
+    }
+
+    // The other statistics are simply those stored for the block; the hash must match them.
+    if (!m_db->ReadStats(block_index->GetBlockHash(), stats)) {
+        return error("%s: cannot read stats of block %s", __func__, block_index->GetBlockHash().ToString());
+    }
+    uint256 hash;
+    muhash.Finalize(hash.begin());
+    if (hash != stats.muhash) {
+        return error("%s: UTXO set hash of block %s does not match its stats", __func__, block_index->GetBlockHash().ToString());
+    }
+    m_muhash = muhash;
+    m_stats = stats;
+    m_muhash_block = block_index;
+    return true;
+}
+
+bool CoinStatsIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    MuHash3072 muhash;
+    Stats stats;
+
+    // The genesis block's outputs are not spendable and never enter the UTXO set.
+    if (pindex->nHeight > 0) {
+        if (!m_muhash_block) {
+            return error("%s: no UTXO set hash to update with block %s", __func__, pindex->GetBlockHash().ToString());
+        }
+        if (m_muhash_block != pindex->pprev && !MoveMuHash(pindex->pprev)) {
+            return false;
+        }
+        muhash = m_muhash;
+        stats = m_stats;
+        if (!ApplyBlock(muhash, stats, block, pindex, true)) {
+            return false;
+        }
+    }
+    muhash.Finalize(stats.muhash.begin());
+
+    if (!m_db->WriteStats(pindex->GetBlockHash(), stats, muhash)) {
+        return false;
+    }
+    m_muhash = muhash;
+    m_stats = stats;
+    m_muhash_block = pindex;
+    return true;
+}
+
+BaseIndex::DB& CoinStatsIndex::GetDB() const { return *m_db; }
+
+bool CoinStatsIndex::LookUpStats(const CBlockIndex* block_index, Stats& stats) const
+{
+    return m_db->ReadStats(block_index->GetBlockHash(), stats);
+}
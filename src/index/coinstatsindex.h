@@ -0,0 +1,101 @@
+// Copyright (c) 2020 The Earthcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_COINSTATSINDEX_H
+#define BITCOIN_INDEX_COINSTATSINDEX_H
+
+#include <amount.h>
+#include <chain.h>
+#include <crypto/muhash.h>
+#include <index/base.h>
+#include <serialize.h>
+
+class COutPoint;
+class Coin;
+class CScript;
+
+/** Add a coin to, or remove it from, a MuHash of the UTXO set. */
+void ApplyCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin);
+void RemoveCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin);
+
+/** The bogosize gettxoutsetinfo reports for an unspent output with this scriptPubKey. */
+uint64_t GetBogoSize(const CScript& script_pub_key);
+
+/**
+ * CoinStatsIndex keeps the statistics gettxoutsetinfo reports about the UTXO
+ * set as of every block, so they can be looked up instead of recomputed by
+ * scanning the chainstate.
+ *
+ * The statistics of a block are those of its parent updated with the coins
+ * the block creates and, read from its undo data, the coins it spends. They
+ * are stored by block hash, so the entries of disconnected blocks stay valid.
+ * Only the finalized UTXO set hash is stored per block; the rolling MuHash it
+ * is computed from is kept in memory, and in the database under a single key,
+ * for the last block indexed. A reorg moves it to the fork point by undoing
+ * the blocks of the old branch.
+ */
+class CoinStatsIndex final : public BaseIndex
+{
+public:
+    /** UTXO set statistics as of one block. */
+    struct Stats
+    {
+        uint256 muhash;
+        uint64_t transaction_output_count = 0;
+        uint64_t bogo_size = 0;
+        CAmount total_amount = 0;
+        /** Sum of the block subsidies up to and including the block. */
+        CAmount total_subsidy = 0;
+
+        ADD_SERIALIZE_METHODS;
+
+        template <typename Stream, typename Operation>
+        inline void SerializationOp(Stream& s, Operation ser_action) {
+            READWRITE(muhash);
+            READWRITE(transaction_output_count);
+            READWRITE(bogo_size);
+            READWRITE(total_amount);
+            READWRITE(total_subsidy);
+        }
+    };
+
+protected:
+    class DB;
+
+private:
+    const std::unique_ptr<DB> m_db;
+
+    /** The rolling UTXO set hash and the statistics as of m_muhash_block. */
+    MuHash3072 m_muhash;
+    Stats m_stats;
+    const CBlockIndex* m_muhash_block = nullptr;
+
+    /** Bring the rolling hash from m_muhash_block to another block, through their last common ancestor. */
+    bool MoveMuHash(const CBlockIndex* block_index);
+
+protected:
+    /// Override base class init to load the rolling hash, or record the statistics of the genesis block.
+    bool Init() override;
+
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+
+    BaseIndex::DB& GetDB() const override;
+
+    const char* GetName() const override { return "coinstatsindex"; }
+
+public:
+    /// Constructs the index, which becomes available to be queried.
+    explicit CoinStatsIndex(size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
+
+    // Destructor is declared because this class contains a unique_ptr to an incomplete type.
+    virtual ~CoinStatsIndex() override;
+
+    /// Look up the UTXO set statistics as of a block the index has processed.
+    bool LookUpStats(const CBlockIndex* block_index, Stats& stats) const;
+};
+
+/// The global UTXO set statistics index. May be null.
+extern std::unique_ptr<CoinStatsIndex> g_coin_stats_index;
+
+#endif // BITCOIN_INDEX_COINSTATSINDEX_H
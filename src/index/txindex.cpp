@@ -2,8 +2,11 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <blockfilemap.h>
+#include <chainparams.h>
 #include <index/txindex.h>
 #include <shutdown.h>
+#include <streams.h>
 #include <ui_interface.h>
 #include <util.h>
 #include <validation.h>
@@ -264,17 +267,17 @@ bool TxIndex::FindTx(const uint256& tx_hash, uint256& block_hash, CTransactionRe
         return false;
     }
 
-    CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-    if (file.IsNull()) {
-        return error("%s: OpenBlockFile failed", __func__);
+    // Works for block files stored compressed as well, decompressing only the block.
+    MappedBlock block_data;
+    if (!ReadRawBlockFromDisk(block_data, postx, Params().MessageStart())) {
+        return error("%s: ReadRawBlockFromDisk failed", __func__);
     }
     CBlockHeader header;
     try {
-        file >> header;
-        if (fseek(file.Get(), postx.nTxOffset, SEEK_CUR)) {
-            return error("%s: fseek(...) failed", __func__);
-        }
-        file >> tx;
+        SpanReader reader(SER_DISK, CLIENT_VERSION, block_data.Data());
+        reader >> header;
+        reader.ignore(postx.nTxOffset);
+        reader >> tx;
     } catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s", __func__, e.what());
     }
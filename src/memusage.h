@@ -6,6 +6,7 @@
 #define BITCOIN_MEMUSAGE_H
 
 #include <indirectmap.h>
+#include <pooledmap.h>
 
 #include <stdlib.h>
 
@@ -165,6 +166,12 @@ static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const pooledmap<X, Y, Z>& m)
+{
+    return (MallocUsage(m.chunk_bytes()) + sizeof(void*)) * m.chunk_count() + MallocUsage(m.table_bytes());
+}
+
 }
 
 #endif // BITCOIN_MEMUSAGE_H
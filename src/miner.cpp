@@ -13,6 +13,7 @@
 #include <consensus/tx_verify.h>
 #include <consensus/merkle.h>
 #include <consensus/validation.h>
+#include <crypto/scrypt.h>
 #include <hash.h>
 #include <net.h>
 #include <policy/feerate.h>
@@ -21,12 +22,19 @@
 #include <primitives/transaction.h>
 #include <script/standard.h>
 #include <timedata.h>
+#include <ui_interface.h>
 #include <util.h>
 #include <utilmoneystr.h>
+#include <utilstrencodings.h>
 #include <validationinterface.h>
 
 #include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <limits>
+#include <mutex>
 #include <queue>
+#include <thread>
 #include <utility>
 
 // Unconfirmed transactions in the memory pool often depend on other
@@ -36,6 +44,7 @@
 
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockWeight = 0;
+std::atomic<double> dGenerateHashesPerSec(0.0);
 
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
 {
@@ -57,11 +66,16 @@ BlockAssembler::Options::Options() {
     nBlockMaxWeight = DEFAULT_BLOCK_MAX_WEIGHT;
 }
 
+static unsigned int ClampBlockMaxWeight(size_t nBlockMaxWeight)
+{
+    // Limit weight to between 4K and MAX_BLOCK_WEIGHT-4K for sanity:
+    return std::max<size_t>(4000, std::min<size_t>(MAX_BLOCK_WEIGHT - 4000, nBlockMaxWeight));
+}
+
 BlockAssembler::BlockAssembler(const CChainParams& params, const Options& options) : chainparams(params)
 {
     blockMinFeeRate = options.blockMinFeeRate;
-    // Limit weight to between 4K and MAX_BLOCK_WEIGHT-4K for sanity:
-    nBlockMaxWeight = std::max<size_t>(4000, std::min<size_t>(MAX_BLOCK_WEIGHT - 4000, options.nBlockMaxWeight));
+    nBlockMaxWeight = ClampBlockMaxWeight(options.nBlockMaxWeight);
 }
 
 static BlockAssembler::Options DefaultOptions()
@@ -433,6 +447,159 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
     }
 }
 
+BlockTemplateCache::BlockTemplateCache(CTxMemPool& pool) : m_pool(pool)
+{
+    // The mempool is only followed once a template is requested.
+    m_tip_connection = uiInterface.NotifyBlockTip.connect([this](bool, const CBlockIndex*) { BlockTipChanged(); });
+}
+
+BlockTemplateCache::~BlockTemplateCache() {}
+
+void BlockTemplateCache::TransactionAdded(CTransactionRef tx)
+{
+    AssertLockHeld(m_pool.cs);
+    ++m_notified;
+    if (!m_template || m_stale) return;
+    if (GetTime() - m_requested_time >= IDLE_TIMEOUT) {
+        Release();
+    } else if (m_added.size() >= MAX_ADDED) {
+        m_added.clear();
+        m_stale = true;
+    } else {
+        m_added.push_back(std::move(tx));
+    }
+}
+
+void BlockTemplateCache::TransactionRemoved(CTransactionRef tx, MemPoolRemovalReason reason)
+{
+    AssertLockHeld(m_pool.cs);
+    ++m_notified;
+    if (m_in_block.count(tx->GetHash())) {
+        m_stale = true;
+        m_added.clear();
+    }
+}
+
+void BlockTemplateCache::BlockTipChanged()
+{
+    LOCK(m_pool.cs);
+    Release();
+}
+
+void BlockTemplateCache::Release()
+{
+    m_template.reset();
+    m_added.clear();
+    m_in_block.clear();
+    m_added_connection.disconnect();
+    m_removed_connection.disconnect();
+}
+
+void BlockTemplateCache::Assemble(const CChainParams& chainparams, bool fMineWitnessTx)
+{
+    const BlockAssembler::Options options = DefaultOptions();
+    m_template = BlockAssembler(chainparams, options).CreateNewBlock(CScript() << OP_TRUE, fMineWitnessTx);
+    m_tip = chainActive.Tip();
+    m_witness = fMineWitnessTx;
+    m_assembled_time = GetTime();
+    m_transactions_updated = m_pool.GetTransactionsUpdated();
+    m_notified = 0;
+    m_added.clear();
+    m_stale = m_displaced = m_coinbase_dirty = false;
+
+    // Take up where BlockAssembler left off.
+    const CBlock& block = m_template->block;
+    m_in_block.clear();
+    m_block_weight = 4000;
+    m_block_sigops_cost = 400;
+    for (size_t i = 1; i < block.vtx.size(); ++i) {
+        m_in_block.insert(block.vtx[i]->GetHash());
+        m_block_weight += GetTransactionWeight(*block.vtx[i]);
+        m_block_sigops_cost += m_template->vTxSigOpsCost[i];
+    }
+    m_fees = -m_template->vTxFees[0];
+    m_height = m_tip->nHeight + 1;
+    m_lock_time_cutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                         ? m_tip->GetMedianTimePast()
+                         : block.GetBlockTime();
+    m_block_max_weight = ClampBlockMaxWeight(options.nBlockMaxWeight);
+    m_block_min_fee_rate = options.blockMinFeeRate;
+}
+
+bool BlockTemplateCache::Append(CTxMemPool::txiter iter)
+{
+    // The checks of BlockAssembler for a package that is only this transaction
+    for (const CTxMemPoolEntry* parent : m_pool.GetMemPoolParents(iter)) {
+        if (!m_in_block.count(parent->GetTx().GetHash())) {
+            m_displaced = true;
+            return false;
+        }
+    }
+    if (iter->GetModifiedFee() < m_block_min_fee_rate.GetFee(iter->GetTxSize()))
+        return false;
+    if (m_block_weight + WITNESS_SCALE_FACTOR * iter->GetTxSize() >= m_block_max_weight ||
+            m_block_sigops_cost + iter->GetSigOpCost() >= MAX_BLOCK_SIGOPS_COST) {
+        m_displaced = true;
+        return false;
+    }
+    if (!IsFinalTx(iter->GetTx(), m_height, m_lock_time_cutoff))
+        return false;
+    if (!(m_witness && IsWitnessEnabled(m_tip, Params().GetConsensus())) && iter->GetTx().HasWitness())
+        return false;
+
+    m_template->block.vtx.emplace_back(iter->GetSharedTx());
+    m_template->vTxFees.push_back(iter->GetFee());
+    m_template->vTxSigOpsCost.push_back(iter->GetSigOpCost());
+    m_in_block.insert(iter->GetTx().GetHash());
+    m_block_weight += iter->GetTxWeight();
+    m_block_sigops_cost += iter->GetSigOpCost();
+    m_fees += iter->GetFee();
+    return true;
+}
+
+std::unique_ptr<CBlockTemplate> BlockTemplateCache::Get(const CChainParams& chainparams, bool fMineWitnessTx)
+{
+    LOCK(m_pool.cs);
+    m_requested_time = GetTime();
+    if (!m_added_connection.connected()) {
+        m_added_connection = m_pool.NotifyEntryAdded.connect([this](CTransactionRef tx) { TransactionAdded(std::move(tx)); });
+        m_removed_connection = m_pool.NotifyEntryRemoved.connect([this](CTransactionRef tx, MemPoolRemovalReason reason) { TransactionRemoved(std::move(tx), reason); });
+    }
+    // Changes to the mempool other than transactions entering and leaving it
+    // count as updates without a notification.
+    if (!m_template || m_tip != chainActive.Tip() || m_witness != fMineWitnessTx || m_stale ||
+            m_pool.GetTransactionsUpdated() != m_transactions_updated + m_notified ||
+            (m_displaced && GetTime() - m_assembled_time >= REASSEMBLE_INTERVAL)) {
+        Assemble(chainparams, fMineWitnessTx);
+        if (!m_template) return nullptr;
+    } else if (!m_added.empty()) {
+        for (const CTransactionRef& tx : m_added) {
+            CTxMemPool::txiter iter = m_pool.mapTx.find(tx->GetHash());
+            if (iter != m_pool.mapTx.end() && !m_in_block.count(tx->GetHash()) && Append(iter))
+                m_coinbase_dirty = true;
+        }
+        m_added.clear();
+        m_transactions_updated += m_notified;
+        m_notified = 0;
+    }
+
+    if (m_coinbase_dirty) {
+        CBlock& block = m_template->block;
+        CMutableTransaction coinbaseTx;
+        coinbaseTx.vin.resize(1);
+        coinbaseTx.vin[0].prevout.SetNull();
+        coinbaseTx.vin[0].scriptSig = block.vtx[0]->vin[0].scriptSig;
+        coinbaseTx.vout.resize(1);
+        coinbaseTx.vout[0] = block.vtx[0]->vout[0];
+        coinbaseTx.vout[0].nValue = m_fees + GetBlockSubsidy(m_height, chainparams.GetConsensus());
+        block.vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
+        m_template->vchCoinbaseCommitment = GenerateCoinbaseCommitment(block, m_tip, chainparams.GetConsensus());
+        m_template->vTxFees[0] = -m_fees;
+        m_coinbase_dirty = false;
+    }
+    return MakeUnique<CBlockTemplate>(*m_template);
+}
+
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
@@ -451,3 +618,138 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
     pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
 }
+
+/** Nonces hashed per scrypt_1024_1_1_256_multi call; a multiple of every kernel's lane count. */
+static const int MINER_NONCE_BATCH = 16;
+
+/**
+ * The threads hashing nonces for ScanBlockNonces. They are started on first
+ * use and kept for later calls, rather than started anew for every block
+ * template, and run one scan at a time.
+ */
+class NonceScanPool
+{
+public:
+    typedef std::function<void(int)> Job;
+
+    ~NonceScanPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_work_cv.notify_all();
+        for (std::thread& thread : m_threads)
+            thread.join();
+    }
+
+    /** Run job(1) to job(nWorkers - 1) on pool threads and job(0) on the caller, and wait for all of them. */
+    void Run(int nWorkers, const Job& job)
+    {
+        std::lock_guard<std::mutex> scan_lock(m_scan_mutex);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            while ((int)m_threads.size() < nWorkers - 1)
+                m_threads.emplace_back(&NonceScanPool::Loop, this, (int)m_threads.size() + 1, m_generation);
+            m_job = &job;
+            m_workers = nWorkers;
+            m_pending = nWorkers - 1;
+            ++m_generation;
+        }
+        m_work_cv.notify_all();
+        job(0);
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done_cv.wait(lock, [this] { return m_pending == 0; });
+        m_job = nullptr;
+    }
+
+private:
+    std::mutex m_scan_mutex;
+    std::mutex m_mutex;
+    std::condition_variable m_work_cv;
+    std::condition_variable m_done_cv;
+    std::vector<std::thread> m_threads;
+    const Job* m_job = nullptr;
+    //! Number of the current scan, and how many threads (the caller included) take part in it
+    uint64_t m_generation = 0;
+    int m_workers = 0;
+    //! Pool threads of the current scan that are not done yet
+    int m_pending = 0;
+    bool m_stop = false;
+
+    void Loop(int nIndex, uint64_t nSeen)
+    {
+        RenameThread("earthcoin-nonce");
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            m_work_cv.wait(lock, [&] { return m_stop || m_generation != nSeen; });
+            if (m_stop) return;
+            nSeen = m_generation;
+            if (nIndex >= m_workers) continue;
+            const Job& job = *m_job;
+            lock.unlock();
+            job(nIndex);
+            lock.lock();
+            if (--m_pending == 0) m_done_cv.notify_one();
+        }
+    }
+};
+
+bool ScanBlockNonces(CBlockHeader* pblock, const Consensus::Params& consensusParams, int nThreads, uint32_t nNonceEnd, uint64_t& nMaxTries)
+{
+    const uint32_t nNonceBegin = pblock->nNonce;
+    if (nNonceEnd <= nNonceBegin || nMaxTries == 0) return false;
+    const uint32_t nRange = nNonceEnd - nNonceBegin;
+    const uint32_t nBatches = nRange / MINER_NONCE_BATCH + (nRange % MINER_NONCE_BATCH != 0);
+    nThreads = std::max<int64_t>(1, std::min<int64_t>(nThreads, nBatches));
+
+    std::atomic<bool> fFound(false);
+    std::atomic<uint32_t> nSolution(0);
+    // Hashes any thread may still spend; claimed a batch at a time so nMaxTries is honoured exactly.
+    std::atomic<int64_t> nTriesLeft(std::min<uint64_t>(nMaxTries, std::numeric_limits<int64_t>::max()));
+    std::atomic<uint64_t> nTriesDone(0);
+
+    auto worker = [&](uint32_t nBegin, uint32_t nEnd) {
+        std::vector<CBlockHeader> headers(MINER_NONCE_BATCH, *pblock);
+        const char* inputs[MINER_NONCE_BATCH];
+        char* outputs[MINER_NONCE_BATCH];
+        uint256 hashes[MINER_NONCE_BATCH];
+        for (int i = 0; i < MINER_NONCE_BATCH; i++) {
+            inputs[i] = BEGIN(headers[i].nVersion);
+            outputs[i] = BEGIN(hashes[i]);
+        }
+
+        for (uint32_t nNonce = nBegin; nNonce < nEnd && !fFound.load(std::memory_order_relaxed);) {
+            int64_t nCount = std::min<int64_t>(MINER_NONCE_BATCH, nEnd - nNonce);
+            const int64_t nAvailable = nTriesLeft.fetch_sub(nCount);
+            if (nAvailable <= 0) break;
+            nCount = std::min(nCount, nAvailable);
+
+            for (int64_t i = 0; i < nCount; i++)
+                headers[i].nNonce = nNonce + i;
+            scrypt_1024_1_1_256_multi(inputs, outputs, nCount);
+            nTriesDone += nCount;
+
+            for (int64_t i = 0; i < nCount; i++) {
+                if (CheckProofOfWork(hashes[i], pblock->nBits, consensusParams)) {
+                    bool fExpected = false;
+                    if (fFound.compare_exchange_strong(fExpected, true)) nSolution = headers[i].nNonce;
+                    return;
+                }
+            }
+            nNonce += nCount;
+        }
+    };
+
+    static NonceScanPool pool;
+    const uint32_t nSlice = nRange / nThreads;
+    pool.Run(nThreads, [&](int t) {
+        const uint32_t nBegin = nNonceBegin + t * nSlice;
+        worker(nBegin, t + 1 == nThreads ? nNonceEnd : nBegin + nSlice);
+    });
+
+    nMaxTries -= std::min<uint64_t>(nMaxTries, nTriesDone);
+    if (!fFound) return false;
+    pblock->nNonce = nSolution;
+    return true;
+}
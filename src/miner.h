@@ -11,7 +11,10 @@
 #include <validation.h>
 
 #include <stdint.h>
+#include <atomic>
 #include <memory>
+#include <set>
+#include <vector>
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
 
@@ -22,6 +25,8 @@ class CScript;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -genproclimit, the number of threads generate and generatetoaddress hash with (-1 = all cores) */
+static const int DEFAULT_GENERATE_THREADS = 1;
 
 struct CBlockTemplate
 {
@@ -193,8 +198,96 @@ private:
     int UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx) EXCLUSIVE_LOCKS_REQUIRED(mempool.cs);
 };
 
+/**
+ * The block template of getblocktemplate, kept up to date as transactions
+ * enter and leave the mempool rather than assembled anew for every request.
+ *
+ * Transactions entering the mempool are appended to the template when all
+ * their in-mempool parents are in it already and they fit; as long as the
+ * block is not full, that is what a new assembly would do with them as well.
+ * The template is assembled anew (BlockAssembler::CreateNewBlock) on a new
+ * tip, when one of its transactions leaves the mempool, after any other change
+ * to the mempool (a prioritisation), and when transactions arrived that a new
+ * assembly might have preferred over some in the template and the last one
+ * was at least REASSEMBLE_INTERVAL seconds ago, or more than MAX_ADDED of
+ * them arrived between two requests.
+ *
+ * On a new tip, or when no template was requested for IDLE_TIMEOUT seconds,
+ * the template is dropped and the mempool no longer followed until the next
+ * request.
+ *
+ * Appended transactions were checked by AcceptToMemoryPool against the same
+ * tip, so unlike a new assembly, appending does not run TestBlockValidity.
+ */
+class BlockTemplateCache
+{
+public:
+    static const int64_t REASSEMBLE_INTERVAL = 5;
+    static const size_t MAX_ADDED = 1000;
+    static const int64_t IDLE_TIMEOUT = 60;
+
+    explicit BlockTemplateCache(CTxMemPool& pool);
+    ~BlockTemplateCache();
+
+    /** A copy of the template for a block on the chain tip, paying to OP_TRUE */
+    std::unique_ptr<CBlockTemplate> Get(const CChainParams& chainparams, bool fMineWitnessTx) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+private:
+    CTxMemPool& m_pool;
+    boost::signals2::scoped_connection m_added_connection;
+    boost::signals2::scoped_connection m_removed_connection;
+    boost::signals2::scoped_connection m_tip_connection;
+
+    // The rest is guarded by m_pool.cs, which the mempool notifications are sent under.
+    std::unique_ptr<CBlockTemplate> m_template;
+    const CBlockIndex* m_tip = nullptr;
+    bool m_witness = false;
+    int64_t m_assembled_time = 0;
+    int64_t m_requested_time = 0;
+    //! The mempool's update counter when the template was last brought up to date
+    unsigned int m_transactions_updated = 0;
+    //! Number of notifications since, each of which accounts for one update
+    unsigned int m_notified = 0;
+    //! Transactions that entered the mempool since, in order
+    std::vector<CTransactionRef> m_added;
+    //! A transaction of the template left the mempool, or too many entered it
+    bool m_stale = false;
+    //! Transactions were left out that a new assembly might have included
+    bool m_displaced = false;
+    bool m_coinbase_dirty = false;
+
+    // Information on the current status of the block, as in BlockAssembler
+    std::set<uint256> m_in_block;
+    uint64_t m_block_weight = 0;
+    uint64_t m_block_sigops_cost = 0;
+    CAmount m_fees = 0;
+    int m_height = 0;
+    int64_t m_lock_time_cutoff = 0;
+    unsigned int m_block_max_weight = 0;
+    CFeeRate m_block_min_fee_rate;
+
+    void TransactionAdded(CTransactionRef tx);
+    void TransactionRemoved(CTransactionRef tx, MemPoolRemovalReason reason);
+    void BlockTipChanged();
+    /** Drop the template and stop following the mempool */
+    void Release() EXCLUSIVE_LOCKS_REQUIRED(m_pool.cs);
+    void Assemble(const CChainParams& chainparams, bool fMineWitnessTx) EXCLUSIVE_LOCKS_REQUIRED(cs_main, m_pool.cs);
+    bool Append(CTxMemPool::txiter iter) EXCLUSIVE_LOCKS_REQUIRED(m_pool.cs);
+};
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
 
+/**
+ * Search nonces [pblock->nNonce, nNonceEnd) for a valid proof of work on nThreads threads.
+ * The range is split into one contiguous slice per thread; all threads stop as soon as one
+ * of them finds a solution or nMaxTries hashes have been spent between them. On success the
+ * solution is stored in pblock->nNonce. nMaxTries is decreased by the number of hashes done.
+ */
+bool ScanBlockNonces(CBlockHeader* pblock, const Consensus::Params& consensusParams, int nThreads, uint32_t nNonceEnd, uint64_t& nMaxTries);
+
+/** Hash rate of the last generate or generatetoaddress call, in hashes per second */
+extern std::atomic<double> dGenerateHashesPerSec;
+
 #endif // BITCOIN_MINER_H
@@ -36,6 +36,7 @@
 
 class CScheduler;
 class CNode;
+class CTransaction;
 
 /** Time between pings automatically sent out for latency probing and keepalive (in seconds). */
 static const int PING_INTERVAL = 2 * 60;
@@ -584,6 +585,7 @@ public:
     unsigned int nDataPos;
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
+    std::shared_ptr<const CTransaction> tx; // transaction of a tx message, when deserialized before processing
 
     CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
         hdrbuf.resize(24);
@@ -632,6 +634,8 @@ public:
     CCriticalSection cs_vProcessMsg;
     std::list<CNetMessage> vProcessMsg;
     size_t nProcessQueueSize;
+    //! Number of messages at the front of vProcessMsg with transactions already pre-validated
+    unsigned int nPreValidatedMsgs;
 
     CCriticalSection cs_sendProcessing;
 
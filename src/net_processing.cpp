@@ -8,6 +8,7 @@
 #include <addrman.h>
 #include <arith_uint256.h>
 #include <blockencodings.h>
+#include <blockfilemap.h>
 #include <chainparams.h>
 #include <consensus/validation.h>
 #include <hash.h>
@@ -92,6 +93,8 @@ static constexpr unsigned int INVENTORY_BROADCAST_MAX = 7 * INVENTORY_BROADCAST_
 static constexpr unsigned int AVG_FEEFILTER_BROADCAST_INTERVAL = 10 * 60;
 /** Maximum feefilter broadcast delay after significant change. */
 static constexpr unsigned int MAX_FEEFILTER_CHANGE_DELAY = 5 * 60;
+/** Maximum number of transactions from one peer pre-validated together. */
+static constexpr unsigned int MAX_TX_PREVALIDATION_BATCH = 100;
 
 // Internal stuff
 namespace {
@@ -590,6 +593,35 @@ static void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vec
     }
 }
 
+/** Request the blocks below a loaded UTXO snapshot that its background validation needs next. */
+static void FindSnapshotBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, const Consensus::Params& consensusParams) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    if (count == 0 || pindexSnapshotBase == nullptr)
+        return;
+
+    CNodeState *state = State(nodeid);
+    assert(state != nullptr);
+    ProcessBlockAvailability(nodeid);
+    if (state->pindexBestKnownBlock == nullptr || state->pindexBestKnownBlock->GetAncestor(pindexSnapshotBase->nHeight) != pindexSnapshotBase) {
+        return;
+    }
+
+    // Stay within a window of the validated block, so what we download can soon be used and pruned.
+    std::vector<const CBlockIndex*> vToFetch;
+    int nMaxHeight = std::min(pindexSnapshotBase->nHeight, pindexSnapshotValidated->nHeight + (int)BLOCK_DOWNLOAD_WINDOW);
+    for (const CBlockIndex* pindex = pindexSnapshotBase->GetAncestor(nMaxHeight); pindex != pindexSnapshotValidated; pindex = pindex->pprev) {
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA) && !mapBlocksInFlight.count(pindex->GetBlockHash())) {
+            vToFetch.push_back(pindex);
+        }
+    }
+    for (const CBlockIndex* pindex : reverse_iterate(vToFetch)) {
+        if (vBlocks.size() >= count || (!state->fHaveWitness && IsWitnessEnabled(pindex->pprev, consensusParams))) {
+            return;
+        }
+        vBlocks.push_back(pindex);
+    }
+}
+
 } // namespace
 
 // This function is used for testing the stale tip eviction logic, see
@@ -1181,18 +1213,17 @@ void static ProcessGetBlockData(CNode* pfrom, const CChainParams& chainparams, c
         } else if (inv.type == MSG_WITNESS_BLOCK) {
             // Fast-path: in this case it is possible to serve the block directly from disk,
             // as the network format matches the format on disk
-            std::vector<uint8_t> block_data;
+            MappedBlock block_data;
             if (!ReadRawBlockFromDisk(block_data, pindex, chainparams.MessageStart())) {
                 assert(!"cannot load block from disk");
             }
-            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, MakeSpan(block_data)));
+            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, block_data.Data()));
             // Don't set pblock as we've sent the block
         } else {
             // Send block from disk
-            std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
-            if (!ReadBlockFromDisk(*pblockRead, pindex, consensusParams))
+            pblock = ReadBlockFromDiskCached(pindex, consensusParams);
+            if (!pblock)
                 assert(!"cannot load block from disk");
-            pblock = pblockRead;
         }
         if (pblock) {
             if (inv.type == MSG_BLOCK)
@@ -1569,7 +1600,7 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
     return true;
 }
 
-bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman* connman, const std::atomic<bool>& interruptMsgProc, bool enable_bip61)
+bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman* connman, const std::atomic<bool>& interruptMsgProc, bool enable_bip61, CTransactionRef ptxReceived = nullptr)
 {
     LogPrint(BCLog::NET, "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->GetId());
     if (gArgs.IsArgSet("-dropmessagestest") && GetRand(gArgs.GetArg("-dropmessagestest", 0)) == 0)
@@ -2123,11 +2154,10 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             return true;
         }
 
-        CBlock block;
-        bool ret = ReadBlockFromDisk(block, pindex, chainparams.GetConsensus());
-        assert(ret);
+        std::shared_ptr<const CBlock> pblock = ReadBlockFromDiskCached(pindex, chainparams.GetConsensus());
+        assert(pblock);
 
-        SendBlockTransactions(block, req, pfrom, connman);
+        SendBlockTransactions(*pblock, req, pfrom, connman);
     }
 
 
@@ -2211,8 +2241,9 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
 
         std::deque<COutPoint> vWorkQueue;
         std::vector<uint256> vEraseQueue;
-        CTransactionRef ptx;
-        vRecv >> ptx;
+        CTransactionRef ptx = std::move(ptxReceived);
+        if (!ptx)
+            vRecv >> ptx;
         const CTransaction& tx = *ptx;
 
         CInv inv(MSG_TX, tx.GetHash());
@@ -2979,6 +3010,42 @@ static bool SendRejectsAndCheckIfBanned(CNode* pnode, CConnman* connman, bool en
     return false;
 }
 
+/**
+ * Collect the transactions of the run of tx messages starting with msg, just
+ * taken off the front of pfrom's process queue, and continuing in the queue,
+ * to pre-validate them together. The messages keep their transaction for
+ * ProcessMessage. Returns how many of the queued messages the run covers.
+ */
+static unsigned int GetTransactionsToPreValidate(CNode* pfrom, CNetMessage& msg, std::vector<CTransactionRef>& txs) EXCLUSIVE_LOCKS_REQUIRED(pfrom->cs_vProcessMsg)
+{
+    if (msg.hdr.GetCommand() != NetMsgType::TX)
+        return 0;
+    // As in ProcessMessage
+    if (!fRelayTxes && (!pfrom->fWhitelisted || !gArgs.GetBoolArg("-whitelistrelay", DEFAULT_WHITELISTRELAY)))
+        return 0;
+
+    auto add = [&](CNetMessage& txmsg) {
+        try {
+            CDataStream vRecv(txmsg.vRecv.begin(), txmsg.vRecv.end(), SER_NETWORK, pfrom->GetRecvVersion());
+            CTransactionRef ptx;
+            vRecv >> ptx;
+            txmsg.tx = ptx;
+            txs.push_back(std::move(ptx));
+        } catch (const std::exception&) {
+            // Malformed, which ProcessMessage reports.
+        }
+    };
+    add(msg);
+    unsigned int nMsgs = 0;
+    for (CNetMessage& next : pfrom->vProcessMsg) {
+        if (nMsgs + 1 >= MAX_TX_PREVALIDATION_BATCH || next.hdr.GetCommand() != NetMsgType::TX)
+            break;
+        add(next);
+        nMsgs++;
+    }
+    return nMsgs;
+}
+
 bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& interruptMsgProc)
 {
     const CChainParams& chainparams = Params();
@@ -3006,6 +3073,7 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
         return false;
 
     std::list<CNetMessage> msgs;
+    std::vector<CTransactionRef> vPreValidate;
     {
         LOCK(pfrom->cs_vProcessMsg);
         if (pfrom->vProcessMsg.empty())
@@ -3015,7 +3083,23 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
         pfrom->nProcessQueueSize -= msgs.front().vRecv.size() + CMessageHeader::HEADER_SIZE;
         pfrom->fPauseRecv = pfrom->nProcessQueueSize > connman->GetReceiveFloodSize();
         fMoreWork = !pfrom->vProcessMsg.empty();
+        // A peer relaying many transactions at once sends a run of tx
+        // messages. Check all of them in parallel before accepting them one
+        // by one, each then mostly finding its signatures in the cache.
+        if (pfrom->nPreValidatedMsgs > 0) {
+            pfrom->nPreValidatedMsgs--;
+        } else if (fMoreWork && nScriptCheckThreads) {
+            pfrom->nPreValidatedMsgs = GetTransactionsToPreValidate(pfrom, msgs.front(), vPreValidate);
+        }
+    }
+    if (!vPreValidate.empty()) {
+        // Transactions already known or rejected are not checked again, as ProcessMessage does.
+        LOCK(cs_main);
+        vPreValidate.erase(std::remove_if(vPreValidate.begin(), vPreValidate.end(), [](const CTransactionRef& tx) {
+            return AlreadyHave(CInv(MSG_TX, tx->GetHash()));
+        }), vPreValidate.end());
     }
+    PreValidateTransactions(mempool, vPreValidate);
     CNetMessage& msg(msgs.front());
 
     msg.SetVersion(pfrom->GetRecvVersion());
@@ -3054,7 +3138,7 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
     bool fRet = false;
     try
     {
-        fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, chainparams, connman, interruptMsgProc, m_enable_bip61);
+        fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, chainparams, connman, interruptMsgProc, m_enable_bip61, std::move(msg.tx));
         if (interruptMsgProc)
             return false;
         if (!pfrom->vRecvGetData.empty())
@@ -3460,10 +3544,9 @@ bool PeerLogicValidation::SendMessages(CNode* pto)
                         }
                     }
                     if (!fGotBlockFromCache) {
-                        CBlock block;
-                        bool ret = ReadBlockFromDisk(block, pBestIndex, consensusParams);
-                        assert(ret);
-                        CBlockHeaderAndShortTxIDs cmpctblock(block, state.fWantsCmpctWitness);
+                        std::shared_ptr<const CBlock> pblock = ReadBlockFromDiskCached(pBestIndex, consensusParams);
+                        assert(pblock);
+                        CBlockHeaderAndShortTxIDs cmpctblock(*pblock, state.fWantsCmpctWitness);
                         connman->PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
                     }
                     state.pindexBestHeaderSent = pBestIndex;
@@ -3731,6 +3814,16 @@ bool PeerLogicValidation::SendMessages(CNode* pto)
                 }
             }
         }
+        if (!pto->fClient && !pto->m_limited_node && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+            std::vector<const CBlockIndex*> vToDownload;
+            FindSnapshotBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, consensusParams);
+            for (const CBlockIndex *pindex : vToDownload) {
+                vGetData.push_back(CInv(MSG_BLOCK | GetFetchFlags(pto), pindex->GetBlockHash()));
+                MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), pindex);
+                LogPrint(BCLog::NET, "Requesting block %s (%d) below the UTXO snapshot peer=%d\n", pindex->GetBlockHash().ToString(),
+                    pindex->nHeight, pto->GetId());
+            }
+        }
 
         //
         // Message: getdata (non-blocks)
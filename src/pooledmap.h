@@ -0,0 +1,317 @@
+// Copyright (c) 2020 The Earthcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_POOLEDMAP_H
+#define BITCOIN_POOLEDMAP_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/** Hash map with entries in pooled, never moving nodes and an open addressing index over them.
+ *
+ * Implements the subset of the std::unordered_map interface that the coins
+ * cache uses, with the same guarantees about references and iterators:
+ * inserting never invalidates them, erasing only invalidates those to the
+ * erased entry, so erasing while iterating works as with unordered_map.
+ *
+ * Entries are constructed in chunks of CHUNK_NODES nodes, saving a heap
+ * allocation (and its overhead) per entry. The index is a linearly probed
+ * table of (32-bit hash, node number) pairs, so a lookup usually touches one
+ * cache line of the table and the entry itself, without chasing bucket
+ * pointers. Iteration walks the chunks in memory order.
+ *
+ * Chunks are only returned to the system by clear(); erased nodes are reused
+ * by later insertions.
+ */
+template <typename K, typename T, typename Hash>
+class pooledmap
+{
+public:
+    typedef K key_type;
+    typedef T mapped_type;
+    typedef std::pair<const K, T> value_type;
+    typedef size_t size_type;
+
+    static const uint32_t CHUNK_NODES = 64;
+
+private:
+    static const uint32_t NO_NODE = std::numeric_limits<uint32_t>::max();
+    static const size_t NO_SLOT = std::numeric_limits<size_t>::max();
+    static const size_t MIN_TABLE_SIZE = 16;
+
+    struct Chunk
+    {
+        typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type nodes[CHUNK_NODES];
+        uint32_t hashes[CHUNK_NODES];
+        bool used[CHUNK_NODES];
+    };
+
+    struct Slot
+    {
+        uint32_t hash;
+        uint32_t node;
+    };
+
+    /** Held by pointer so that maps can be swapped with salted hashers, which are not assignable. */
+    std::unique_ptr<Hash> m_hasher;
+    std::vector<Chunk*> m_chunks;
+    /** Power of two sized, or empty before the first insertion. */
+    std::vector<Slot> m_table;
+    size_t m_size = 0;
+    /** Nodes below this number have been handed out at least once. */
+    uint32_t m_fresh = 0;
+    /** Head of the list of erased nodes, linked through their storage. */
+    uint32_t m_free = NO_NODE;
+
+    Chunk& ChunkOf(uint32_t node) const { return *m_chunks[node / CHUNK_NODES]; }
+    void* Storage(uint32_t node) const { return &ChunkOf(node).nodes[node % CHUNK_NODES]; }
+    value_type& Node(uint32_t node) const { return *static_cast<value_type*>(Storage(node)); }
+    bool Used(uint32_t node) const { return ChunkOf(node).used[node % CHUNK_NODES]; }
+
+    uint32_t NextUsed(uint32_t node) const
+    {
+        for (; node < m_fresh; ++node) {
+            if (Used(node)) return node;
+        }
+        return NO_NODE;
+    }
+
+    uint32_t AllocateNode()
+    {
+        if (m_free != NO_NODE) {
+            const uint32_t node = m_free;
+            memcpy(&m_free, Storage(node), sizeof(m_free));
+            return node;
+        }
+        if (m_fresh == m_chunks.size() * CHUNK_NODES) {
+            assert(m_fresh < NO_NODE - CHUNK_NODES);
+            m_chunks.push_back(new Chunk);
+            memset(m_chunks.back()->used, 0, sizeof(m_chunks.back()->used));
+        }
+        return m_fresh++;
+    }
+
+    void DestroyNode(uint32_t node)
+    {
+        Node(node).~value_type();
+        ChunkOf(node).used[node % CHUNK_NODES] = false;
+        memcpy(Storage(node), &m_free, sizeof(m_free));
+        m_free = node;
+    }
+
+    size_t FindSlot(const K& key, uint32_t hash) const
+    {
+        if (m_table.empty()) return NO_SLOT;
+        const size_t mask = m_table.size() - 1;
+        for (size_t pos = hash & mask;; pos = (pos + 1) & mask) {
+            const Slot& slot = m_table[pos];
+            if (slot.node == NO_NODE) return NO_SLOT;
+            if (slot.hash == hash && Node(slot.node).first == key) return pos;
+        }
+    }
+
+    size_t FindSlotOfNode(uint32_t node) const
+    {
+        const size_t mask = m_table.size() - 1;
+        for (size_t pos = ChunkOf(node).hashes[node % CHUNK_NODES] & mask;; pos = (pos + 1) & mask) {
+            if (m_table[pos].node == node) return pos;
+        }
+    }
+
+    static void PlaceSlot(std::vector<Slot>& table, const Slot& slot)
+    {
+        const size_t mask = table.size() - 1;
+        size_t pos = slot.hash & mask;
+        while (table[pos].node != NO_NODE) pos = (pos + 1) & mask;
+        table[pos] = slot;
+    }
+
+    void Grow()
+    {
+        std::vector<Slot> table(m_table.empty() ? MIN_TABLE_SIZE : m_table.size() * 2, Slot{0, NO_NODE});
+        for (const Slot& slot : m_table) {
+            if (slot.node != NO_NODE) PlaceSlot(table, slot);
+        }
+        m_table.swap(table);
+    }
+
+    /** Remove the slot at pos, shifting back the entries of its probe run that may fill the hole. */
+    void RemoveSlot(size_t pos)
+    {
+        const size_t mask = m_table.size() - 1;
+        size_t hole = pos;
+        for (size_t next = (hole + 1) & mask; m_table[next].node != NO_NODE; next = (next + 1) & mask) {
+            const size_t home = m_table[next].hash & mask;
+            if (((next - home) & mask) >= ((next - hole) & mask)) {
+                m_table[hole] = m_table[next];
+                hole = next;
+            }
+        }
+        m_table[hole].node = NO_NODE;
+    }
+
+    template <bool Const>
+    class iter
+    {
+        friend class pooledmap;
+        template <bool> friend class iter;
+        typedef typename std::conditional<Const, const pooledmap, pooledmap>::type map_type;
+
+        map_type* m_map;
+        uint32_t m_node;
+
+        iter(map_type* map, uint32_t node) : m_map(map), m_node(node) {}
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename pooledmap::value_type value_type;
+        typedef ptrdiff_t difference_type;
+        typedef typename std::conditional<Const, const value_type*, value_type*>::type pointer;
+        typedef typename std::conditional<Const, const value_type&, value_type&>::type reference;
+
+        iter() : m_map(nullptr), m_node(NO_NODE) {}
+        template <bool C = Const, typename std::enable_if<C, int>::type = 0>
+        iter(const iter<false>& other) : m_map(other.m_map), m_node(other.m_node) {}
+
+        reference operator*() const { return m_map->Node(m_node); }
+        pointer operator->() const { return &m_map->Node(m_node); }
+        iter& operator++() { m_node = m_map->NextUsed(m_node + 1); return *this; }
+        iter operator++(int) { iter copy(*this); ++*this; return copy; }
+        friend bool operator==(const iter& a, const iter& b) { return a.m_node == b.m_node; }
+        friend bool operator!=(const iter& a, const iter& b) { return a.m_node != b.m_node; }
+    };
+
+public:
+    typedef iter<false> iterator;
+    typedef iter<true> const_iterator;
+
+    pooledmap() : m_hasher(new Hash()) {}
+    ~pooledmap() { clear(); }
+    pooledmap(const pooledmap&) = delete;
+    pooledmap& operator=(const pooledmap&) = delete;
+
+    iterator begin() { return iterator(this, NextUsed(0)); }
+    const_iterator begin() const { return const_iterator(this, NextUsed(0)); }
+    iterator end() { return iterator(this, NO_NODE); }
+    const_iterator end() const { return const_iterator(this, NO_NODE); }
+
+    size_type size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    iterator find(const K& key)
+    {
+        const size_t pos = FindSlot(key, (*m_hasher)(key));
+        return iterator(this, pos == NO_SLOT ? NO_NODE : m_table[pos].node);
+    }
+
+    const_iterator find(const K& key) const
+    {
+        const size_t pos = FindSlot(key, (*m_hasher)(key));
+        return const_iterator(this, pos == NO_SLOT ? NO_NODE : m_table[pos].node);
+    }
+
+    size_type count(const K& key) const { return FindSlot(key, (*m_hasher)(key)) == NO_SLOT ? 0 : 1; }
+
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args)
+    {
+        const uint32_t node = AllocateNode();
+        try {
+            ::new (Storage(node)) value_type(std::forward<Args>(args)...);
+        } catch (...) {
+            memcpy(Storage(node), &m_free, sizeof(m_free));
+            m_free = node;
+            throw;
+        }
+        Chunk& chunk = ChunkOf(node);
+        chunk.used[node % CHUNK_NODES] = true;
+
+        const uint32_t hash = (*m_hasher)(Node(node).first);
+        const size_t pos = FindSlot(Node(node).first, hash);
+        if (pos != NO_SLOT) {
+            DestroyNode(node);
+            return std::make_pair(iterator(this, m_table[pos].node), false);
+        }
+        chunk.hashes[node % CHUNK_NODES] = hash;
+        // Keep the load factor at or below 3/4.
+        if ((m_size + 1) * 4 > m_table.size() * 3) Grow();
+        PlaceSlot(m_table, Slot{hash, node});
+        ++m_size;
+        return std::make_pair(iterator(this, node), true);
+    }
+
+    std::pair<iterator, bool> insert(const value_type& value) { return emplace(value); }
+
+    T& operator[](const K& key)
+    {
+        iterator it = find(key);
+        if (it != end()) return it->second;
+        return emplace(std::piecewise_construct, std::forward_as_tuple(key), std::tuple<>()).first->second;
+    }
+
+    /** Erase the entry at it and return the next one in iteration order. */
+    iterator erase(const_iterator it)
+    {
+        const uint32_t node = it.m_node;
+        RemoveSlot(FindSlotOfNode(node));
+        DestroyNode(node);
+        --m_size;
+        return iterator(this, NextUsed(node + 1));
+    }
+
+    iterator erase(iterator it) { return erase(const_iterator(it)); }
+
+    size_type erase(const K& key)
+    {
+        const size_t pos = FindSlot(key, (*m_hasher)(key));
+        if (pos == NO_SLOT) return 0;
+        const uint32_t node = m_table[pos].node;
+        RemoveSlot(pos);
+        DestroyNode(node);
+        --m_size;
+        return 1;
+    }
+
+    void swap(pooledmap& other)
+    {
+        m_hasher.swap(other.m_hasher);
+        m_chunks.swap(other.m_chunks);
+        m_table.swap(other.m_table);
+        std::swap(m_size, other.m_size);
+        std::swap(m_fresh, other.m_fresh);
+        std::swap(m_free, other.m_free);
+    }
+
+    /** Destroy all entries and release the chunks and the index. */
+    void clear()
+    {
+        for (uint32_t node = NextUsed(0); node != NO_NODE; node = NextUsed(node + 1)) {
+            Node(node).~value_type();
+        }
+        for (Chunk* chunk : m_chunks) delete chunk;
+        std::vector<Chunk*>().swap(m_chunks);
+        std::vector<Slot>().swap(m_table);
+        m_size = 0;
+        m_fresh = 0;
+        m_free = NO_NODE;
+    }
+
+    /** Memory held, for memusage::DynamicUsage. */
+    size_t chunk_count() const { return m_chunks.size(); }
+    static size_t chunk_bytes() { return sizeof(Chunk); }
+    size_t table_bytes() const { return m_table.size() * sizeof(Slot); }
+};
+
+#endif // BITCOIN_POOLEDMAP_H
@@ -3,6 +3,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <blockfilemap.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <core_io.h>
@@ -208,7 +209,11 @@ static bool rest_block(HTTPRequest* req,
     if (!ParseHashStr(hashStr, hash))
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
-    CBlock block;
+    // Unless witness data is to be stripped, the binary and hex formats are
+    // the block as stored on disk, which is served without deserializing it.
+    const bool fRaw = (rf == RetFormat::BINARY || rf == RetFormat::HEX) && RPCSerializationFlags() == 0;
+    std::shared_ptr<const CBlock> pblock;
+    MappedBlock block_data;
     CBlockIndex* pblockindex = nullptr;
     {
         LOCK(cs_main);
@@ -220,23 +225,29 @@ static bool rest_block(HTTPRequest* req,
         if (IsBlockPruned(pblockindex))
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
 
-        if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+        if (!fRaw)
+            pblock = ReadBlockFromDiskCached(pblockindex, Params().GetConsensus());
+        if (fRaw ? !ReadRawBlockFromDisk(block_data, pblockindex, Params().MessageStart()) : !pblock)
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
     }
 
     CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-    ssBlock << block;
+    Span<const uint8_t> block_bytes = block_data.Data();
+    if (!fRaw) {
+        ssBlock << *pblock;
+        block_bytes = Span<const uint8_t>(reinterpret_cast<const uint8_t*>(ssBlock.data()), ssBlock.size());
+    }
 
     switch (rf) {
     case RetFormat::BINARY: {
-        std::string binaryBlock = ssBlock.str();
+        std::string binaryBlock(block_bytes.begin(), block_bytes.end());
         req->WriteHeader("Content-Type", "application/octet-stream");
         req->WriteReply(HTTP_OK, binaryBlock);
         return true;
     }
 
     case RetFormat::HEX: {
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
+        std::string strHex = HexStr(block_bytes.begin(), block_bytes.end()) + "\n";
         req->WriteHeader("Content-Type", "text/plain");
         req->WriteReply(HTTP_OK, strHex);
         return true;
@@ -246,7 +257,7 @@ static bool rest_block(HTTPRequest* req,
         UniValue objBlock;
         {
             LOCK(cs_main);
-            objBlock = blockToJSON(block, pblockindex, showTxDetails);
+            objBlock = blockToJSON(*pblock, pblockindex, showTxDetails);
         }
         std::string strJSON = objBlock.write() + "\n";
         req->WriteHeader("Content-Type", "application/json");
@@ -124,6 +124,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "finalizepsbt", 1, "extract"},
     { "converttopsbt", 1, "permitsigdata"},
     { "converttopsbt", 2, "iswitness"},
+    { "gettxoutsetinfo", 1, "height" },
     { "gettxout", 1, "n" },
     { "gettxout", 2, "include_mempool" },
     { "gettxoutproof", 0, "txids" },
@@ -7,6 +7,7 @@
 #include <clientversion.h>
 #include <core_io.h>
 #include <crypto/ripemd160.h>
+#include <crypto/scrypt.h>
 #include <key_io.h>
 #include <validation.h>
 #include <httpserver.h>
@@ -290,6 +291,20 @@ static UniValue RPCLockedMemoryInfo()
     return obj;
 }
 
+static UniValue RPCScryptInfo()
+{
+    UniValue threads(UniValue::VARR);
+    for (const ScryptThreadStats& stats : scrypt_thread_stats()) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("name", stats.name);
+        obj.pushKV("hashes", stats.hashes);
+        obj.pushKV("scratchpad", uint64_t(stats.scratchpad));
+        obj.pushKV("hugepages", stats.huge_pages);
+        threads.push_back(obj);
+    }
+    return threads;
+}
+
 #ifdef HAVE_MALLOC_INFO
 static std::string RPCMallocInfo()
 {
@@ -331,7 +346,15 @@ static UniValue getmemoryinfo(const JSONRPCRequest& request)
             "    \"locked\": xxxxxx,       (numeric) Amount of bytes that succeeded locking. If this number is smaller than total, locking pages failed at some point and key data could be swapped to disk.\n"
             "    \"chunks_used\": xxxxx,   (numeric) Number allocated chunks\n"
             "    \"chunks_free\": xxxxx,   (numeric) Number unused chunks\n"
-            "  }\n"
+            "  },\n"
+            "  \"scrypt\": [              (json array) Proof of work hashing per thread\n"
+            "    {\n"
+            "      \"name\": \"xxxx\",       (string) Thread name, \"exited\" for the sum over threads that have finished\n"
+            "      \"hashes\": xxxxx,      (numeric) Number of scrypt hashes computed\n"
+            "      \"scratchpad\": xxxxx,  (numeric) Bytes of scratchpad held by the thread\n"
+            "      \"hugepages\": true|false (boolean) Whether the scratchpad is backed by huge pages\n"
+            "    },...\n"
+            "  ]\n"
             "}\n"
             "\nResult (mode \"mallocinfo\"):\n"
             "\"<malloc version=\"1\">...\"\n"
@@ -344,6 +367,7 @@ static UniValue getmemoryinfo(const JSONRPCRequest& request)
     if (mode == "stats") {
         UniValue obj(UniValue::VOBJ);
         obj.pushKV("locked", RPCLockedMemoryInfo());
+        obj.pushKV("scrypt", RPCScryptInfo());
         return obj;
     } else if (mode == "mallocinfo") {
 #ifdef HAVE_MALLOC_INFO
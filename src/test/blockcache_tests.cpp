@@ -0,0 +1,79 @@
+// Copyright (c) 2020 The Earthcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockcache.h>
+
+#include <primitives/transaction.h>
+#include <test/test_bitcoin.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockcache_tests, BasicTestingSetup)
+
+static std::shared_ptr<const CBlock> MakeBlock(size_t txs)
+{
+    std::shared_ptr<CBlock> block = std::make_shared<CBlock>();
+    block->nNonce = InsecureRand32();
+    for (size_t i = 0; i < txs; ++i) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << std::vector<unsigned char>(100, 1);
+        block->vtx.push_back(MakeTransactionRef(std::move(tx)));
+    }
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(blockcache_lru)
+{
+    std::vector<std::shared_ptr<const CBlock>> blocks;
+    for (int i = 0; i < 4; ++i) {
+        blocks.push_back(MakeBlock(10));
+    }
+
+    // Find the usage of a block by filling an unbounded cache with one.
+    BlockCache sizing(std::numeric_limits<size_t>::max());
+    sizing.Insert(blocks[0]->GetHash(), blocks[0]);
+    const size_t block_usage = sizing.GetStats().usage;
+    BOOST_CHECK(block_usage > 0);
+
+    BlockCache cache(block_usage * 3);
+    for (int i = 0; i < 3; ++i) {
+        cache.Insert(blocks[i]->GetHash(), blocks[i]);
+    }
+    BOOST_CHECK_EQUAL(cache.GetStats().entries, 3U);
+    BOOST_CHECK(cache.Get(blocks[0]->GetHash()) == blocks[0]);
+
+    // The least recently used block makes room for a new one.
+    cache.Insert(blocks[3]->GetHash(), blocks[3]);
+    BOOST_CHECK(!cache.Get(blocks[1]->GetHash()));
+    BOOST_CHECK(cache.Get(blocks[0]->GetHash()) == blocks[0]);
+    BOOST_CHECK(cache.Get(blocks[2]->GetHash()) == blocks[2]);
+    BOOST_CHECK(cache.Get(blocks[3]->GetHash()) == blocks[3]);
+
+    BlockCacheStats stats = cache.GetStats();
+    BOOST_CHECK_EQUAL(stats.entries, 3U);
+    BOOST_CHECK_EQUAL(stats.usage, block_usage * 3);
+    BOOST_CHECK_EQUAL(stats.hits, 4U);
+    BOOST_CHECK_EQUAL(stats.misses, 1U);
+
+    // Blocks larger than the whole cache are not held at all.
+    cache.Insert(uint256S("01"), MakeBlock(100));
+    BOOST_CHECK(!cache.Get(uint256S("01")));
+    BOOST_CHECK_EQUAL(cache.GetStats().entries, 3U);
+
+    // Shrinking the cache drops blocks; disabling it drops all.
+    cache.SetMaxUsage(block_usage);
+    BOOST_CHECK_EQUAL(cache.GetStats().entries, 1U);
+    BOOST_CHECK(cache.Get(blocks[3]->GetHash()) == blocks[3]);
+    cache.SetMaxUsage(0);
+    cache.Insert(blocks[0]->GetHash(), blocks[0]);
+    stats = cache.GetStats();
+    BOOST_CHECK_EQUAL(stats.entries, 0U);
+    BOOST_CHECK_EQUAL(stats.usage, 0U);
+    BOOST_CHECK_EQUAL(stats.max_usage, 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,162 @@
+// Copyright (c) 2020 The Earthcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockcompression.h>
+
+#include <test/test_bitcoin.h>
+#include <util.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockcompression_tests, BasicTestingSetup)
+
+static Span<const uint8_t> ReadOnly(const std::vector<uint8_t>& data) { return MakeSpan(data); }
+
+/** Data like that of block files: random bytes (hashes, signatures) interleaved with repeats of earlier data (scripts, amounts). */
+static std::vector<uint8_t> BlockLikeData(size_t size)
+{
+    std::vector<uint8_t> data;
+    while (data.size() < size) {
+        if (data.size() > 100 && InsecureRandBool()) {
+            const size_t length = 4 + InsecureRandRange(300);
+            const size_t from = data.size() - 1 - InsecureRandRange(std::min<size_t>(data.size(), 70000));
+            for (size_t i = 0; i < length; ++i) data.push_back(data[from + i]);
+        } else {
+            std::vector<uint8_t> random = insecure_rand_ctx.randbytes(1 + InsecureRandRange(100));
+            data.insert(data.end(), random.begin(), random.end());
+        }
+    }
+    data.resize(size);
+    return data;
+}
+
+static void CheckRoundTrip(const std::vector<uint8_t>& data, bool compressible)
+{
+    std::vector<uint8_t> packed;
+    BOOST_CHECK_EQUAL(CompressBlockData(MakeSpan(data), packed), compressible);
+    if (!compressible) return;
+    BOOST_CHECK(packed.size() < data.size());
+
+    std::vector<uint8_t> unpacked(data.size());
+    BOOST_REQUIRE(DecompressBlockData(ReadOnly(packed), MakeSpan(unpacked)));
+    BOOST_CHECK(unpacked == data);
+    // The size of the original is part of what is checked.
+    std::vector<uint8_t> longer(data.size() + 1);
+    BOOST_CHECK(!DecompressBlockData(ReadOnly(packed), MakeSpan(longer)));
+    std::vector<uint8_t> shorter(data.size() - 1);
+    BOOST_CHECK(!DecompressBlockData(ReadOnly(packed), MakeSpan(shorter)));
+}
+
+BOOST_AUTO_TEST_CASE(blockcompression_codec)
+{
+    CheckRoundTrip({}, false);
+    CheckRoundTrip(std::vector<uint8_t>(10, 7), false);
+    CheckRoundTrip(insecure_rand_ctx.randbytes(5000), false);
+    // Runs, which are matches overlapping what they produce, and long lengths.
+    CheckRoundTrip(std::vector<uint8_t>(100000, 0), true);
+    std::vector<uint8_t> pattern;
+    for (int i = 0; i < 3000; ++i) pattern.push_back(i % 3);
+    CheckRoundTrip(pattern, true);
+    std::vector<uint8_t> literals = insecure_rand_ctx.randbytes(1000);
+    literals.insert(literals.end(), 1000, 0x42);
+    CheckRoundTrip(literals, true);
+    for (int i = 0; i < 20; ++i) {
+        CheckRoundTrip(BlockLikeData(1000 + InsecureRandRange(BLOCK_COMPRESSION_FRAME_SIZE)), true);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(blockcompression_corrupt)
+{
+    const std::vector<uint8_t> data = BlockLikeData(20000);
+    std::vector<uint8_t> packed;
+    BOOST_REQUIRE(CompressBlockData(MakeSpan(data), packed));
+    std::vector<uint8_t> unpacked(data.size());
+
+    for (size_t length = 0; length < packed.size(); length += 1 + InsecureRandRange(50)) {
+        BOOST_CHECK(!DecompressBlockData(Span<const uint8_t>(packed.data(), length), MakeSpan(unpacked)));
+    }
+    // Corrupt data either fails to decompress or decompresses to something else, but stays within its buffers.
+    for (int i = 0; i < 1000; ++i) {
+        std::vector<uint8_t> corrupt = packed;
+        corrupt[InsecureRandRange(corrupt.size())] ^= 1 + InsecureRandRange(255);
+        DecompressBlockData(ReadOnly(corrupt), MakeSpan(unpacked));
+    }
+    const uint8_t bad_offset[] = {0x10, 'a', 0x02, 0x00, 0x00};
+    std::vector<uint8_t> out(10);
+    BOOST_CHECK(!DecompressBlockData(MakeSpan(bad_offset), Span<uint8_t>(out.data(), 5)));
+}
+
+static void WriteFile(const fs::path& path, const std::vector<uint8_t>& data)
+{
+    FILE* file = fsbridge::fopen(path, "wb");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fwrite(data.data(), 1, data.size(), file), data.size());
+    fclose(file);
+}
+
+static std::vector<uint8_t> ReadFile(const fs::path& path)
+{
+    std::vector<uint8_t> data(fs::file_size(path));
+    FILE* file = fsbridge::fopen(path, "rb");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fread(data.data(), 1, data.size(), file), data.size());
+    fclose(file);
+    return data;
+}
+
+BOOST_AUTO_TEST_CASE(blockcompression_file)
+{
+    const fs::path dir = SetDataDir("blockcompression");
+    // Some frames compress, the one of random data does not, and the last one is short.
+    std::vector<uint8_t> data = BlockLikeData(3 * BLOCK_COMPRESSION_FRAME_SIZE);
+    std::vector<uint8_t> random = insecure_rand_ctx.randbytes(BLOCK_COMPRESSION_FRAME_SIZE);
+    data.insert(data.end(), random.begin(), random.end());
+    data.resize(data.size() + 1234, 0);
+    WriteFile(dir / "blk00000.dat", data);
+
+    BOOST_REQUIRE(CompressBlockFile(dir / "blk00000.dat", dir / "blkz00000.dat"));
+    const std::vector<uint8_t> compressed = ReadFile(dir / "blkz00000.dat");
+    BOOST_CHECK(compressed.size() < data.size());
+
+    for (int i = 0; i < 200; ++i) {
+        const size_t pos = InsecureRandRange(data.size());
+        const size_t length = InsecureRandRange(std::min<size_t>(data.size() - pos, 3 * BLOCK_COMPRESSION_FRAME_SIZE) + 1);
+        std::vector<uint8_t> read(length);
+        BOOST_REQUIRE(ReadCompressedBlockFile(MakeSpan(compressed), pos, MakeSpan(read)));
+        BOOST_CHECK(std::equal(read.begin(), read.end(), data.begin() + pos));
+    }
+    std::vector<uint8_t> frame(BLOCK_COMPRESSION_FRAME_SIZE);
+    BOOST_CHECK(ReadCompressedBlockFile(MakeSpan(compressed), BLOCK_COMPRESSION_FRAME_SIZE, MakeSpan(frame)));
+    BOOST_CHECK(std::equal(frame.begin(), frame.end(), data.begin() + BLOCK_COMPRESSION_FRAME_SIZE));
+    // Reads beyond the end of the original fail.
+    std::vector<uint8_t> tail(2);
+    BOOST_CHECK(!ReadCompressedBlockFile(MakeSpan(compressed), data.size() - 1, MakeSpan(tail)));
+    BOOST_CHECK(!ReadCompressedBlockFile(MakeSpan(compressed), data.size() + 1, Span<uint8_t>(tail.data(), tail.data())));
+
+    FILE* file = fsbridge::fopen(dir / "blk00000.dat", "wb+");
+    BOOST_REQUIRE(file);
+    BOOST_CHECK(DecompressBlockFile(MakeSpan(compressed), file));
+    fclose(file);
+    BOOST_CHECK(ReadFile(dir / "blk00000.dat") == data);
+
+    std::vector<uint8_t> corrupt = compressed;
+    corrupt[0] ^= 1;
+    BOOST_CHECK(!ReadCompressedBlockFile(ReadOnly(corrupt), 0, MakeSpan(tail)));
+    // A frame index pointing outside of the file.
+    corrupt = compressed;
+    corrupt[16 + 8 + 7] = 0xff;
+    BOOST_CHECK(!ReadCompressedBlockFile(ReadOnly(corrupt), BLOCK_COMPRESSION_FRAME_SIZE, MakeSpan(tail)));
+    BOOST_CHECK(!ReadCompressedBlockFile(Span<const uint8_t>(compressed.data(), 20), 0, MakeSpan(tail)));
+}
+
+BOOST_AUTO_TEST_CASE(blockcompression_empty_file)
+{
+    const fs::path dir = SetDataDir("blockcompression_empty");
+    WriteFile(dir / "rev00000.dat", {});
+    BOOST_REQUIRE(CompressBlockFile(dir / "rev00000.dat", dir / "revz00000.dat"));
+    const std::vector<uint8_t> compressed = ReadFile(dir / "revz00000.dat");
+    BOOST_CHECK(ReadCompressedBlockFile(MakeSpan(compressed), 0, Span<uint8_t>()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,96 @@
+// Copyright (c) 2020 The Earthcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilemap.h>
+
+#include <streams.h>
+#include <test/test_bitcoin.h>
+#include <util.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilemap_tests, BasicTestingSetup)
+
+static void AppendToFile(const fs::path& path, const std::vector<uint8_t>& data)
+{
+    FILE* file = fsbridge::fopen(path, "ab");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fwrite(data.data(), 1, data.size(), file), data.size());
+    fclose(file);
+}
+
+BOOST_AUTO_TEST_CASE(blockfilemap_cache)
+{
+    const fs::path dir = SetDataDir("blockfilemap");
+    auto file_path = [&dir](int file) { return dir / strprintf("blk%05u.dat", file); };
+    for (int file = 0; file < 3; ++file) {
+        AppendToFile(file_path(file), std::vector<uint8_t>(100, file));
+    }
+    if (!BlockFileMapping::Map(file_path(0))) {
+        BOOST_TEST_MESSAGE("Block files cannot be mapped on this platform");
+        return;
+    }
+
+    BlockFileMapCache cache(file_path, 2);
+    std::shared_ptr<const BlockFileMapping> mapping = cache.Get(0, 100);
+    BOOST_REQUIRE(mapping);
+    BOOST_CHECK_EQUAL(mapping->Data().size(), 100);
+    BOOST_CHECK_EQUAL(mapping->Data()[99], 0);
+    BOOST_CHECK(cache.Get(0, 50) == mapping);
+
+    // A mapping too short for the data asked for is replaced once the file has grown.
+    BOOST_CHECK(!cache.Get(1, 150));
+    AppendToFile(file_path(1), std::vector<uint8_t>(100, 7));
+    std::shared_ptr<const BlockFileMapping> grown = cache.Get(1, 150);
+    BOOST_REQUIRE(grown);
+    BOOST_CHECK_EQUAL(grown->Data().size(), 200);
+    BOOST_CHECK_EQUAL(grown->Data()[150], 7);
+
+    // Only the two most recently used mappings are kept, but the views handed out stay valid.
+    BOOST_CHECK(cache.Get(2, 100) != nullptr);
+    BOOST_CHECK(cache.Get(0, 100) != mapping);
+    BOOST_CHECK_EQUAL(mapping->Data()[0], 0);
+    BOOST_CHECK(cache.Get(2, 100) == cache.Get(2, 100));
+    cache.Forget(2);
+    mapping = cache.Get(2, 100);
+    BOOST_REQUIRE(mapping);
+    BOOST_CHECK_EQUAL(mapping->Data()[0], 2);
+
+    // A cached mapping of a file truncated since is not handed out again: reading its
+    // pages past the new end would fault.
+    mapping.reset();
+    BOOST_REQUIRE(cache.Get(1, 150));
+    fs::resize_file(file_path(1), 120);
+    BOOST_CHECK(!cache.Get(1, 150));
+    std::shared_ptr<const BlockFileMapping> shrunk = cache.Get(1, 100);
+    BOOST_REQUIRE(shrunk);
+    BOOST_CHECK_EQUAL(shrunk->Data().size(), 120);
+    fs::remove(file_path(1));
+    BOOST_CHECK(!cache.Get(1, 0));
+}
+
+BOOST_AUTO_TEST_CASE(blockfilemap_mappedblock)
+{
+    MappedBlock block;
+    Span<uint8_t> buffer = block.SetBuffer(6);
+    uint32_t value = 0x01020304;
+    uint16_t other = 0x0506;
+    CDataStream ss(SER_DISK, 0);
+    ss << value << other;
+    std::copy(ss.begin(), ss.end(), buffer.begin());
+
+    // The view moves along with the buffer it points into.
+    MappedBlock moved(std::move(block));
+    SpanReader reader(SER_DISK, 0, moved.Data());
+    BOOST_CHECK_EQUAL(reader.size(), 6);
+    uint32_t read_value;
+    uint16_t read_other;
+    reader >> read_value >> read_other;
+    BOOST_CHECK_EQUAL(read_value, value);
+    BOOST_CHECK_EQUAL(read_other, other);
+    BOOST_CHECK(reader.empty());
+    BOOST_CHECK_THROW(reader >> read_other, std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,141 @@
+// Copyright (c) 2020 The Earthcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <test/test_bitcoin.h>
+#include <txdb.h>
+#include <util.h>
+
+#include <map>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockindexsnapshot_tests, BasicTestingSetup)
+
+typedef std::map<uint256, CBlockIndex*> TestBlockMap;
+
+static CBlockIndex* Insert(CBlockIndexArena& arena, TestBlockMap& map, const uint256& hash)
+{
+    if (hash.IsNull()) return nullptr;
+    auto it = map.find(hash);
+    if (it != map.end()) return it->second;
+    CBlockIndex* pindex = arena.Create();
+    pindex->phashBlock = &map.emplace(hash, pindex).first->first;
+    return pindex;
+}
+
+static void Load(CBlockTreeDB& db, CBlockIndexArena& arena, TestBlockMap& map)
+{
+    map.clear();
+    arena.Clear();
+    BOOST_CHECK(db.LoadBlockIndexGuts(Params().GetConsensus(), [&](const uint256& hash) { return Insert(arena, map, hash); }));
+}
+
+static void CheckEqual(const TestBlockMap& expected, const TestBlockMap& loaded)
+{
+    BOOST_REQUIRE_EQUAL(expected.size(), loaded.size());
+    for (const auto& entry : expected) {
+        auto it = loaded.find(entry.first);
+        BOOST_REQUIRE(it != loaded.end());
+        const CBlockIndex* a = entry.second;
+        const CBlockIndex* b = it->second;
+        BOOST_CHECK_EQUAL(a->GetBlockHeader().GetHash(), b->GetBlockHeader().GetHash());
+        BOOST_CHECK((a->pprev ? a->pprev->GetBlockHash() : uint256()) == (b->pprev ? b->pprev->GetBlockHash() : uint256()));
+        BOOST_CHECK_EQUAL(a->nHeight, b->nHeight);
+        BOOST_CHECK_EQUAL(a->nStatus, b->nStatus);
+        BOOST_CHECK_EQUAL(a->nTx, b->nTx);
+        BOOST_CHECK_EQUAL(a->nFile, b->nFile);
+        BOOST_CHECK_EQUAL(a->nDataPos, b->nDataPos);
+        BOOST_CHECK_EQUAL(a->nUndoPos, b->nUndoPos);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(blockindexsnapshot_roundtrip)
+{
+    const fs::path snapshot = GetBlocksDir() / "index.snapshot";
+    CBlockTreeDB db(1 << 20, true);
+
+    // A chain with a fork, some of it with data on disk.
+    CBlockIndexArena arena;
+    TestBlockMap blocks;
+    std::vector<CBlockIndex*> chain;
+    std::vector<const CBlockIndex*> entries;
+    CBlockIndex* pprev = nullptr;
+    for (int i = 0; i < 300; i++) {
+        // The database keys entries by the hash of their header, so that is what they are indexed by here too.
+        CBlockIndex* pindex = arena.Create();
+        pindex->pprev = i == 200 ? chain[150] : pprev;
+        pindex->nHeight = pindex->pprev ? pindex->pprev->nHeight + 1 : 0;
+        pindex->nVersion = 4;
+        pindex->hashMerkleRoot = InsecureRand256();
+        pindex->nTime = InsecureRand32();
+        pindex->nBits = 0x1e0ffff0;
+        pindex->nNonce = InsecureRand32();
+        pindex->nTx = 1 + InsecureRandRange(100);
+        pindex->nStatus = BLOCK_VALID_TREE | (i % 3 ? BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO : 0);
+        if (pindex->nStatus & BLOCK_HAVE_DATA) {
+            pindex->nFile = i / 100;
+            pindex->nDataPos = 8 + i * 1000;
+            pindex->nUndoPos = 8 + i * 100;
+        }
+        pindex->phashBlock = &blocks.emplace(pindex->GetBlockHeader().GetHash(), pindex).first->first;
+        chain.push_back(pindex);
+        entries.push_back(pindex);
+        pprev = pindex;
+    }
+    BOOST_REQUIRE(db.WriteBatchSync({}, 0, entries));
+
+    // Without a snapshot, the index comes from the database.
+    CBlockIndexArena arena_loaded;
+    TestBlockMap loaded;
+    Load(db, arena_loaded, loaded);
+    CheckEqual(blocks, loaded);
+
+    BOOST_REQUIRE(db.WriteBlockIndexSnapshot(entries));
+    BOOST_CHECK(fs::exists(snapshot));
+    Load(db, arena_loaded, loaded);
+    CheckEqual(blocks, loaded);
+    // The snapshot is used only once.
+    BOOST_CHECK(!fs::exists(snapshot));
+    Load(db, arena_loaded, loaded);
+    CheckEqual(blocks, loaded);
+
+    // A snapshot that does not match the database is not used.
+    BOOST_REQUIRE(db.WriteBlockIndexSnapshot(entries));
+    FILE* file = fsbridge::fopen(snapshot, "ab");
+    BOOST_REQUIRE(file);
+    fputc(0, file);
+    fclose(file);
+    Load(db, arena_loaded, loaded);
+    CheckEqual(blocks, loaded);
+    BOOST_CHECK(!fs::exists(snapshot));
+
+    // Neither is one taken before the block index was written again.
+    CBlockIndex* pindex = arena.Create();
+    pindex->pprev = chain.back();
+    pindex->nHeight = pindex->pprev->nHeight + 1;
+    pindex->nVersion = 4;
+    pindex->nTime = InsecureRand32();
+    pindex->nBits = 0x1e0ffff0;
+    pindex->nStatus = BLOCK_VALID_TREE;
+    pindex->phashBlock = &blocks.emplace(pindex->GetBlockHeader().GetHash(), pindex).first->first;
+    BOOST_REQUIRE(db.WriteBlockIndexSnapshot(entries));
+    BOOST_REQUIRE(db.WriteBatchSync({}, 0, {pindex}));
+    entries.push_back(pindex);
+    Load(db, arena_loaded, loaded);
+    CheckEqual(blocks, loaded);
+    BOOST_CHECK(!fs::exists(snapshot));
+
+    // Nor one taken before a binary that does not know about snapshots (and so
+    // leaves the snapshot id and the generation in place) stored a block.
+    BOOST_REQUIRE(db.WriteBlockIndexSnapshot(entries));
+    CBlockFileInfo info;
+    info.AddBlock(pindex->nHeight, pindex->nTime);
+    BOOST_REQUIRE(db.Write(std::make_pair('f', 0), info, true));
+    Load(db, arena_loaded, loaded);
+    CheckEqual(blocks, loaded);
+    BOOST_CHECK(!fs::exists(snapshot));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
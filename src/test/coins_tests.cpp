@@ -4,6 +4,7 @@
 
 #include <coins.h>
 #include <script/standard.h>
+#include <txdb.h>
 #include <uint256.h>
 #include <undo.h>
 #include <utilstrencodings.h>
@@ -855,4 +856,70 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_AUTO_TEST_CASE(ccoins_prefetch)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    const COutPoint prefetched(InsecureRand256(), 0);
+    const COutPoint added(InsecureRand256(), 1);
+    cache.AddCoin(added, Coin(CTxOut(1, CScript()), 1, false), false);
+
+    cache.AddPrefetchedCoin(prefetched, Coin(CTxOut(2, CScript() << std::vector<unsigned char>(100, 1)), 1, false));
+    cache.AddPrefetchedCoin(added, Coin(CTxOut(3, CScript()), 1, false));
+    BOOST_CHECK(cache.HaveCoinInCache(prefetched));
+    BOOST_CHECK_EQUAL(cache.AccessCoin(prefetched).out.nValue, 2);
+    BOOST_CHECK_EQUAL(cache.AccessCoin(added).out.nValue, 1);
+    cache.SelfTest();
+
+    // A prefetched coin is not modified, so it is not written back.
+    cache.SetBestBlock(InsecureRand256());
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(!base.HaveCoin(prefetched));
+    BOOST_CHECK(base.HaveCoin(added));
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_db_background_flush)
+{
+    CCoinsViewDB db(1 << 20, true, false, true);
+    BOOST_CHECK(db.FlushesInBackground());
+    CCoinsViewCache cache(&db);
+
+    std::vector<COutPoint> outpoints;
+    for (int i = 0; i < 1000; ++i) {
+        outpoints.emplace_back(InsecureRand256(), i % 3);
+        cache.AddCoin(outpoints.back(), Coin(CTxOut(i + 1, CScript() << i), 1, false), false);
+    }
+    const uint256 block1 = InsecureRand256();
+    cache.SetBestBlock(block1);
+    BOOST_CHECK(cache.Flush());
+
+    // Whether or not the write has completed, the coins are there.
+    BOOST_CHECK(db.GetBestBlock() == block1);
+    for (int i = 0; i < 1000; ++i) {
+        Coin coin;
+        BOOST_CHECK(db.GetCoin(outpoints[i], coin));
+        BOOST_CHECK_EQUAL(coin.out.nValue, i + 1);
+    }
+
+    // Spends flushed while the first write may still be in flight stay spent.
+    for (int i = 0; i < 1000; i += 2) {
+        BOOST_CHECK(cache.SpendCoin(outpoints[i]));
+    }
+    const uint256 block2 = InsecureRand256();
+    cache.SetBestBlock(block2);
+    BOOST_CHECK(cache.Flush());
+    for (int i = 0; i < 1000; ++i) {
+        BOOST_CHECK_EQUAL(db.HaveCoin(outpoints[i]), i % 2 == 1);
+    }
+
+    BOOST_CHECK(db.Sync());
+    BOOST_CHECK_EQUAL(db.DynamicMemoryUsage(), 0U);
+    BOOST_CHECK(db.GetBestBlock() == block2);
+    BOOST_CHECK(db.GetHeadBlocks().empty());
+    size_t count = 0;
+    std::unique_ptr<CCoinsViewCursor> cursor(db.Cursor());
+    for (; cursor->Valid(); cursor->Next()) ++count;
+    BOOST_CHECK_EQUAL(count, 500U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
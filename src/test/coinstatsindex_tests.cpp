@@ -0,0 +1,174 @@
+// Copyright (c) 2020 The Earthcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <coins.h>
+#include <consensus/validation.h>
+#include <index/coinstatsindex.h>
+#include <script/interpreter.h>
+#include <test/test_bitcoin.h>
+#include <txdb.h>
+#include <util.h>
+#include <utiltime.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(coinstatsindex_tests)
+
+/** The statistics of the chainstate at its best block, computed by scanning it. */
+static CoinStatsIndex::Stats ScanUTXOSet()
+{
+    FlushStateToDisk();
+    CoinStatsIndex::Stats stats;
+    MuHash3072 muhash;
+    std::unique_ptr<CCoinsViewCursor> cursor(pcoinsdbview->Cursor());
+    for (; cursor->Valid(); cursor->Next()) {
+        COutPoint outpoint;
+        Coin coin;
+        BOOST_REQUIRE(cursor->GetKey(outpoint) && cursor->GetValue(coin));
+        ApplyCoinHash(muhash, outpoint, coin);
+        stats.transaction_output_count++;
+        stats.bogo_size += GetBogoSize(coin.out.scriptPubKey);
+        stats.total_amount += coin.out.nValue;
+    }
+    muhash.Finalize(stats.muhash.begin());
+    return stats;
+}
+
+static void CheckTipStats(const CoinStatsIndex& index)
+{
+    const CoinStatsIndex::Stats expected = ScanUTXOSet();
+    CoinStatsIndex::Stats stats;
+    const CBlockIndex* tip;
+    {
+        LOCK(cs_main);
+        tip = chainActive.Tip();
+    }
+    BOOST_REQUIRE(index.LookUpStats(tip, stats));
+    BOOST_CHECK(stats.muhash == expected.muhash);
+    BOOST_CHECK_EQUAL(stats.transaction_output_count, expected.transaction_output_count);
+    BOOST_CHECK_EQUAL(stats.bogo_size, expected.bogo_size);
+    BOOST_CHECK_EQUAL(stats.total_amount, expected.total_amount);
+}
+
+BOOST_FIXTURE_TEST_CASE(coinstatsindex_initial_sync, TestChain100Setup)
+{
+    CoinStatsIndex coin_stats_index(1 << 20, true);
+
+    // Nothing is indexed before the index is started.
+    CoinStatsIndex::Stats stats;
+    const CBlockIndex* genesis;
+    {
+        LOCK(cs_main);
+        genesis = chainActive.Genesis();
+    }
+    BOOST_CHECK(!coin_stats_index.LookUpStats(genesis, stats));
+    BOOST_CHECK(!coin_stats_index.BlockUntilSyncedToCurrentChain());
+
+    coin_stats_index.Start();
+
+    // Allow the index to catch up with the block index.
+    constexpr int64_t timeout_ms = 10 * 1000;
+    int64_t time_start = GetTimeMillis();
+    while (!coin_stats_index.BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+        MilliSleep(100);
+    }
+
+    // The genesis block's outputs never enter the UTXO set.
+    BOOST_REQUIRE(coin_stats_index.LookUpStats(genesis, stats));
+    BOOST_CHECK_EQUAL(stats.transaction_output_count, 0U);
+    BOOST_CHECK_EQUAL(stats.total_amount, 0);
+    uint256 empty_hash;
+    MuHash3072().Finalize(empty_hash.begin());
+    BOOST_CHECK(stats.muhash == empty_hash);
+
+    CheckTipStats(coin_stats_index);
+
+    // A block that spends a coin both removes and adds outputs.
+    CScript script_pub_key = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(m_coinbase_txns[0]->GetHash(), 0);
+    spend.vout.resize(2);
+    spend.vout[0].nValue = m_coinbase_txns[0]->vout[0].nValue / 2;
+    spend.vout[0].scriptPubKey = script_pub_key;
+    spend.vout[1].nValue = 0;
+    spend.vout[1].scriptPubKey = CScript() << OP_RETURN;
+    std::vector<unsigned char> sig;
+    uint256 hash = SignatureHash(script_pub_key, spend, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+    BOOST_REQUIRE(coinbaseKey.Sign(hash, sig));
+    sig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << sig;
+
+    const CBlock block = CreateAndProcessBlock({spend}, script_pub_key);
+    const CBlockIndex* tip;
+    {
+        LOCK(cs_main);
+        tip = chainActive.Tip();
+    }
+    BOOST_REQUIRE(tip->GetBlockHash() == block.GetHash());
+    BOOST_CHECK(coin_stats_index.BlockUntilSyncedToCurrentChain());
+    CheckTipStats(coin_stats_index);
+
+    // The subsidy of every block is accounted for, whatever the miners claimed.
+    BOOST_REQUIRE(coin_stats_index.LookUpStats(tip, stats));
+    CAmount total_subsidy = 0;
+    for (int height = 1; height <= tip->nHeight; ++height) {
+        total_subsidy += GetBlockSubsidy(height, Params().GetConsensus());
+    }
+    BOOST_CHECK_EQUAL(stats.total_subsidy, total_subsidy);
+
+    coin_stats_index.Stop(); // Stop thread before calling destructor
+}
+
+static void WaitForSync(CoinStatsIndex& index)
+{
+    constexpr int64_t timeout_ms = 10 * 1000;
+    int64_t time_start = GetTimeMillis();
+    while (!index.BlockUntilSyncedToCurrentChain()) {
+        BOOST_REQUIRE(time_start + timeout_ms > GetTimeMillis());
+        MilliSleep(100);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(coinstatsindex_reorg_and_restart, TestChain100Setup)
+{
+    std::unique_ptr<CoinStatsIndex> index = MakeUnique<CoinStatsIndex>(1 << 20, false, true);
+    index->Start();
+    WaitForSync(*index);
+    CheckTipStats(*index);
+
+    // Replacing the tip moves the rolling hash back to its parent first.
+    CBlockIndex* stale_tip;
+    {
+        LOCK(cs_main);
+        stale_tip = chainActive.Tip();
+        CValidationState state;
+        BOOST_REQUIRE(InvalidateBlock(state, Params(), stale_tip));
+    }
+    CreateAndProcessBlock({}, CScript() << OP_TRUE);
+    BOOST_CHECK(index->BlockUntilSyncedToCurrentChain());
+    CheckTipStats(*index);
+
+    // The stats of the disconnected block are still there.
+    CoinStatsIndex::Stats stats;
+    BOOST_CHECK(index->LookUpStats(stale_tip, stats));
+
+    // After a restart the rolling hash is picked up from the database.
+    index->Stop();
+    index.reset();
+    index = MakeUnique<CoinStatsIndex>(1 << 20);
+    index->Start();
+    WaitForSync(*index);
+    CreateAndProcessBlock({}, CScript() << OP_TRUE);
+    BOOST_CHECK(index->BlockUntilSyncedToCurrentChain());
+    CheckTipStats(*index);
+
+    index->Stop(); // Stop thread before calling destructor
+}
+
+BOOST_AUTO_TEST_SUITE_END()
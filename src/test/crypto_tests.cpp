@@ -4,6 +4,7 @@
 
 #include <crypto/aes.h>
 #include <crypto/chacha20.h>
+#include <crypto/muhash.h>
 #include <crypto/ripemd160.h>
 #include <crypto/sha1.h>
 #include <crypto/sha256.h>
@@ -11,6 +12,7 @@
 #include <crypto/hmac_sha256.h>
 #include <crypto/hmac_sha512.h>
 #include <random.h>
+#include <streams.h>
 #include <utilstrencodings.h>
 #include <test/test_bitcoin.h>
 
@@ -562,4 +564,68 @@ BOOST_AUTO_TEST_CASE(sha256d64)
     }
 }
 
+static uint256 FinalizedMuHash(MuHash3072 muhash)
+{
+    uint256 hash;
+    muhash.Finalize(hash.begin());
+    return hash;
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    std::vector<unsigned char> elements[4];
+    for (int i = 0; i < 4; ++i) {
+        elements[i] = insecure_rand_ctx.randbytes(36 + i);
+    }
+
+    // The empty set hashes to SHA256 of the number 1.
+    unsigned char one[Num3072::BYTE_SIZE] = {1};
+    uint256 empty_hash;
+    CSHA256().Write(one, sizeof(one)).Finalize(empty_hash.begin());
+    BOOST_CHECK(FinalizedMuHash(MuHash3072()) == empty_hash);
+
+    MuHash3072 forward, backward;
+    for (int i = 0; i < 4; ++i) {
+        forward.Insert(elements[i].data(), elements[i].size());
+        backward.Insert(elements[3 - i].data(), elements[3 - i].size());
+    }
+    const uint256 all_hash = FinalizedMuHash(forward);
+    BOOST_CHECK(all_hash == FinalizedMuHash(backward));
+    BOOST_CHECK(all_hash != empty_hash);
+
+    // Removing an element undoes inserting it, before or after the insertion.
+    MuHash3072 three;
+    three.Remove(elements[2].data(), elements[2].size());
+    for (int i = 0; i < 4; ++i) {
+        three.Insert(elements[i].data(), elements[i].size());
+    }
+    MuHash3072 expected;
+    expected.Insert(elements[0].data(), elements[0].size());
+    expected.Insert(elements[1].data(), elements[1].size());
+    expected.Insert(elements[3].data(), elements[3].size());
+    BOOST_CHECK(FinalizedMuHash(three) == FinalizedMuHash(expected));
+    BOOST_CHECK(FinalizedMuHash(three) != all_hash);
+
+    // Sets combine by multiplication and division.
+    MuHash3072 low, high;
+    low.Insert(elements[0].data(), elements[0].size()).Insert(elements[1].data(), elements[1].size());
+    high.Insert(elements[2].data(), elements[2].size()).Insert(elements[3].data(), elements[3].size());
+    MuHash3072 combined(low);
+    combined *= high;
+    BOOST_CHECK(FinalizedMuHash(combined) == all_hash);
+    combined /= low;
+    BOOST_CHECK(FinalizedMuHash(combined) == FinalizedMuHash(high));
+
+    // Finalizing does not change the set, and the state survives serialization.
+    forward.Remove(elements[2].data(), elements[2].size());
+    CDataStream ss(SER_DISK, 0);
+    ss << forward;
+    BOOST_CHECK_EQUAL(ss.size(), 2 * Num3072::BYTE_SIZE);
+    MuHash3072 restored;
+    ss >> restored;
+    BOOST_CHECK(FinalizedMuHash(restored) == FinalizedMuHash(expected));
+    forward.Finalize(empty_hash.begin());
+    BOOST_CHECK(FinalizedMuHash(forward) == FinalizedMuHash(expected));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -749,4 +749,78 @@ BOOST_AUTO_TEST_CASE(MempoolAncestryTests)
     BOOST_CHECK_EQUAL(descendants, 6ULL);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolSnapshotTest)
+{
+    TestMemPoolEntryHelper entry;
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(2);
+    for (int i = 0; i < 2; i++)
+    {
+        txParent.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txParent.vout[i].nValue = 33000LL;
+    }
+    CMutableTransaction txChild;
+    txChild.vin.resize(2);
+    for (int i = 0; i < 2; i++)
+    {
+        txChild.vin[i].prevout = COutPoint(txParent.GetHash(), i);
+        txChild.vin[i].scriptSig = CScript() << OP_11;
+    }
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 11000LL;
+
+    CTxMemPool pool;
+    std::shared_ptr<const CTxMemPoolSnapshot> empty = pool.GetSnapshot();
+    BOOST_CHECK(empty->vEntries.empty());
+    BOOST_CHECK(pool.GetSnapshot() == empty);
+
+    {
+        LOCK(pool.cs);
+        pool.addUnchecked(txParent.GetHash(), entry.Fee(10000LL).Time(1).FromTx(txParent));
+        pool.addUnchecked(txChild.GetHash(), entry.Fee(2000LL).Time(2).FromTx(txChild));
+    }
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot = pool.GetSnapshot();
+    BOOST_CHECK(empty->vEntries.empty());
+    BOOST_REQUIRE_EQUAL(snapshot->vEntries.size(), 2U);
+    BOOST_CHECK(snapshot->vEntries[0].txid < snapshot->vEntries[1].txid);
+    BOOST_CHECK(pool.GetSnapshot() == snapshot);
+
+    const TxMempoolEntryInfo* parent = snapshot->Find(txParent.GetHash());
+    const TxMempoolEntryInfo* child = snapshot->Find(txChild.GetHash());
+    BOOST_REQUIRE(parent && child);
+    BOOST_CHECK(!snapshot->Find(uint256S("1")));
+    BOOST_CHECK_EQUAL(parent->nFee, 10000LL);
+    BOOST_CHECK_EQUAL(parent->nTime, 1);
+    BOOST_CHECK_EQUAL(parent->nCountWithDescendants, 2U);
+    BOOST_CHECK_EQUAL(parent->nModFeesWithDescendants, 12000LL);
+    BOOST_CHECK(parent->parents.empty());
+    BOOST_REQUIRE_EQUAL(parent->children.size(), 1U);
+    BOOST_CHECK(parent->children[0] == txChild.GetHash());
+    BOOST_CHECK_EQUAL(child->nCountWithAncestors, 2U);
+    BOOST_REQUIRE_EQUAL(child->parents.size(), 1U);
+    BOOST_CHECK(child->parents[0] == txParent.GetHash());
+
+    // Changes to the mempool give a new snapshot, and leave the old one alone.
+    pool.PrioritiseTransaction(txChild.GetHash(), 1000LL);
+    std::shared_ptr<const CTxMemPoolSnapshot> prioritised = pool.GetSnapshot();
+    BOOST_CHECK(prioritised != snapshot);
+    BOOST_CHECK_EQUAL(prioritised->Find(txParent.GetHash())->nModFeesWithDescendants, 13000LL);
+    BOOST_CHECK_EQUAL(parent->nModFeesWithDescendants, 12000LL);
+
+    {
+        LOCK(pool.cs);
+        pool.removeRecursive(txParent);
+    }
+    BOOST_CHECK(pool.GetSnapshot()->vEntries.empty());
+    BOOST_CHECK_EQUAL(snapshot->vEntries.size(), 2U);
+
+    // The mempool does not hold on to snapshots nobody uses any more.
+    std::weak_ptr<const CTxMemPoolSnapshot> released = prioritised;
+    prioritised.reset();
+    BOOST_CHECK(released.expired());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
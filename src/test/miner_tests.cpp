@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <arith_uint256.h>
 #include <chainparams.h>
 #include <coins.h>
 #include <consensus/consensus.h>
@@ -11,6 +12,7 @@
 #include <validation.h>
 #include <miner.h>
 #include <policy/policy.h>
+#include <pow.h>
 #include <pubkey.h>
 #include <script/standard.h>
 #include <txmempool.h>
@@ -521,4 +523,103 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+BOOST_AUTO_TEST_CASE(ScanBlockNonces_threads)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::REGTEST);
+    const Consensus::Params& consensus = chainParams->GetConsensus();
+
+    CBlockHeader header = chainParams->GenesisBlock().GetBlockHeader();
+    header.nBits = UintToArith256(consensus.powLimit).GetCompact();
+    header.nNonce = 0;
+
+    // Whichever thread wins, the nonce it reports must carry a valid proof of work.
+    for (int nThreads : {1, 4}) {
+        CBlockHeader block = header;
+        uint64_t nMaxTries = 1000;
+        BOOST_CHECK(ScanBlockNonces(&block, consensus, nThreads, 0x10000, nMaxTries));
+        BOOST_CHECK(CheckProofOfWork(block.GetPoWHash(), block.nBits, consensus));
+        BOOST_CHECK(nMaxTries < 1000);
+    }
+
+    // An unreachable target spends exactly the tries allowed, across all threads.
+    header.nBits = UintToArith256(uint256S("0x0000000000000000000000000000000000000000000000000000000000000001")).GetCompact();
+    uint64_t nMaxTries = 100;
+    BOOST_CHECK(!ScanBlockNonces(&header, consensus, 3, 0x10000, nMaxTries));
+    BOOST_CHECK_EQUAL(nMaxTries, 0U);
+    BOOST_CHECK_EQUAL(header.nNonce, 0U);
+
+    // Otherwise the scan ends with the nonce range.
+    nMaxTries = 1000;
+    BOOST_CHECK(!ScanBlockNonces(&header, consensus, 4, 40, nMaxTries));
+    BOOST_CHECK_EQUAL(nMaxTries, 960U);
+}
+
+static CTransactionRef SpendToMemPool(const CKey& key, const CTransactionRef& prev, CAmount fee)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(prev->GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = prev->vout[0].nValue - fee;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+
+    CTransactionRef tx = MakeTransactionRef(spend);
+    CValidationState state;
+    BOOST_CHECK(AcceptToMemoryPool(mempool, state, tx, nullptr, nullptr, true, 0));
+    return tx;
+}
+
+BOOST_FIXTURE_TEST_CASE(BlockTemplateCache_follows_mempool, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    LOCK(cs_main);
+    BlockTemplateCache cache(mempool);
+    BOOST_CHECK_EQUAL(cache.Get(chainparams, true)->block.vtx.size(), 1U);
+    const CAmount subsidy = cache.Get(chainparams, true)->block.vtx[0]->GetValueOut();
+
+    // Transactions entering the mempool are added to the template, and paid to the coinbase.
+    CTransactionRef parent = SpendToMemPool(coinbaseKey, m_coinbase_txns[0], CENT);
+    CTransactionRef child = SpendToMemPool(coinbaseKey, parent, 2 * CENT);
+    std::unique_ptr<CBlockTemplate> pblocktemplate = cache.Get(chainparams, true);
+    const CBlock& block = pblocktemplate->block;
+    BOOST_REQUIRE_EQUAL(block.vtx.size(), 3U);
+    BOOST_CHECK(block.vtx[1]->GetHash() == parent->GetHash());
+    BOOST_CHECK(block.vtx[2]->GetHash() == child->GetHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -3 * CENT);
+    BOOST_CHECK_EQUAL(block.vtx[0]->GetValueOut(), subsidy + 3 * CENT);
+    CValidationState state;
+    BOOST_CHECK(TestBlockValidity(state, chainparams, block, chainActive.Tip(), false, false));
+
+    // Without them the template is assembled anew.
+    mempool.removeRecursive(*parent);
+    pblocktemplate = cache.Get(chainparams, true);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1U);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0]->GetValueOut(), subsidy);
+
+    // As it is for a new tip.
+    parent = SpendToMemPool(coinbaseKey, m_coinbase_txns[0], CENT);
+    std::vector<CMutableTransaction> noTxns;
+    CreateAndProcessBlock(noTxns, CScript() << OP_TRUE);
+    pblocktemplate = cache.Get(chainparams, true);
+    BOOST_CHECK(pblocktemplate->block.hashPrevBlock == chainActive.Tip()->GetBlockHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2U);
+
+    // A template no longer requested is dropped, and assembled anew on the next request.
+    SetMockTime(GetTime() + BlockTemplateCache::IDLE_TIMEOUT);
+    child = SpendToMemPool(coinbaseKey, parent, CENT);
+    SpendToMemPool(coinbaseKey, child, CENT);
+    pblocktemplate = cache.Get(chainparams, true);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 4U);
+    SetMockTime(0);
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,131 @@
+// Copyright (c) 2020 The Earthcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <pooledmap.h>
+
+#include <test/test_bitcoin.h>
+#include <memusage.h>
+
+#include <map>
+#include <memory>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(pooledmap_tests, BasicTestingSetup)
+
+/** A deliberately weak hash, so that probe runs collide and wrap around the table. */
+struct WeakHasher
+{
+    size_t operator()(uint32_t key) const { return key % 61; }
+};
+
+typedef pooledmap<uint32_t, std::unique_ptr<uint64_t>, WeakHasher> TestMap;
+
+static void CheckEqual(const TestMap& map, const std::map<uint32_t, uint64_t>& expected)
+{
+    BOOST_REQUIRE_EQUAL(map.size(), expected.size());
+    size_t iterated = 0;
+    for (TestMap::const_iterator it = map.begin(); it != map.end(); ++it) {
+        auto found = expected.find(it->first);
+        BOOST_REQUIRE(found != expected.end());
+        BOOST_CHECK_EQUAL(*it->second, found->second);
+        ++iterated;
+    }
+    BOOST_CHECK_EQUAL(iterated, expected.size());
+    for (const auto& entry : expected) {
+        TestMap::const_iterator it = map.find(entry.first);
+        BOOST_REQUIRE(it != map.end());
+        BOOST_CHECK_EQUAL(*it->second, entry.second);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(pooledmap_random_operations)
+{
+    TestMap map;
+    std::map<uint32_t, uint64_t> expected;
+    for (int i = 0; i < 20000; ++i) {
+        const uint32_t key = InsecureRandRange(3000);
+        switch (InsecureRandRange(4)) {
+        case 0:
+        case 1: {
+            const uint64_t value = InsecureRandBits(64);
+            auto result = map.emplace(key, std::unique_ptr<uint64_t>(new uint64_t(value)));
+            BOOST_CHECK_EQUAL(result.second, expected.emplace(key, value).second);
+            BOOST_CHECK_EQUAL(result.first->first, key);
+            break;
+        }
+        case 2:
+            BOOST_CHECK_EQUAL(map.erase(key), expected.erase(key));
+            break;
+        case 3: {
+            std::unique_ptr<uint64_t>& value = map[key];
+            if (!value) value.reset(new uint64_t(0));
+            ++*value;
+            ++expected[key];
+            break;
+        }
+        }
+        BOOST_CHECK_EQUAL(map.count(key), expected.count(key));
+        if (i % 1000 == 0) CheckEqual(map, expected);
+    }
+    CheckEqual(map, expected);
+}
+
+BOOST_AUTO_TEST_CASE(pooledmap_stability)
+{
+    TestMap map;
+    std::vector<uint64_t*> values;
+    for (uint32_t key = 0; key < 1000; ++key) {
+        values.push_back(map.emplace(key, std::unique_ptr<uint64_t>(new uint64_t(key))).first->second.get());
+    }
+    // Growing the index and reusing erased nodes leaves the other entries in place.
+    for (uint32_t key = 0; key < 1000; key += 2) {
+        map.erase(key);
+    }
+    for (uint32_t key = 1000; key < 5000; ++key) {
+        map.emplace(key, std::unique_ptr<uint64_t>(new uint64_t(key)));
+    }
+    for (uint32_t key = 1; key < 1000; key += 2) {
+        TestMap::iterator it = map.find(key);
+        BOOST_REQUIRE(it != map.end());
+        BOOST_CHECK(it->second.get() == values[key]);
+        BOOST_CHECK(&*it == &*map.find(key));
+    }
+
+    // Erasing while iterating visits every entry exactly once, like a flush does.
+    size_t memory = memusage::DynamicUsage(map);
+    BOOST_CHECK(memory > 0);
+    size_t erased = 0;
+    for (TestMap::iterator it = map.begin(); it != map.end();) {
+        TestMap::iterator old = it++;
+        map.erase(old);
+        ++erased;
+    }
+    BOOST_CHECK_EQUAL(erased, 4500U);
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.begin() == map.end());
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), memory);
+
+    map.clear();
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), 0U);
+    map[7].reset(new uint64_t(7));
+    BOOST_CHECK_EQUAL(*map.find(7)->second, 7U);
+}
+
+BOOST_AUTO_TEST_CASE(pooledmap_swap)
+{
+    TestMap a, b;
+    std::map<uint32_t, uint64_t> expected_a, expected_b;
+    for (uint32_t key = 0; key < 300; ++key) {
+        a.emplace(key, std::unique_ptr<uint64_t>(new uint64_t(key)));
+        expected_b.emplace(key, key);
+    }
+    b.emplace(1000, std::unique_ptr<uint64_t>(new uint64_t(1)));
+    expected_a.emplace(1000, 1);
+    a.swap(b);
+    CheckEqual(a, expected_a);
+    CheckEqual(b, expected_b);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
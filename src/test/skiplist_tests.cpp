@@ -43,6 +43,36 @@ BOOST_AUTO_TEST_CASE(skiplist_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(block_index_arena_test)
+{
+    // Long enough to span several chunks of the arena.
+    CBlockIndexArena arena;
+    CBlockHeader header;
+    header.nTime = 1234;
+    std::vector<CBlockIndex*> vIndex;
+    for (int i = 0; i < 40000; i++) {
+        CBlockIndex* pindex = i % 2 ? arena.Create() : arena.Create(header);
+        BOOST_CHECK(pindex->pskip == nullptr && pindex->nChainWork == 0);
+        BOOST_CHECK_EQUAL(pindex->nTime, i % 2 ? 0U : 1234U);
+        pindex->nHeight = i;
+        pindex->pprev = i ? vIndex.back() : nullptr;
+        pindex->BuildSkip();
+        vIndex.push_back(pindex);
+    }
+
+    // Entries created in a row sit next to each other, and never move.
+    BOOST_CHECK(vIndex[1] == vIndex[0] + 1);
+    for (int i = 0; i < 1000; i++) {
+        int from = InsecureRandRange(vIndex.size());
+        int to = InsecureRandRange(from + 1);
+        BOOST_CHECK(vIndex[from]->GetAncestor(to) == vIndex[to]);
+        BOOST_CHECK_EQUAL(vIndex[from]->nHeight, from);
+    }
+
+    arena.Clear();
+    BOOST_CHECK(arena.Create()->pprev == nullptr);
+}
+
 BOOST_AUTO_TEST_CASE(getlocator_test)
 {
     // Build a main chain 100000 blocks long.
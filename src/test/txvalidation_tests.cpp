@@ -7,6 +7,7 @@
 #include <amount.h>
 #include <consensus/validation.h>
 #include <primitives/transaction.h>
+#include <script/interpreter.h>
 #include <script/script.h>
 #include <test/test_bitcoin.h>
 
@@ -58,4 +59,91 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_reject_coinbase, TestChain100Setup)
     BOOST_CHECK_EQUAL(nDoS, 100);
 }
 
+static CTransactionRef SpendToMemPool(const CKey& key, const CTransactionRef& prev, uint32_t n, size_t outputs)
+{
+    CMutableTransaction tx;
+    tx.nVersion = 1;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(prev->GetHash(), n);
+    tx.vout.resize(outputs);
+    for (CTxOut& out : tx.vout) {
+        out.nValue = prev->vout[n].nValue / 4;
+        out.scriptPubKey = prev->vout[n].scriptPubKey;
+    }
+
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(prev->vout[n].scriptPubKey, tx, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig << vchSig;
+
+    CTransactionRef ref = MakeTransactionRef(tx);
+    LOCK(cs_main);
+    CValidationState state;
+    BOOST_CHECK(AcceptToMemoryPool(mempool, state, ref, nullptr, nullptr, true, 0));
+    return ref;
+}
+
+/**
+ * Ensure that a dumped mempool loads again, children after their parents,
+ * with the fee deltas it had.
+ */
+BOOST_FIXTURE_TEST_CASE(tx_mempool_dump_load, TestChain100Setup)
+{
+    // A chain of three transactions, and another child of the first, which
+    // is loaded in one batch with the second.
+    std::vector<CTransactionRef> txs;
+    txs.push_back(SpendToMemPool(coinbaseKey, m_coinbase_txns[0], 0, 2));
+    txs.push_back(SpendToMemPool(coinbaseKey, txs[0], 0, 1));
+    txs.push_back(SpendToMemPool(coinbaseKey, txs[1], 0, 1));
+    txs.push_back(SpendToMemPool(coinbaseKey, txs[0], 1, 1));
+    mempool.PrioritiseTransaction(txs[2]->GetHash(), 1000);
+    mempool.PrioritiseTransaction(uint256S("1"), 2000);
+    BOOST_CHECK_EQUAL(mempool.size(), 4U);
+
+    BOOST_CHECK(DumpMempool());
+    mempool.clear();
+    mempool.ClearPrioritisation(txs[2]->GetHash());
+    mempool.ClearPrioritisation(uint256S("1"));
+    BOOST_CHECK(LoadMempool());
+
+    BOOST_CHECK_EQUAL(mempool.size(), 4U);
+    for (const CTransactionRef& tx : txs) {
+        BOOST_CHECK(mempool.exists(tx->GetHash()));
+    }
+    LOCK(mempool.cs);
+    BOOST_CHECK_EQUAL(mempool.mapTx.find(txs[2]->GetHash())->GetModifiedFee(), mempool.mapTx.find(txs[2]->GetHash())->GetFee() + 1000);
+    BOOST_CHECK_EQUAL(mempool.mapDeltas.count(uint256S("1")), 1U);
+}
+
+/**
+ * Ensure that a mempool.dat of the unbatched format, as earlier versions wrote
+ * it, still loads, children after their parents.
+ */
+BOOST_FIXTURE_TEST_CASE(tx_mempool_load_unbatched, TestChain100Setup)
+{
+    std::vector<CTransactionRef> txs;
+    txs.push_back(SpendToMemPool(coinbaseKey, m_coinbase_txns[0], 0, 2));
+    txs.push_back(SpendToMemPool(coinbaseKey, txs[0], 0, 1));
+    txs.push_back(SpendToMemPool(coinbaseKey, txs[0], 1, 1));
+    txs.push_back(SpendToMemPool(coinbaseKey, txs[1], 0, 1));
+    mempool.clear();
+
+    {
+        CAutoFile file(fsbridge::fopen(GetDataDir() / "mempool.dat", "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(!file.IsNull());
+        file << (uint64_t)1 << (uint64_t)txs.size();
+        for (const CTransactionRef& tx : txs) {
+            file << *tx << (int64_t)GetTime() << (int64_t)0;
+        }
+        file << std::map<uint256, CAmount>();
+    }
+    BOOST_CHECK(LoadMempool());
+
+    BOOST_CHECK_EQUAL(mempool.size(), txs.size());
+    for (const CTransactionRef& tx : txs) {
+        BOOST_CHECK(mempool.exists(tx->GetHash()));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
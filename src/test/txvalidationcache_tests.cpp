@@ -91,6 +91,55 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0U);
 }
 
+BOOST_FIXTURE_TEST_CASE(tx_prevalidation, TestChain100Setup)
+{
+    // Pre-validating transactions leaves their acceptance, and the coins
+    // cache, as they would be without it.
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    std::vector<CMutableTransaction> spends(3);
+    for (int i = 0; i < 3; i++)
+    {
+        spends[i].nVersion = 1;
+        spends[i].vin.resize(1);
+        // The last one spends the first.
+        spends[i].vin[0].prevout = i < 2 ? COutPoint(m_coinbase_txns[i]->GetHash(), 0) : COutPoint(spends[0].GetHash(), 0);
+        spends[i].vout.resize(1);
+        spends[i].vout[0].nValue = (11 - i) * CENT;
+        spends[i].vout[0].scriptPubKey = scriptPubKey;
+
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, spends[i], 0, SIGHASH_ALL, 0, SigVersion::BASE);
+        // Sign the second one for something else.
+        if (i == 1) hash = uint256S("1");
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        spends[i].vin[0].scriptSig << vchSig;
+    }
+
+    std::vector<CTransactionRef> txs;
+    for (const CMutableTransaction& spend : spends) {
+        txs.push_back(MakeTransactionRef(spend));
+    }
+    size_t cache_size;
+    {
+        LOCK(cs_main);
+        pcoinsTip->Uncache(txs[0]->vin[0].prevout);
+        cache_size = pcoinsTip->GetCacheSize();
+    }
+    PreValidateTransactions(mempool, txs);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK_EQUAL(pcoinsTip->GetCacheSize(), cache_size);
+    }
+
+    BOOST_CHECK(ToMemPool(spends[0]));
+    BOOST_CHECK(!ToMemPool(spends[1]));
+    BOOST_CHECK(ToMemPool(spends[2]));
+    BOOST_CHECK_EQUAL(mempool.size(), 2U);
+    mempool.clear();
+}
+
 // Run CheckInputs (using pcoinsTip) on the given transaction, for all script
 // flags.  Test that CheckInputs passes for all flags that don't overlap with
 // the failing_flags argument, but otherwise fails.
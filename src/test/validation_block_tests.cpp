@@ -7,10 +7,13 @@
 #include <chainparams.h>
 #include <consensus/merkle.h>
 #include <consensus/validation.h>
+#include <fs.h>
 #include <miner.h>
 #include <pow.h>
 #include <random.h>
+#include <streams.h>
 #include <test/test_bitcoin.h>
+#include <txdb.h>
 #include <validation.h>
 #include <validationinterface.h>
 
@@ -181,4 +184,132 @@ BOOST_AUTO_TEST_CASE(processnewblock_signals_ordering)
     BOOST_CHECK_EQUAL(sub.m_expected_tip, chainActive.Tip()->GetBlockHash());
 }
 
+BOOST_AUTO_TEST_CASE(processnewblockheaders_pow_batch)
+{
+    // A chain of headers, checked for proof of work ahead of cs_main in groups
+    std::vector<CBlockHeader> headers;
+    uint256 prev = Params().GenesisBlock().GetHash();
+    for (int i = 0; i < 40; i++) {
+        headers.push_back(FinalizeBlock(Block(prev))->GetBlockHeader());
+        prev = headers.back().GetHash();
+    }
+
+    // Break the proof of work of one header in the middle of a group
+    std::vector<CBlockHeader> bad_headers(headers.begin(), headers.begin() + 30);
+    CBlockHeader bad = headers[30];
+    while (CheckProofOfWork(bad.GetPoWHash(), bad.nBits, Params().GetConsensus())) {
+        ++bad.nNonce;
+    }
+    bad_headers.push_back(bad);
+
+    CValidationState state;
+    const CBlockIndex* pindex = nullptr;
+    CBlockHeader first_invalid;
+    BOOST_CHECK(!ProcessNewBlockHeaders(bad_headers, state, Params(), &pindex, &first_invalid));
+    BOOST_CHECK_EQUAL(first_invalid.GetHash(), bad.GetHash());
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "high-hash");
+    BOOST_CHECK(pindex != nullptr && pindex->GetBlockHash() == headers[29].GetHash());
+
+    // The valid chain is accepted, including the headers already known from above
+    CValidationState state2;
+    BOOST_CHECK(ProcessNewBlockHeaders(headers, state2, Params(), &pindex));
+    BOOST_CHECK(pindex != nullptr && pindex->GetBlockHash() == headers.back().GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(loadexternalblockfile_out_of_order)
+{
+    // The block template is for the height after the current tip, so the
+    // coinbases pay nothing to stay within the subsidy at any height.
+    auto unfinished_block = [](const uint256& prev_hash) {
+        auto pblock = Block(prev_hash);
+        CMutableTransaction txCoinbase(*pblock->vtx[0]);
+        txCoinbase.vout[0].nValue = 0;
+        pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
+        return pblock;
+    };
+    std::vector<std::shared_ptr<const CBlock>> chain;
+    uint256 prev = Params().GenesisBlock().GetHash();
+    for (int i = 0; i < 6; i++) {
+        chain.push_back(FinalizeBlock(unfinished_block(prev)));
+        prev = chain.back()->GetHash();
+    }
+
+    // A child of the fourth block whose proof of work does not meet its target
+    auto bad = unfinished_block(chain[3]->GetHash());
+    bad->hashMerkleRoot = BlockMerkleRoot(*bad);
+    while (CheckProofOfWork(bad->GetPoWHash(), bad->nBits, Params().GetConsensus())) {
+        ++bad->nNonce;
+    }
+
+    // Write a bootstrap file with blocks ahead of their parents, and the bad
+    // block ahead of its parent so that it is only accepted once that is.
+    const std::vector<std::shared_ptr<const CBlock>> file_order{chain[0], chain[2], chain[1], chain[4], bad, chain[3], chain[5]};
+    const fs::path path = GetDataDir() / "bootstrap.dat";
+    {
+        CAutoFile file(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+        for (const auto& block : file_order) {
+            file << Params().MessageStart() << (unsigned int)::GetSerializeSize(*block, SER_DISK, CLIENT_VERSION) << *block;
+        }
+    }
+    FILE* file = fsbridge::fopen(path, "rb");
+    BOOST_REQUIRE(file != nullptr);
+    BOOST_CHECK(LoadExternalBlockFile(Params(), file));
+
+    CValidationState state;
+    BOOST_CHECK(ActivateBestChain(state, Params()));
+    LOCK(cs_main);
+    BOOST_CHECK_EQUAL(chainActive.Height(), 6);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == chain.back()->GetHash());
+    for (const auto& block : chain) {
+        const CBlockIndex* pindex = LookupBlockIndex(block->GetHash());
+        BOOST_CHECK(pindex && chainActive.Contains(pindex) && (pindex->nStatus & BLOCK_HAVE_DATA));
+    }
+    // The block with bad proof of work never makes it into the block index
+    BOOST_CHECK(LookupBlockIndex(bad->GetHash()) == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(chainstate_background_flush)
+{
+    // Reorg away from blocks whose coins are still being written in the background
+    BOOST_CHECK(pcoinsdbview->FlushesInBackground());
+    bool ignored;
+    std::vector<std::shared_ptr<const CBlock>> chain_a;
+    uint256 prev = Params().GenesisBlock().GetHash();
+    for (int i = 0; i < 10; i++) {
+        chain_a.push_back(GoodBlock(prev));
+        prev = chain_a.back()->GetHash();
+        BOOST_CHECK(ProcessNewBlock(Params(), chain_a.back(), true, &ignored));
+    }
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(pcoinsTip->Flush());
+        BOOST_CHECK(pcoinsdbview->GetBestBlock() == chain_a.back()->GetHash());
+    }
+
+    std::vector<std::shared_ptr<const CBlock>> chain_b;
+    prev = chain_a[4]->GetHash();
+    for (int i = 0; i < 8; i++) {
+        chain_b.push_back(GoodBlock(prev));
+        prev = chain_b.back()->GetHash();
+        BOOST_CHECK(ProcessNewBlock(Params(), chain_b.back(), true, &ignored));
+    }
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == chain_b.back()->GetHash());
+        BOOST_CHECK(pcoinsTip->Flush());
+    }
+    FlushStateToDisk();
+
+    LOCK(cs_main);
+    BOOST_CHECK_EQUAL(pcoinsdbview->DynamicMemoryUsage(), 0U);
+    BOOST_CHECK(pcoinsdbview->GetBestBlock() == chain_b.back()->GetHash());
+    BOOST_CHECK(pcoinsdbview->GetHeadBlocks().empty());
+    for (size_t i = 0; i < chain_a.size(); i++) {
+        BOOST_CHECK_EQUAL(pcoinsdbview->HaveCoin(COutPoint(chain_a[i]->vtx[0]->GetHash(), 0)), i < 5);
+    }
+    for (const auto& block : chain_b) {
+        BOOST_CHECK(pcoinsdbview->HaveCoin(COutPoint(block->vtx[0]->GetHash(), 0)));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -5,6 +5,7 @@
 
 #include <txdb.h>
 
+#include <blockfilemap.h>
 #include <chainparams.h>
 #include <hash.h>
 #include <random.h>
@@ -13,9 +14,12 @@
 #include <uint256.h>
 #include <util.h>
 #include <ui_interface.h>
+#include <warnings.h>
 
 #include <stdint.h>
 
+#include <functional>
+
 #include <boost/thread.hpp>
 
 static const char DB_COIN = 'C';
@@ -28,6 +32,14 @@ static const char DB_HEAD_BLOCKS = 'H';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_BLOCK_INDEX_SNAPSHOT = 'S';
+static const char DB_SNAPSHOT_BASE = 'U';
+static const char DB_BLOCK_INDEX_GENERATION = 'G';
+
+static const char BLOCK_INDEX_SNAPSHOT_MAGIC[4] = {'e', 'b', 'i', 's'};
+static const uint32_t BLOCK_INDEX_SNAPSHOT_VERSION = 3;
+/** Size of each snapshot entry: the block hash, the previous block hash, the merkle root and ten 32-bit fields. */
+static const size_t BLOCK_INDEX_SNAPSHOT_ENTRY_SIZE = 3 * 32 + 10 * 4;
 
 namespace {
 
@@ -53,19 +65,62 @@ struct CoinEntry {
 
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true)
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe, bool fBackgroundFlush) : CCoinsViewDB(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, fBackgroundFlush)
+{
+}
+
+CCoinsViewDB::CCoinsViewDB(const fs::path& ldb_path, size_t nCacheSize, bool fMemory, bool fWipe, bool fBackgroundFlush) : db(ldb_path, nCacheSize, fMemory, fWipe, true), m_background_flush(fBackgroundFlush)
 {
+    if (m_background_flush) {
+        m_flush_thread = std::thread(&TraceThread<std::function<void()>>, "coinsflush",
+            std::function<void()>(std::bind(&CCoinsViewDB::ThreadFlush, this)));
+    }
+}
+
+CCoinsViewDB::~CCoinsViewDB()
+{
+    if (m_flush_thread.joinable()) {
+        {
+            WaitableLock lock(m_flush_mutex);
+            m_flush_stop = true;
+        }
+        m_flush_cv.notify_all();
+        m_flush_thread.join();
+    }
 }
 
 bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    {
+        // Coins not among the entries being written are the same before and
+        // after the write, so for those the database can be read mid-write.
+        WaitableLock lock(m_flush_mutex);
+        CCoinsMap::const_iterator it = m_flushing.find(outpoint);
+        if (it != m_flushing.end()) {
+            coin = it->second.coin;
+            return !coin.IsSpent();
+        }
+    }
     return db.Read(CoinEntry(&outpoint), coin);
 }
 
 bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    {
+        WaitableLock lock(m_flush_mutex);
+        CCoinsMap::const_iterator it = m_flushing.find(outpoint);
+        if (it != m_flushing.end()) {
+            return !it->second.coin.IsSpent();
+        }
+    }
     return db.Exists(CoinEntry(&outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
+    {
+        WaitableLock lock(m_flush_mutex);
+        if (!m_flushing_block.IsNull()) {
+            return m_flushing_block;
+        }
+    }
     uint256 hashBestChain;
     if (!db.Read(DB_BEST_BLOCK, hashBestChain))
         return uint256();
@@ -73,6 +128,7 @@ uint256 CCoinsViewDB::GetBestBlock() const {
 }
 
 std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
+    WaitForFlush();
     std::vector<uint256> vhashHeadBlocks;
     if (!db.Read(DB_HEAD_BLOCKS, vhashHeadBlocks)) {
         return std::vector<uint256>();
@@ -81,12 +137,10 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
-    CDBBatch batch(db);
-    size_t count = 0;
-    size_t changed = 0;
-    size_t batch_size = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
-    int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
     assert(!hashBlock.IsNull());
+    if (!Sync()) {
+        return false;
+    }
 
     uint256 old_tip = GetBestBlock();
     if (old_tip.IsNull()) {
@@ -98,6 +152,105 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
         }
     }
 
+    if (!m_background_flush) {
+        return WriteCoinsMap(mapCoins, hashBlock, old_tip, true);
+    }
+
+    size_t usage = memusage::DynamicUsage(mapCoins);
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it) {
+        usage += it->second.coin.DynamicMemoryUsage();
+    }
+    {
+        WaitableLock lock(m_flush_mutex);
+        m_flushing.swap(mapCoins);
+        m_flushing_block = hashBlock;
+        m_flushing_old_tip = old_tip;
+        m_flushing_usage = usage;
+        m_flush_pending = true;
+    }
+    m_flush_cv.notify_all();
+    return true;
+}
+
+/** Shut down after a background write failed, as the synchronous write path does through AbortNode. */
+static void AbortFlush()
+{
+    const std::string strMessage = "Failed to write to coin database";
+    SetMiscWarning(strMessage);
+    LogPrintf("*** %s\n", strMessage);
+    uiInterface.ThreadSafeMessageBox(_("Error: A fatal internal error occurred, see debug.log for details"), "", CClientUIInterface::MSG_ERROR);
+    StartShutdown();
+}
+
+void CCoinsViewDB::ThreadFlush()
+{
+    while (true) {
+        uint256 hashBlock, old_tip;
+        {
+            WaitableLock lock(m_flush_mutex);
+            m_flush_cv.wait(lock, [this] { return m_flush_pending || m_flush_stop; });
+            if (!m_flush_pending) {
+                return;
+            }
+            hashBlock = m_flushing_block;
+            old_tip = m_flushing_old_tip;
+        }
+
+        bool ret = false;
+        try {
+            // The entries are not erased as they are written, lookups may still need them.
+            ret = WriteCoinsMap(m_flushing, hashBlock, old_tip, false);
+        } catch (const std::runtime_error& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+        }
+
+        {
+            WaitableLock lock(m_flush_mutex);
+            if (ret) {
+                m_flushing.clear();
+                m_flushing_block.SetNull();
+                m_flushing_usage = 0;
+            } else {
+                // Keep serving lookups from the entries: the database is
+                // missing them, and no later write is accepted.
+                m_flush_failed = true;
+            }
+            m_flush_pending = false;
+        }
+        m_flush_cv.notify_all();
+        if (!ret) {
+            AbortFlush();
+        }
+    }
+}
+
+void CCoinsViewDB::WaitForFlush() const
+{
+    WaitableLock lock(m_flush_mutex);
+    m_flush_cv.wait(lock, [this] { return !m_flush_pending; });
+}
+
+bool CCoinsViewDB::Sync()
+{
+    WaitForFlush();
+    WaitableLock lock(m_flush_mutex);
+    return !m_flush_failed;
+}
+
+size_t CCoinsViewDB::DynamicMemoryUsage() const
+{
+    WaitableLock lock(m_flush_mutex);
+    return m_flushing_usage;
+}
+
+bool CCoinsViewDB::WriteCoinsMap(CCoinsMap& mapCoins, const uint256& hashBlock, const uint256& old_tip, bool fErase)
+{
+    CDBBatch batch(db);
+    size_t count = 0;
+    size_t changed = 0;
+    size_t batch_size = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
+    int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
+
     // In the first batch, mark the database as being in the middle of a
     // transition from old_tip to hashBlock.
     // A vector is used for future extensibility, as we may want to support
@@ -116,7 +269,9 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
         }
         count++;
         CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (fErase) {
+            mapCoins.erase(itOld);
+        }
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
@@ -141,6 +296,19 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     return ret;
 }
 
+bool CCoinsViewDB::WriteCoins(const std::vector<std::pair<COutPoint, Coin>>& coins)
+{
+    if (!Sync()) {
+        return false;
+    }
+    CDBBatch batch(db);
+    for (const std::pair<COutPoint, Coin>& entry : coins) {
+        batch.Write(CoinEntry(&entry.first), entry.second);
+    }
+    LogPrint(BCLog::COINDB, "Writing snapshot batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
+    return db.WriteBatch(batch);
+}
+
 size_t CCoinsViewDB::EstimateSize() const
 {
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
@@ -170,6 +338,7 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
 
 CCoinsViewCursor *CCoinsViewDB::Cursor() const
 {
+    WaitForFlush();
     CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper&>(db).NewIterator(), GetBestBlock());
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
@@ -231,6 +400,10 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
         batch.Write(std::make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
     }
+    // Lets a block index snapshot tell cheaply whether it is still current.
+    uint64_t nGeneration = 0;
+    Read(DB_BLOCK_INDEX_GENERATION, nGeneration);
+    batch.Write(DB_BLOCK_INDEX_GENERATION, nGeneration + 1);
     return WriteBatch(batch, true);
 }
 
@@ -246,8 +419,169 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
+bool CBlockTreeDB::WriteSnapshotBase(const uint256& hash) {
+    return Write(DB_SNAPSHOT_BASE, hash, true);
+}
+
+bool CBlockTreeDB::ReadSnapshotBase(uint256& hash) {
+    return Read(DB_SNAPSHOT_BASE, hash);
+}
+
+bool CBlockTreeDB::EraseSnapshotBase() {
+    return Erase(DB_SNAPSHOT_BASE, true);
+}
+
+static fs::path BlockIndexSnapshotPath()
+{
+    return GetBlocksDir() / "index.snapshot";
+}
+
+/**
+ * What a block index snapshot records of the database it was taken from: the
+ * generation WriteBatchSync bumps with every write of the block index, and
+ * the last block file with its info. Both are read with a few lookups, however
+ * large the index. A binary that does not know about snapshots leaves the
+ * generation alone, but changes the block file info as soon as it stores a
+ * block; the headers it adds without one are only missing from the index
+ * loaded from the snapshot, and are downloaded again.
+ */
+struct BlockIndexDBState
+{
+    uint64_t nGeneration = 0;
+    int nLastFile = 0;
+    CBlockFileInfo lastFileInfo;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nGeneration);
+        READWRITE(nLastFile);
+        READWRITE(lastFileInfo);
+    }
+
+    bool operator==(const BlockIndexDBState& other) const {
+        return nGeneration == other.nGeneration && nLastFile == other.nLastFile &&
+            lastFileInfo.nBlocks == other.lastFileInfo.nBlocks && lastFileInfo.nSize == other.lastFileInfo.nSize &&
+            lastFileInfo.nUndoSize == other.lastFileInfo.nUndoSize && lastFileInfo.nHeightFirst == other.lastFileInfo.nHeightFirst &&
+            lastFileInfo.nHeightLast == other.lastFileInfo.nHeightLast && lastFileInfo.nTimeFirst == other.lastFileInfo.nTimeFirst &&
+            lastFileInfo.nTimeLast == other.lastFileInfo.nTimeLast;
+    }
+};
+
+static BlockIndexDBState ReadBlockIndexDBState(CBlockTreeDB& db)
+{
+    BlockIndexDBState state;
+    db.Read(DB_BLOCK_INDEX_GENERATION, state.nGeneration);
+    if (db.ReadLastBlockFile(state.nLastFile)) {
+        db.ReadBlockFileInfo(state.nLastFile, state.lastFileInfo);
+    }
+    return state;
+}
+
+bool CBlockTreeDB::WriteBlockIndexSnapshot(const std::vector<const CBlockIndex*>& entries)
+{
+    // Whatever happens below, no older snapshot may be taken for this one.
+    if (!Erase(DB_BLOCK_INDEX_SNAPSHOT, true))
+        return error("%s: failed to erase the snapshot id", __func__);
+
+    const fs::path path = BlockIndexSnapshotPath();
+    const fs::path pathTmp = path.string() + ".new";
+    const uint256 id = GetRandHash();
+    const BlockIndexDBState dbState = ReadBlockIndexDBState(*this);
+    const uint64_t nEntries = entries.size();
+    {
+        CAutoFile file(fsbridge::fopen(pathTmp, "wb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull())
+            return error("%s: failed to open %s", __func__, pathTmp.string());
+        try {
+            file.write(BLOCK_INDEX_SNAPSHOT_MAGIC, sizeof(BLOCK_INDEX_SNAPSHOT_MAGIC));
+            file << BLOCK_INDEX_SNAPSHOT_VERSION << id << dbState << nEntries;
+            for (const CBlockIndex* pindex : entries) {
+                // As in CDiskBlockIndex, positions are only kept while the data is.
+                const bool fHaveData = pindex->nStatus & BLOCK_HAVE_DATA;
+                const bool fHaveUndo = pindex->nStatus & BLOCK_HAVE_UNDO;
+                file << pindex->GetBlockHash() << (pindex->pprev ? pindex->pprev->GetBlockHash() : uint256()) << pindex->hashMerkleRoot;
+                file << pindex->nHeight << ((fHaveData || fHaveUndo) ? pindex->nFile : 0) << (fHaveData ? pindex->nDataPos : 0U) << (fHaveUndo ? pindex->nUndoPos : 0U);
+                file << pindex->nVersion << pindex->nTime << pindex->nBits << pindex->nNonce << pindex->nStatus << pindex->nTx;
+            }
+        } catch (const std::exception& e) {
+            return error("%s: failed to write %s: %s", __func__, pathTmp.string(), e.what());
+        }
+        if (!FileCommit(file.Get()))
+            return error("%s: failed to commit %s", __func__, pathTmp.string());
+    }
+    if (!RenameOver(pathTmp, path))
+        return error("%s: failed to rename %s", __func__, pathTmp.string());
+
+    return Write(DB_BLOCK_INDEX_SNAPSHOT, id, true);
+}
+
+bool CBlockTreeDB::LoadBlockIndexSnapshot(std::function<CBlockIndex*(const uint256&)> insertBlockIndex)
+{
+    uint256 id;
+    if (!Read(DB_BLOCK_INDEX_SNAPSHOT, id))
+        return false;
+    // The snapshot only matches the database until the block index is next
+    // written, so it is used at most once.
+    if (!Erase(DB_BLOCK_INDEX_SNAPSHOT, true))
+        return false;
+
+    const fs::path path = BlockIndexSnapshotPath();
+    bool fLoaded = false;
+    std::shared_ptr<const BlockFileMapping> mapping = BlockFileMapping::Map(path);
+    if (!mapping) {
+        LogPrintf("Cannot map the block index snapshot %s\n", path.string());
+    } else {
+        mapping->WillNeed(0, mapping->Data().size());
+        try {
+            SpanReader reader(SER_DISK, CLIENT_VERSION, mapping->Data());
+            char magic[sizeof(BLOCK_INDEX_SNAPSHOT_MAGIC)];
+            uint32_t nVersion;
+            uint256 fileId;
+            BlockIndexDBState fileState;
+            uint64_t nEntries = 0;
+            reader.read(magic, sizeof(magic));
+            reader >> nVersion;
+            if (nVersion == BLOCK_INDEX_SNAPSHOT_VERSION)
+                reader >> fileId >> fileState >> nEntries;
+            // The id is only cleared by binaries that know about snapshots, so
+            // also check that nothing else wrote to the database since.
+            if (memcmp(magic, BLOCK_INDEX_SNAPSHOT_MAGIC, sizeof(magic)) != 0 || nVersion != BLOCK_INDEX_SNAPSHOT_VERSION ||
+                fileId != id || reader.size() / BLOCK_INDEX_SNAPSHOT_ENTRY_SIZE != nEntries || reader.size() % BLOCK_INDEX_SNAPSHOT_ENTRY_SIZE != 0 ||
+                !(fileState == ReadBlockIndexDBState(*this))) {
+                LogPrintf("The block index snapshot %s does not match the block index database\n", path.string());
+            } else {
+                for (uint64_t i = 0; i < nEntries; i++) {
+                    if (i % 100000 == 0)
+                        boost::this_thread::interruption_point();
+                    uint256 hash, hashPrev;
+                    reader >> hash >> hashPrev;
+                    CBlockIndex* pindexNew = insertBlockIndex(hash);
+                    pindexNew->pprev = insertBlockIndex(hashPrev);
+                    reader >> pindexNew->hashMerkleRoot;
+                    reader >> pindexNew->nHeight >> pindexNew->nFile >> pindexNew->nDataPos >> pindexNew->nUndoPos;
+                    reader >> pindexNew->nVersion >> pindexNew->nTime >> pindexNew->nBits >> pindexNew->nNonce >> pindexNew->nStatus >> pindexNew->nTx;
+                }
+                fLoaded = true;
+            }
+        } catch (const std::ios_base::failure& e) {
+            LogPrintf("Failed to read the block index snapshot %s: %s\n", path.string(), e.what());
+        }
+        mapping.reset();
+    }
+
+    fs::remove(path);
+    if (fLoaded)
+        LogPrintf("Loaded the block index from its snapshot\n");
+    return fLoaded;
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex)
 {
+    if (LoadBlockIndexSnapshot(insertBlockIndex))
+        return true;
+
     std::unique_ptr<CDBIterator> pcursor(NewIterator());
 
     pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, uint256()));
@@ -280,6 +614,7 @@ bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams,
                 // While it is technically feasible to verify the PoW, doing so takes several minutes as it
                 // requires recomputing every PoW hash during every Earthcoin startup.
                 // We opt instead to simply trust the data that is on your local disk.
+                // Use -checkblockindexpow to verify it on all cores in the background after startup.
                 //if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, consensusParams))
                 //    return error("%s: CheckProofOfWork failed: %s", __func__, pindexNew->ToString());
 
@@ -10,10 +10,12 @@
 #include <dbwrapper.h>
 #include <chain.h>
 #include <primitives/block.h>
+#include <sync.h>
 
 #include <map>
 #include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -27,6 +29,8 @@ static constexpr int MAX_BLOCK_COINSDB_USAGE = 10;
 static const int64_t nDefaultDbCache = 450;
 //! -dbbatchsize default (bytes)
 static const int64_t nDefaultDbBatchSize = 16 << 20;
+//! -dbbackgroundflush default
+static const bool DEFAULT_DB_BACKGROUND_FLUSH = true;
 //! max. -dbcache (MiB)
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache (MiB)
@@ -37,16 +41,53 @@ static const int64_t nMaxBlockDBCache = 2;
 // Unlike for the UTXO database, for the txindex scenario the leveldb cache make
 // a meaningful difference: https://github.com/bitcoin/bitcoin/pull/8273#issuecomment-229601991
 static const int64_t nMaxTxIndexCache = 1024;
+//! Max memory allocated to the coinstats index DB specific cache (MiB)
+static const int64_t nMaxCoinStatsIndexCache = 8;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
 
-/** CCoinsView backed by the coin database (chainstate/) */
+/** CCoinsView backed by the coin database (chainstate/)
+ *
+ * With fBackgroundFlush, BatchWrite takes over the entries it is given and
+ * returns right away, leaving them to be written by a background thread. Until
+ * that write has completed, lookups are answered from those entries first, so
+ * the view stays consistent with the best block it was last given. Only one
+ * write is in flight at a time: the next BatchWrite waits for the previous one.
+ * A crash during the write is recovered from like one during a synchronous
+ * write, by replaying the blocks between the head blocks marked in the database.
+ */
 class CCoinsViewDB final : public CCoinsView
 {
 protected:
     CDBWrapper db;
+
+private:
+    const bool m_background_flush;
+    //! Guards the state of the write in flight.
+    mutable CWaitableCriticalSection m_flush_mutex;
+    //! Signalled when a write is handed to the writer thread, when it completes, and at shutdown.
+    mutable CConditionVariable m_flush_cv;
+    //! Entries being written, and the best block they bring the database to (null if none).
+    //! If the write fails they are kept, as the database does not have them.
+    CCoinsMap m_flushing;
+    uint256 m_flushing_block;
+    uint256 m_flushing_old_tip;
+    size_t m_flushing_usage = 0;
+    bool m_flush_pending = false;
+    bool m_flush_failed = false;
+    bool m_flush_stop = false;
+    //! Writer thread, running for the lifetime of the view if it flushes in the background.
+    std::thread m_flush_thread;
+
+    bool WriteCoinsMap(CCoinsMap& mapCoins, const uint256& hashBlock, const uint256& old_tip, bool fErase);
+    void ThreadFlush();
+    void WaitForFlush() const;
+
 public:
-    explicit CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    explicit CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool fBackgroundFlush = false);
+    //! Open a coins database in a directory other than the chainstate's.
+    CCoinsViewDB(const fs::path& ldb_path, size_t nCacheSize, bool fMemory, bool fWipe, bool fBackgroundFlush);
+    ~CCoinsViewDB();
 
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
@@ -57,7 +98,14 @@ public:
 
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
+    //! Write coins without touching the best block marker, for bulk loading a UTXO snapshot.
+    bool WriteCoins(const std::vector<std::pair<COutPoint, Coin>>& coins);
     size_t EstimateSize() const override;
+    bool FlushesInBackground() const { return m_background_flush; }
+    //! Wait for a background write to complete. Returns false if a background write has failed.
+    bool Sync();
+    //! Memory held by the entries of the background write in flight.
+    size_t DynamicMemoryUsage() const;
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -95,7 +143,26 @@ public:
     void ReadReindexing(bool &fReindexing);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    //! The base block of a loaded UTXO snapshot whose history is still being validated.
+    bool WriteSnapshotBase(const uint256& hash);
+    bool ReadSnapshotBase(uint256& hash);
+    bool EraseSnapshotBase();
+    /**
+     * Load the block index, from the snapshot written at the last clean
+     * shutdown if there is one that matches the database, or else from the
+     * database itself.
+     */
     bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+    /**
+     * Write the given block index entries, which must match what is in the
+     * database, to a flat snapshot file that the next startup can map and
+     * read in one go. It is only used if the database is not written to in
+     * the meantime.
+     */
+    bool WriteBlockIndexSnapshot(const std::vector<const CBlockIndex*>& entries);
+
+private:
+    bool LoadBlockIndexSnapshot(std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
 };
 
 #endif // BITCOIN_TXDB_H
@@ -17,6 +17,7 @@
 #include <coins.h>
 #include <indirectmap.h>
 #include <policy/feerate.h>
+#include <prevector.h>
 #include <primitives/transaction.h>
 #include <sync.h>
 #include <random.h>
@@ -63,6 +64,11 @@ class CTxMemPool;
 
 class CTxMemPoolEntry
 {
+public:
+    /** Direct in-mempool parents or children of an entry. Most transactions
+     *  have only a few, which are stored inside the entry itself. */
+    typedef prevector<2, const CTxMemPoolEntry*> Links;
+
 private:
     CTransactionRef tx;
     CAmount nFee;              //!< Cached to avoid expensive parent-transaction lookups
@@ -128,6 +134,11 @@ public:
     int64_t GetSigOpCostWithAncestors() const { return nSigOpCostWithAncestors; }
 
     mutable size_t vTxHashesIdx; //!< Index in mempool's vTxHashes
+
+    // The mempool graph, maintained by CTxMemPool
+    mutable Links memPoolParents;  //!< Direct in-mempool parents
+    mutable Links memPoolChildren; //!< Direct in-mempool children
+    mutable uint64_t nEpoch;       //!< Last walk of the graph that visited this entry
 };
 
 // Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
@@ -338,6 +349,51 @@ struct TxMempoolInfo
     int64_t nFeeDelta;
 };
 
+/**
+ * A copy of the state of a mempool entry, which remains valid after the
+ * mempool lock is released.
+ */
+struct TxMempoolEntryInfo
+{
+    uint256 txid;
+    uint256 wtxid;
+    CAmount nFee;
+    CAmount nModifiedFee;
+    size_t nTxSize;
+    int64_t nTime;
+    unsigned int nHeight;
+
+    uint64_t nCountWithDescendants;
+    uint64_t nSizeWithDescendants;
+    CAmount nModFeesWithDescendants;
+    uint64_t nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+
+    /** Txids of the direct in-mempool parents and children. */
+    std::vector<uint256> parents;
+    std::vector<uint256> children;
+};
+
+/**
+ * An immutable copy of all mempool entries, sorted by txid, as of one
+ * version of the mempool (see CTxMemPool::GetSnapshot()). Readers share it
+ * until the mempool changes, and can read it without holding any lock.
+ */
+class CTxMemPoolSnapshot
+{
+public:
+    CTxMemPoolSnapshot(unsigned int version, std::vector<TxMempoolEntryInfo> entries)
+        : nVersion(version), vEntries(std::move(entries)) {}
+
+    /** The value of CTxMemPool::GetTransactionsUpdated() the snapshot was taken at */
+    const unsigned int nVersion;
+    const std::vector<TxMempoolEntryInfo> vEntries;
+
+    /** The entry of a transaction, or nullptr if it was not in the mempool. */
+    const TxMempoolEntryInfo* Find(const uint256& txid) const;
+};
+
 /** Reason why a transaction was removed from the mempool,
  * this is passed to the notification signal.
  */
@@ -392,18 +448,19 @@ public:
  *
  * In order for the feerate sort to remain correct, we must update transactions
  * in the mempool when new descendants arrive.  To facilitate this, we track
- * the set of in-mempool direct parents and direct children in mapLinks.  Within
+ * the in-mempool direct parents and direct children in the entries themselves
+ * (CTxMemPoolEntry::memPoolParents and memPoolChildren).  Within
  * each CTxMemPoolEntry, we track the size and fees of all descendants.
  *
  * Usually when a new transaction is added to the mempool, it has no in-mempool
  * children (because any such children would be an orphan).  So in
  * addUnchecked(), we:
- * - update a new entry's setMemPoolParents to include all in-mempool parents
+ * - update a new entry's memPoolParents to include all in-mempool parents
  * - update the new entry's direct parents to include the new tx as a child
  * - update all ancestors of the transaction to include the new tx's size/fee
  *
  * When a transaction is removed from the mempool, we must:
- * - update all in-mempool parents to not track the tx in setMemPoolChildren
+ * - update all in-mempool parents to not track the tx in memPoolChildren
  * - update all ancestors to not include the tx's size/fees in descendant state
  * - update all in-mempool children to not include it as a parent
  *
@@ -425,7 +482,7 @@ public:
  * state, to account for in-mempool, out-of-block descendants for all the
  * in-block transactions by calling UpdateTransactionsFromBlock().  Note that
  * until this is called, the mempool state is not consistent, and in particular
- * mapLinks may not be correct (and therefore functions like
+ * the parent and child links may not be correct (and therefore functions like
  * CalculateMemPoolAncestors() and CalculateDescendants() that rely
  * on them to walk the mempool are not generally safe to use).
  *
@@ -451,6 +508,10 @@ private:
     mutable bool blockSinceLastRollingFeeBump;
     mutable double rollingMinimumFeeRate; //!< minimum fee to get into the pool, decreases exponentially
 
+    mutable uint64_t nEpoch; //!< Number of the last walk of the mempool graph, see CTxMemPoolEntry::nEpoch
+
+    mutable std::weak_ptr<const CTxMemPoolSnapshot> lastSnapshot; //!< The last snapshot taken, handed out again while in use and until the mempool changes
+
     void trackPackageRemoved(const CFeeRate& rate) EXCLUSIVE_LOCKS_REQUIRED(cs);
 
 public:
@@ -496,22 +557,26 @@ public:
     };
     typedef std::set<txiter, CompareIteratorByHash> setEntries;
 
-    const setEntries & GetMemPoolParents(txiter entry) const EXCLUSIVE_LOCKS_REQUIRED(cs);
-    const setEntries & GetMemPoolChildren(txiter entry) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+    const CTxMemPoolEntry::Links & GetMemPoolParents(txiter entry) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+    const CTxMemPoolEntry::Links & GetMemPoolChildren(txiter entry) const EXCLUSIVE_LOCKS_REQUIRED(cs);
     uint64_t CalculateDescendantMaximum(txiter entry) const EXCLUSIVE_LOCKS_REQUIRED(cs);
 private:
-    typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
-
-    struct TxLinks {
-        setEntries parents;
-        setEntries children;
-    };
+    typedef std::map<txiter, std::vector<txiter>, CompareIteratorByHash> cacheMap;
 
-    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
-    txlinksMap mapLinks;
+    void UpdateLinks(CTxMemPoolEntry::Links& links, const CTxMemPoolEntry& link, bool add) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    void UpdateParent(txiter entry, txiter parent, bool add) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    void UpdateChild(txiter entry, txiter child, bool add) EXCLUSIVE_LOCKS_REQUIRED(cs);
 
-    void UpdateParent(txiter entry, txiter parent, bool add);
-    void UpdateChild(txiter entry, txiter child, bool add);
+    /** Start a walk of the mempool graph, in which no entry has been visited yet.
+     *  Walks may not be nested. */
+    uint64_t StartEpoch() const EXCLUSIVE_LOCKS_REQUIRED(cs) { return ++nEpoch; }
+    /** Mark an entry visited by the walk of the given epoch, and return whether it already was. */
+    static bool Visited(const CTxMemPoolEntry& entry, uint64_t epoch)
+    {
+        if (entry.nEpoch == epoch) return true;
+        entry.nEpoch = epoch;
+        return false;
+    }
 
     std::vector<indexed_transaction_set::const_iterator> GetSortedDepthAndScore() const EXCLUSIVE_LOCKS_REQUIRED(cs);
 
@@ -594,7 +659,7 @@ public:
      *  limitDescendantSize = max size of descendants any ancestor can have
      *  errString = populated with error reason if any limits are hit
      *  fSearchForParents = whether to search a tx's vin for in-mempool parents, or
-     *    look up parents from mapLinks. Must be true for entries not in the mempool
+     *    look up parents from memPoolParents. Must be true for entries not in the mempool
      */
     bool CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, setEntries& setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string& errString, bool fSearchForParents = true) const EXCLUSIVE_LOCKS_REQUIRED(cs);
 
@@ -647,6 +712,15 @@ public:
     CTransactionRef get(const uint256& hash) const;
     TxMempoolInfo info(const uint256& hash) const;
     std::vector<TxMempoolInfo> infoAll() const;
+    TxMempoolEntryInfo GetEntryInfo(txiter it) const EXCLUSIVE_LOCKS_REQUIRED(cs);
+    /**
+     * A snapshot of all entries, for readers that should not hold cs while
+     * they go through them (such as RPC building JSON). The copy is only made
+     * when the mempool changed since the last snapshot; until then, callers
+     * share the last one. The mempool does not keep it: it is freed once the
+     * last caller is done with it, as DynamicMemoryUsage does not count it.
+     */
+    std::shared_ptr<const CTxMemPoolSnapshot> GetSnapshot() const;
 
     size_t DynamicMemoryUsage() const;
 
@@ -684,7 +758,7 @@ private:
     /** Before calling removeUnchecked for a given transaction,
      *  UpdateForRemoveFromMempool must be called on the entire (dependent) set
      *  of transactions being removed at the same time.  We use each
-     *  CTxMemPoolEntry's setMemPoolParents in order to walk ancestors of a
+     *  CTxMemPoolEntry's memPoolParents in order to walk ancestors of a
      *  given transaction that is removed, so we can't remove intermediate
      *  transactions in a chain before we've updated all the state for the
      *  removal.
@@ -6,6 +6,9 @@
 #include <validation.h>
 
 #include <arith_uint256.h>
+#include <blockcache.h>
+#include <blockcompression.h>
+#include <blockfilemap.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <checkpoints.h>
@@ -14,6 +17,8 @@
 #include <consensus/merkle.h>
 #include <consensus/tx_verify.h>
 #include <consensus/validation.h>
+#include <crypto/common.h>
+#include <crypto/scrypt.h>
 #include <cuckoocache.h>
 #include <hash.h>
 #include <index/txindex.h>
@@ -157,6 +162,7 @@ private:
 public:
     CChain chainActive;
     BlockMap mapBlockIndex;
+    CBlockIndexArena m_block_index_arena;
     std::multimap<CBlockIndex*, CBlockIndex*> mapBlocksUnlinked;
     CBlockIndex *pindexBestInvalid = nullptr;
 
@@ -167,8 +173,9 @@ public:
     /**
      * If a block header hasn't already been seen, call CheckBlockHeader on it, ensure
      * that it doesn't descend from an invalid block, and then add it to mapBlockIndex.
+     * fCheckPOW may only be false if the proof of work of the header was verified by the caller.
      */
-    bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fCheckPOW = true) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
     // Block (dis)connection on a given view:
@@ -187,18 +194,21 @@ public:
     bool ReplayBlocks(const CChainParams& params, CCoinsView* view);
     bool RewindBlockIndex(const CChainParams& params);
     bool LoadGenesisBlock(const CChainParams& chainparams);
+    /** Mark the chain up to a UTXO snapshot's base block as validated but pruned. */
+    void LoadSnapshotChain(CBlockIndex* pindexBase, const Consensus::Params& consensus_params) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
     void PruneBlockIndexCandidates();
 
     void UnloadBlockIndex();
 
+    /** Create a new block index entry for a given block hash */
+    CBlockIndex* InsertBlockIndex(const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
 private:
     bool ActivateBestChainStep(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, bool& fInvalidFound, ConnectTrace& connectTrace);
     bool ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool);
 
     CBlockIndex* AddToBlockIndex(const CBlockHeader& block) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
-    /** Create a new block index entry for a given block hash */
-    CBlockIndex* InsertBlockIndex(const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     /**
      * Make various assertions about the state of the block index.
      *
@@ -221,6 +231,8 @@ CCriticalSection cs_main;
 BlockMap& mapBlockIndex = g_chainstate.mapBlockIndex;
 CChain& chainActive = g_chainstate.chainActive;
 CBlockIndex *pindexBestHeader = nullptr;
+CBlockIndex *pindexSnapshotBase = nullptr;
+CBlockIndex *pindexSnapshotValidated = nullptr;
 CWaitableCriticalSection g_best_block_mutex;
 CConditionVariable g_best_block_cv;
 uint256 g_best_block;
@@ -233,6 +245,7 @@ bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
+bool fCheckBlockReadPoW = DEFAULT_CHECK_BLOCK_READ_POW;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
@@ -265,6 +278,8 @@ namespace {
     CCriticalSection cs_LastBlockFile;
     std::vector<CBlockFileInfo> vinfoBlockFile;
     int nLastBlockFile = 0;
+    /** Size on disk of the block (false) and undo (true) files stored compressed, by file number. */
+    std::map<std::pair<int, bool>, uint64_t> mapCompressedFileSize;
     /** Global flag to indicate we should check to see if there are
      *  block/undo files that should be deleted.  Set on startup
      *  or if we allocate more file space when we're in prune mode
@@ -300,6 +315,13 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 std::unique_ptr<CCoinsViewDB> pcoinsdbview;
 std::unique_ptr<CCoinsViewCache> pcoinsTip;
 std::unique_ptr<CBlockTreeDB> pblocktree;
+/** Coins database the history below pindexSnapshotBase is validated against. */
+static std::unique_ptr<CCoinsViewDB> pcoinsSnapshotCheck;
+
+static fs::path SnapshotValidationDir()
+{
+    return GetDataDir() / "chainstate_background";
+}
 
 enum class FlushStateMode {
     NONE,
@@ -314,6 +336,7 @@ static void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPr
 static void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight);
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = nullptr);
 static FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
+static void QueueBlockFileCompression();
 
 bool CheckFinalTx(const CTransaction &tx, int flags)
 {
@@ -1003,6 +1026,97 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return AcceptToMemoryPoolWithTime(chainparams, pool, state, tx, pfMissingInputs, GetTime(), plTxnReplaced, bypass_limits, nAbsurdFee, test_accept);
 }
 
+/**
+ * The checks of one transaction that AcceptToMemoryPool can have done without
+ * cs_main: the scripts of its inputs against the coins they spend. They are
+ * only run to fill the signature cache; whether they pass is for
+ * AcceptToMemoryPool to find out, so they never report a failure.
+ */
+class CTxPreValidation
+{
+private:
+    CTransactionRef m_tx;
+    std::vector<Coin> m_coins;
+
+public:
+    CTxPreValidation() {}
+    CTxPreValidation(const CTransactionRef& tx, std::vector<Coin>&& coins) : m_tx(tx), m_coins(std::move(coins)) {}
+
+    bool operator()() {
+        PrecomputedTransactionData txdata(*m_tx);
+        for (unsigned int i = 0; i < m_tx->vin.size(); i++) {
+            if (!CScriptCheck(m_coins[i].out, *m_tx, i, STANDARD_SCRIPT_VERIFY_FLAGS, true /* cacheStore */, &txdata)())
+                break;
+        }
+        return true;
+    }
+
+    void swap(CTxPreValidation& check) {
+        std::swap(m_tx, check.m_tx);
+        std::swap(m_coins, check.m_coins);
+    }
+};
+
+static CCheckQueue<CTxPreValidation> txprevalidationqueue(4);
+
+void ThreadTxPreValidation() {
+    RenameThread("earthcoin-txcheck");
+    txprevalidationqueue.Thread();
+}
+
+void PreValidateTransactions(CTxMemPool& pool, const std::vector<CTransactionRef>& txs)
+{
+    if (nScriptCheckThreads == 0 || txs.size() < 2)
+        return;
+
+    std::vector<CTxPreValidation> vChecks;
+    vChecks.reserve(txs.size());
+    {
+        LOCK2(cs_main, pool.cs);
+        CCoinsViewMemPool viewMemPool(pcoinsTip.get(), pool);
+        const CFeeRate mempoolMinFee = pool.GetMinFee(gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+        // Leave the coins cache as it was, as AcceptToMemoryPool does for transactions it rejects.
+        std::vector<COutPoint> coins_to_uncache;
+        for (const CTransactionRef& tx : txs) {
+            // Only script checks are costly, so the cheap checks of AcceptToMemoryPool that
+            // would reject the transaction come first: checking scripts of transactions that
+            // are never accepted would only push useful entries out of the signature cache.
+            CValidationState state;
+            std::string reason;
+            if (tx->IsCoinBase() || pool.exists(tx->GetHash()) || !CheckTransaction(*tx, state) ||
+                (fRequireStandard && !IsStandardTx(*tx, reason)))
+                continue;
+            std::vector<Coin> coins;
+            coins.reserve(tx->vin.size());
+            CAmount nValueIn = 0;
+            for (const CTxIn& txin : tx->vin) {
+                if (!pcoinsTip->HaveCoinInCache(txin.prevout))
+                    coins_to_uncache.push_back(txin.prevout);
+                Coin coin;
+                // Transactions spending others of the batch are left to AcceptToMemoryPool.
+                if (!viewMemPool.GetCoin(txin.prevout, coin))
+                    break;
+                nValueIn += coin.out.nValue;
+                coins.push_back(std::move(coin));
+            }
+            if (coins.size() != tx->vin.size() || !MoneyRange(nValueIn) || nValueIn < tx->GetValueOut())
+                continue;
+            CAmount nModifiedFees = nValueIn - tx->GetValueOut();
+            pool.ApplyDelta(tx->GetHash(), nModifiedFees);
+            const int64_t nSize = GetVirtualTransactionSize(*tx);
+            if (nModifiedFees < mempoolMinFee.GetFee(nSize) || nModifiedFees < ::minRelayTxFee.GetFee(nSize))
+                continue;
+            vChecks.emplace_back(tx, std::move(coins));
+        }
+        for (const COutPoint& outpoint : coins_to_uncache)
+            pcoinsTip->Uncache(outpoint);
+    }
+
+    CCheckQueueControl<CTxPreValidation> control(&txprevalidationqueue);
+    control.Add(vChecks);
+    control.Wait();
+}
+
 /**
  * Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock.
  * If blockIndex is provided, the transaction is fetched from the corresponding block.
@@ -1077,25 +1191,24 @@ static bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMes
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams, bool fCheckPOW)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+    MappedBlock block_data;
+    if (!ReadRawBlockFromDisk(block_data, pos, Params().MessageStart()))
+        return error("ReadBlockFromDisk: ReadRawBlockFromDisk failed for %s", pos.ToString());
 
     // Read block
     try {
-        filein >> block;
+        SpanReader(SER_DISK, CLIENT_VERSION, block_data.Data()) >> block;
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
     }
     
     // A different rule for the genesis block. Because the original EAC genesis wan not mined correctly.
-    if (block.hashPrevBlock == uint256S("0x00"))
+    if (!fCheckPOW || block.hashPrevBlock == uint256S("0x00"))
         return true;
     
     // Check the header
@@ -1108,12 +1221,16 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
     CDiskBlockPos blockPos;
+    bool fCheckPOW;
     {
         LOCK(cs_main);
         blockPos = pindex->GetBlockPos();
+        // The scrypt hash was already checked when the header was accepted into the index; a matching
+        // block hash below proves the same header was read back, so skip recomputing it.
+        fCheckPOW = fCheckBlockReadPoW || !pindex->IsValid(BLOCK_VALID_HEADER);
     }
 
-    if (!ReadBlockFromDisk(block, blockPos, consensusParams))
+    if (!ReadBlockFromDisk(block, blockPos, consensusParams, fCheckPOW))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
@@ -1121,24 +1238,58 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
-bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& message_start)
+BlockCache g_block_cache(DEFAULT_BLOCK_CACHE_SIZE << 20);
+
+std::shared_ptr<const CBlock> ReadBlockFromDiskCached(const CBlockIndex* pindex, const Consensus::Params& consensusParams, bool fInsert)
 {
-    CDiskBlockPos hpos = pos;
-    hpos.nPos -= 8; // Seek back 8 bytes for meta header
-    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
-        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
-    }
+    std::shared_ptr<const CBlock> pblock = g_block_cache.Get(pindex->GetBlockHash());
+    if (pblock) return pblock;
 
-    try {
-        CMessageHeader::MessageStartChars blk_start;
-        unsigned int blk_size;
+    std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+    if (!ReadBlockFromDisk(*pblockRead, pindex, consensusParams))
+        return nullptr;
+    if (fInsert)
+        g_block_cache.Insert(pindex->GetBlockHash(), pblockRead);
+    return pblockRead;
+}
+
+/** Open block files kept mapped for reading blocks. */
+static const size_t MAX_BLOCK_FILE_MAPS = 32;
+
+static BlockFileMapCache g_block_file_maps([](int nFile) { return GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk"); }, MAX_BLOCK_FILE_MAPS);
+/** Compressed block and undo files are read through mappings as well, see blockcompression.h. */
+static BlockFileMapCache g_compressed_block_maps([](int nFile) { return GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blkz"); }, MAX_BLOCK_FILE_MAPS);
+static BlockFileMapCache g_compressed_undo_maps([](int nFile) { return GetBlockPosFilename(CDiskBlockPos(nFile, 0), "revz"); }, MAX_BLOCK_FILE_MAPS);
+
+/** Read dst.size() bytes at position pos of a block or undo file, whether it is stored compressed or not. */
+static bool ReadBlockFileRange(int nFile, bool fUndo, uint64_t pos, Span<uint8_t> dst)
+{
+    FILE* file = fsbridge::fopen(GetBlockPosFilename(CDiskBlockPos(nFile, 0), fUndo ? "rev" : "blk"), "rb");
+    if (file) {
+        const bool ok = fseek(file, pos, SEEK_SET) == 0 && fread(dst.data(), 1, dst.size(), file) == (size_t)dst.size();
+        fclose(file);
+        return ok;
+    }
+    std::shared_ptr<const BlockFileMapping> mapping = (fUndo ? g_compressed_undo_maps : g_compressed_block_maps).Get(nFile, 0);
+    return mapping && ReadCompressedBlockFile(mapping->Data(), pos, dst);
+}
+
+bool ReadRawBlockFromDisk(MappedBlock& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& message_start)
+{
+    // Every block is stored behind its message start and size.
+    if (pos.IsNull() || pos.nPos < CMessageHeader::MESSAGE_START_SIZE + 4) {
+        return error("%s: Invalid block position %s", __func__, pos.ToString());
+    }
+    const size_t header_pos = pos.nPos - CMessageHeader::MESSAGE_START_SIZE - 4;
 
-        filein >> blk_start >> blk_size;
+    std::shared_ptr<const BlockFileMapping> mapping = g_block_file_maps.Get(pos.nFile, pos.nPos);
+    if (mapping) {
+        const uint8_t* header = mapping->Data().data() + header_pos;
+        unsigned int blk_size = ReadLE32(header + CMessageHeader::MESSAGE_START_SIZE);
 
-        if (memcmp(blk_start, message_start, CMessageHeader::MESSAGE_START_SIZE)) {
+        if (memcmp(header, message_start, CMessageHeader::MESSAGE_START_SIZE)) {
             return error("%s: Block magic mismatch for %s: %s versus expected %s", __func__, pos.ToString(),
-                    HexStr(blk_start, blk_start + CMessageHeader::MESSAGE_START_SIZE),
+                    HexStr(header, header + CMessageHeader::MESSAGE_START_SIZE),
                     HexStr(message_start, message_start + CMessageHeader::MESSAGE_START_SIZE));
         }
 
@@ -1147,16 +1298,44 @@ bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos,
                     blk_size, MAX_SIZE);
         }
 
-        block.resize(blk_size); // Zeroing of memory is intentional here
-        filein.read((char*)block.data(), blk_size);
-    } catch(const std::exception& e) {
-        return error("%s: Read from block file failed: %s for %s", __func__, e.what(), pos.ToString());
+        if ((size_t)mapping->Data().size() < (size_t)pos.nPos + blk_size) {
+            mapping = g_block_file_maps.Get(pos.nFile, (size_t)pos.nPos + blk_size);
+        }
+        if (mapping) {
+            mapping->WillNeed(pos.nPos, blk_size);
+            block.SetMapped(mapping, mapping->Data().subspan(pos.nPos, blk_size));
+            return true;
+        }
+    }
+
+    // Block files cannot be mapped here, this one is stored compressed, or it is shorter than
+    // the block (which reading reports as an error); read the block into memory instead.
+    uint8_t header[CMessageHeader::MESSAGE_START_SIZE + 4];
+    if (!ReadBlockFileRange(pos.nFile, false, header_pos, MakeSpan(header))) {
+        return error("%s: Read from block file failed for %s", __func__, pos.ToString());
+    }
+    unsigned int blk_size = ReadLE32(header + CMessageHeader::MESSAGE_START_SIZE);
+
+    if (memcmp(header, message_start, CMessageHeader::MESSAGE_START_SIZE)) {
+        return error("%s: Block magic mismatch for %s: %s versus expected %s", __func__, pos.ToString(),
+                HexStr(header, header + CMessageHeader::MESSAGE_START_SIZE),
+                HexStr(message_start, message_start + CMessageHeader::MESSAGE_START_SIZE));
+    }
+
+    if (blk_size > MAX_SIZE) {
+        return error("%s: Block data is larger than maximum deserialization size for %s: %s versus %s", __func__, pos.ToString(),
+                blk_size, MAX_SIZE);
+    }
+
+    Span<uint8_t> buffer = block.SetBuffer(blk_size); // Zeroing of memory is intentional here
+    if (!ReadBlockFileRange(pos.nFile, false, pos.nPos, buffer)) {
+        return error("%s: Read from block file failed for %s", __func__, pos.ToString());
     }
 
     return true;
 }
 
-bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start)
+bool ReadRawBlockFromDisk(MappedBlock& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start)
 {
     CDiskBlockPos block_pos;
     {
@@ -1410,14 +1589,20 @@ int GetSpendHeight(const CCoinsViewCache& inputs)
 }
 
 
-static CuckooCache::cache<uint256, SignatureCacheHasher> scriptExecutionCache;
+/** Guards scriptExecutionCache, which blocks are checked against with and without cs_main held */
+static CCriticalSection cs_script_execution_cache;
+static CuckooCache::cache<uint256, SignatureCacheHasher> scriptExecutionCache GUARDED_BY(cs_script_execution_cache);
 static uint256 scriptExecutionCacheNonce(GetRandHash());
 
 void InitScriptExecutionCache() {
     // nMaxCacheSize is unsigned. If -maxsigcachesize is set to zero,
     // setup_bytes creates the minimum possible cache (2 elements).
     size_t nMaxCacheSize = std::min(std::max((int64_t)0, gArgs.GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) / 2), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
-    size_t nElems = scriptExecutionCache.setup_bytes(nMaxCacheSize);
+    size_t nElems;
+    {
+        LOCK(cs_script_execution_cache);
+        nElems = scriptExecutionCache.setup_bytes(nMaxCacheSize);
+    }
     LogPrintf("Using %zu MiB out of %zu/2 requested for script execution cache, able to store %zu elements\n",
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
@@ -1463,9 +1648,11 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
             // round - giving us 19 + 32 + 4 = 55 bytes (+ 8 + 1 = 64)
             static_assert(55 - sizeof(flags) - 32 >= 128/8, "Want at least 128 bits of nonce for script execution cache");
             CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetWitnessHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
-            AssertLockHeld(cs_main); //TODO: Remove this requirement by making CuckooCache not require external locks
-            if (scriptExecutionCache.contains(hashCacheEntry, !cacheFullScriptStore)) {
-                return true;
+            {
+                LOCK(cs_script_execution_cache);
+                if (scriptExecutionCache.contains(hashCacheEntry, !cacheFullScriptStore)) {
+                    return true;
+                }
             }
 
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
@@ -1512,6 +1699,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
             if (cacheFullScriptStore && !pvChecks) {
                 // We executed all of the provided scripts, and were told to
                 // cache the result. Do so now.
+                LOCK(cs_script_execution_cache);
                 scriptExecutionCache.insert(hashCacheEntry);
             }
         }
@@ -1549,21 +1737,36 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
-static bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
+} // namespace
+
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
 {
     CDiskBlockPos pos = pindex->GetUndoPos();
     if (pos.IsNull()) {
         return error("%s: no undo data available", __func__);
     }
 
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
+    // Read the record, behind its message start and size, in one go; the file may be stored compressed.
+    if (pos.nPos < CMessageHeader::MESSAGE_START_SIZE + 4) {
+        return error("%s: Invalid undo position %s", __func__, pos.ToString());
+    }
+    uint8_t header[CMessageHeader::MESSAGE_START_SIZE + 4];
+    if (!ReadBlockFileRange(pos.nFile, true, pos.nPos - sizeof(header), MakeSpan(header))) {
+        return error("%s: Read from undo file failed for %s", __func__, pos.ToString());
+    }
+    const unsigned int nSize = ReadLE32(header + CMessageHeader::MESSAGE_START_SIZE);
+    if (nSize > MAX_SIZE) {
+        return error("%s: Undo data is larger than maximum deserialization size for %s", __func__, pos.ToString());
+    }
+    std::vector<uint8_t> record(nSize + sizeof(uint256));
+    if (!ReadBlockFileRange(pos.nFile, true, pos.nPos, MakeSpan(record))) {
+        return error("%s: Read from undo file failed for %s", __func__, pos.ToString());
+    }
 
     // Read block
+    SpanReader filein(SER_DISK, CLIENT_VERSION, Span<const uint8_t>(record.data(), record.size()));
     uint256 hashChecksum;
-    CHashVerifier<CAutoFile> verifier(&filein); // We need a CHashVerifier as reserializing may lose data
+    CHashVerifier<SpanReader> verifier(&filein); // We need a CHashVerifier as reserializing may lose data
     try {
         verifier << pindex->pprev->GetBlockHash();
         verifier >> blockundo;
@@ -1580,6 +1783,8 @@ static bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex *pindex)
     return true;
 }
 
+namespace {
+
 /** Abort with a message */
 static bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
 {
@@ -1700,7 +1905,8 @@ void static FlushBlockFile(bool fFinalize = false)
     CDiskBlockPos posOld(nLastBlockFile, 0);
     bool status = true;
 
-    FILE *fileOld = OpenBlockFile(posOld);
+    // Files stored compressed were sealed already; -reindex only comes back to them to read.
+    FILE *fileOld = fs::exists(GetBlockPosFilename(posOld, "blkz")) ? nullptr : OpenBlockFile(posOld);
     if (fileOld) {
         if (fFinalize)
             status &= TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nSize);
@@ -1708,7 +1914,7 @@ void static FlushBlockFile(bool fFinalize = false)
         fclose(fileOld);
     }
 
-    fileOld = OpenUndoFile(posOld);
+    fileOld = fs::exists(GetBlockPosFilename(posOld, "revz")) ? nullptr : OpenUndoFile(posOld);
     if (fileOld) {
         if (fFinalize)
             status &= TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nUndoSize);
@@ -1749,6 +1955,82 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+/** Reads one coin from the chainstate database for PrefetchInputs. */
+class CCoinPrefetch
+{
+private:
+    COutPoint m_outpoint;
+    Coin* m_coin;
+
+public:
+    CCoinPrefetch() : m_coin(nullptr) {}
+    CCoinPrefetch(const COutPoint& outpoint, Coin* coin) : m_outpoint(outpoint), m_coin(coin) {}
+
+    bool operator()() {
+        try {
+            pcoinsdbview->GetCoin(m_outpoint, *m_coin);
+        } catch (const std::runtime_error& e) {
+            // Leave the coin to ConnectBlock, whose read reports the error.
+            *m_coin = Coin();
+        }
+        return true;
+    }
+
+    void swap(CCoinPrefetch& check) {
+        std::swap(m_outpoint, check.m_outpoint);
+        std::swap(m_coin, check.m_coin);
+    }
+};
+
+static CCheckQueue<CCoinPrefetch> coinprefetchqueue(8);
+
+void ThreadCoinPrefetch() {
+    RenameThread("earthcoin-prefetch");
+    coinprefetchqueue.Thread();
+}
+
+/**
+ * Read the coins spent by a block that pcoinsTip does not hold into it, on
+ * the prefetch threads. ConnectBlock would otherwise read them from the
+ * database one at a time; this way the reads overlap.
+ */
+static void PrefetchInputs(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    if (nScriptCheckThreads == 0)
+        return;
+
+    std::set<uint256> txids;
+    for (const CTransactionRef& tx : block.vtx) {
+        txids.insert(tx->GetHash());
+    }
+    std::vector<COutPoint> outpoints;
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        for (const CTxIn& txin : block.vtx[i]->vin) {
+            // Outputs created in the block itself are not in the database yet.
+            if (!txids.count(txin.prevout.hash) && !pcoinsTip->HaveCoinInCache(txin.prevout))
+                outpoints.push_back(txin.prevout);
+        }
+    }
+    if (outpoints.size() < 2)
+        return;
+
+    std::vector<Coin> coins(outpoints.size());
+    std::vector<CCoinPrefetch> vChecks;
+    vChecks.reserve(outpoints.size());
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        vChecks.emplace_back(outpoints[i], &coins[i]);
+    }
+    CCheckQueueControl<CCoinPrefetch> control(&coinprefetchqueue);
+    control.Add(vChecks);
+    control.Wait();
+
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        if (!coins[i].IsSpent())
+            pcoinsTip->AddPrefetchedCoin(outpoints[i], std::move(coins[i]));
+    }
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -1843,64 +2125,20 @@ static unsigned int GetBlockScriptFlags(const CBlockIndex* pindex, const Consens
 
 
 
-static int64_t nTimeCheck = 0;
-static int64_t nTimeForks = 0;
-static int64_t nTimeVerify = 0;
-static int64_t nTimeConnect = 0;
-static int64_t nTimeIndex = 0;
-static int64_t nTimeCallbacks = 0;
-static int64_t nTimeTotal = 0;
-static int64_t nBlocksTotal = 0;
+/** The consensus rules ConnectBlock() checks a block's transactions against */
+struct BlockConnectRules {
+    bool fScriptChecks;
+    bool fEnforceBIP30;
+    int nLockTimeFlags;
+    unsigned int flags;
+};
 
-/** Apply the effects of this block (with given index) on the UTXO set represented by coins.
- *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
- *  can fail if those validity checks fail (among other reasons). */
-bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
+/** Work out which rules apply to a block from its place in the block index. */
+static BlockConnectRules GetBlockConnectRules(const CBlockIndex* pindex, const CChainParams& chainparams) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     AssertLockHeld(cs_main);
-    assert(pindex);
-    assert(*pindex->phashBlock == block.GetHash());
-    int64_t nTimeStart = GetTimeMicros();
-
-    // Check it again in case a previous version let a bad block in
-    // NOTE: We don't currently (re-)invoke ContextualCheckBlock() or
-    // ContextualCheckBlockHeader() here. This means that if we add a new
-    // consensus rule that is enforced in one of those two functions, then we
-    // may have let in a block that violates the rule prior to updating the
-    // software, and we would NOT be enforcing the rule here. Fully solving
-    // upgrade from one software version to the next after a consensus rule
-    // change is potentially tricky and issue-specific (see RewindBlockIndex()
-    // for one general approach that was used for BIP 141 deployment).
-    // Also, currently the rule against blocks more than 2 hours in the future
-    // is enforced in ContextualCheckBlockHeader(); we wouldn't want to
-    // re-enforce that rule here (at least until we make it impossible for
-    // GetAdjustedTime() to go backward).
-    if (!CheckBlock(block, state, chainparams.GetConsensus(), !fJustCheck, !fJustCheck)) {
-        if (state.CorruptionPossible()) {
-            // We don't write down blocks to disk if they may have been
-            // corrupted, so this should be impossible unless we're having hardware
-            // problems.
-            return AbortNode(state, "Corrupt block found indicating potential hardware failure; shutting down");
-        }
-        return error("%s: Consensus::CheckBlock: %s", __func__, FormatStateMessage(state));
-    }
-
-    // verify that the view's current state corresponds to the previous block
-    uint256 hashPrevBlock = pindex->pprev == nullptr ? uint256() : pindex->pprev->GetBlockHash();
-    assert(hashPrevBlock == view.GetBestBlock());
-
-    // Special case for the genesis block, skipping connection of its transactions
-    // (its coinbase is unspendable)
-    if (block.GetHash() == chainparams.GetConsensus().hashGenesisBlock) {
-        if (!fJustCheck)
-            view.SetBestBlock(pindex->GetBlockHash());
-        return true;
-    }
-
-    nBlocksTotal++;
-
-    bool fScriptChecks = true;
+    BlockConnectRules rules;
+    rules.fScriptChecks = true;
     if (!hashAssumeValid.IsNull()) {
         // We've been configured with the hash of a block which has been externally verified to have a valid history.
         // A suitable default value is included with the software and updated from time to time.  Because validity
@@ -1921,14 +2159,11 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
                 //  artificially set the default assumed verified block further back.
                 // The test against nMinimumChainWork prevents the skipping when denied access to any chain at
                 //  least as good as the expected chain.
-                fScriptChecks = (GetBlockProofEquivalentTime(*pindexBestHeader, *pindex, *pindexBestHeader, chainparams.GetConsensus()) <= 60 * 60 * 24 * 7 * 2);
+                rules.fScriptChecks = (GetBlockProofEquivalentTime(*pindexBestHeader, *pindex, *pindexBestHeader, chainparams.GetConsensus()) <= 60 * 60 * 24 * 7 * 2);
             }
         }
     }
 
-    int64_t nTime1 = GetTimeMicros(); nTimeCheck += nTime1 - nTimeStart;
-    LogPrint(BCLog::BENCH, "    - Sanity checks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime1 - nTimeStart), nTimeCheck * MICRO, nTimeCheck * MILLI / nBlocksTotal);
-
     // Do not allow blocks that contain transactions which 'overwrite' older transactions,
     // unless those are already completely spent.
     // If such overwrites are allowed, coinbases and transactions depending upon those
@@ -1942,7 +2177,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     // two in the chain that violate it. This prevents exploiting the issue against nodes during their
     // initial block download.
     
-    bool fEnforceBIP30 = true;
+    rules.fEnforceBIP30 = true;
     //bool fEnforceBIP30 = !((pindex->nHeight==91842 && pindex->GetBlockHash() == uint256S("0x00000000000a4d0a398161ffc163c503763b1f4360639393e0e4c8e300e0caec")) ||
     //                       (pindex->nHeight==91880 && pindex->GetBlockHash() == uint256S("0x00000000000743f190a18c5577a3c2d2a1f610ae9601ac046a38084ccb7cd721")));
 
@@ -2005,12 +2240,33 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     assert(pindex->pprev);
     CBlockIndex *pindexBIP34height = pindex->pprev->GetAncestor(chainparams.GetConsensus().BIP34Height);
     //Only continue to enforce if we're below BIP34 activation height or the block hash at that height doesn't correspond.
-    fEnforceBIP30 = fEnforceBIP30 && (!pindexBIP34height || !(pindexBIP34height->GetBlockHash() == chainparams.GetConsensus().BIP34Hash));
+    rules.fEnforceBIP30 = rules.fEnforceBIP30 && (!pindexBIP34height || !(pindexBIP34height->GetBlockHash() == chainparams.GetConsensus().BIP34Hash));
+
+    // Start enforcing BIP68 (sequence locks) and BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    rules.nLockTimeFlags = 0;
+    if (VersionBitsState(pindex->pprev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_CSV, versionbitscache) == ThresholdState::ACTIVE) {
+        rules.nLockTimeFlags |= LOCKTIME_VERIFY_SEQUENCE;
+    }
 
+    // Get the script flags for this block
+    rules.flags = GetBlockScriptFlags(pindex, chainparams.GetConsensus());
+
+    return rules;
+}
+
+/**
+ * Check a block's transactions against the coins in view and spend them,
+ * recording what they spent in blockundo. Does not need cs_main, so blocks
+ * can be checked against a chainstate of their own without holding it.
+ */
+static bool ConnectBlockTransactions(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view,
+                                     const CChainParams& chainparams, const BlockConnectRules& rules, bool fJustCheck,
+                                     CBlockUndo& blockundo, int& nInputs, int64_t& nTimeTxsConnected)
+{
     // TODO: Remove BIP30 checking from block height 1,983,702 on, once we have a
     // consensus change that ensures coinbases at those heights can not
     // duplicate earlier coinbases.
-    if (fEnforceBIP30) {
+    if (rules.fEnforceBIP30) {
         for (const auto& tx : block.vtx) {
             for (size_t o = 0; o < tx->vout.size(); o++) {
                 if (view.HaveCoin(COutPoint(tx->GetHash(), o))) {
@@ -2021,25 +2277,11 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         }
     }
 
-    // Start enforcing BIP68 (sequence locks) and BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
-    int nLockTimeFlags = 0;
-    if (VersionBitsState(pindex->pprev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_CSV, versionbitscache) == ThresholdState::ACTIVE) {
-        nLockTimeFlags |= LOCKTIME_VERIFY_SEQUENCE;
-    }
-
-    // Get the script flags for this block
-    unsigned int flags = GetBlockScriptFlags(pindex, chainparams.GetConsensus());
-
-    int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
-    LogPrint(BCLog::BENCH, "    - Fork checks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime2 - nTime1), nTimeForks * MICRO, nTimeForks * MILLI / nBlocksTotal);
-
-    CBlockUndo blockundo;
-
-    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : nullptr);
+    CCheckQueueControl<CScriptCheck> control(rules.fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : nullptr);
 
     std::vector<int> prevheights;
     CAmount nFees = 0;
-    int nInputs = 0;
+    nInputs = 0;
     int64_t nSigOpsCost = 0;
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
     std::vector<PrecomputedTransactionData> txdata;
@@ -2070,7 +2312,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
                 prevheights[j] = view.AccessCoin(tx.vin[j].prevout).nHeight;
             }
 
-            if (!SequenceLocks(tx, nLockTimeFlags, &prevheights, *pindex)) {
+            if (!SequenceLocks(tx, rules.nLockTimeFlags, &prevheights, *pindex)) {
                 return state.DoS(100, error("%s: contains a non-BIP68-final transaction", __func__),
                                  REJECT_INVALID, "bad-txns-nonfinal");
             }
@@ -2080,7 +2322,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         // * legacy (always)
         // * p2sh (when P2SH enabled in flags and excludes coinbase)
         // * witness (when witness enabled in flags and excludes coinbase)
-        nSigOpsCost += GetTransactionSigOpCost(tx, view, flags);
+        nSigOpsCost += GetTransactionSigOpCost(tx, view, rules.flags);
         if (nSigOpsCost > MAX_BLOCK_SIGOPS_COST)
             return state.DoS(100, error("ConnectBlock(): too many sigops"),
                              REJECT_INVALID, "bad-blk-sigops");
@@ -2090,7 +2332,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         {
             std::vector<CScriptCheck> vChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : nullptr))
+            if (!CheckInputs(tx, state, view, rules.fScriptChecks, rules.flags, fCacheResults, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : nullptr))
                 return error("ConnectBlock(): CheckInputs on %s failed with %s",
                     tx.GetHash().ToString(), FormatStateMessage(state));
             control.Add(vChecks);
@@ -2102,8 +2344,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         }
         UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
     }
-    int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
-    LogPrint(BCLog::BENCH, "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs (%.2fms/blk)]\n", (unsigned)block.vtx.size(), MILLI * (nTime3 - nTime2), MILLI * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : MILLI * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * MICRO, nTimeConnect * MILLI / nBlocksTotal);
+    nTimeTxsConnected = GetTimeMicros();
 
     CAmount blockReward = nFees + GetBlockSubsidy(pindex->nHeight, chainparams.GetConsensus());
     if (block.vtx[0]->GetValueOut() > blockReward)
@@ -2118,28 +2359,105 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
 	LogPrintf("%s: CheckQueue failed", __func__);    
         //return state.DoS(100, error("%s: CheckQueue failed", __func__), REJECT_INVALID, "block-validation-failed");
 	
-    int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2;
-    LogPrint(BCLog::BENCH, "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs (%.2fms/blk)]\n", nInputs - 1, MILLI * (nTime4 - nTime2), nInputs <= 1 ? 0 : MILLI * (nTime4 - nTime2) / (nInputs-1), nTimeVerify * MICRO, nTimeVerify * MILLI / nBlocksTotal);
+    return true;
+}
 
-    if (fJustCheck)
-        return true;
+static int64_t nTimeCheck = 0;
+static int64_t nTimeForks = 0;
+static int64_t nTimeVerify = 0;
+static int64_t nTimeConnect = 0;
+static int64_t nTimeIndex = 0;
+static int64_t nTimeCallbacks = 0;
+static int64_t nTimeTotal = 0;
+static int64_t nBlocksTotal = 0;
 
-    if (!WriteUndoDataForBlock(blockundo, state, pindex, chainparams))
-        return false;
+/** Apply the effects of this block (with given index) on the UTXO set represented by coins.
+ *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
+ *  can fail if those validity checks fail (among other reasons). */
+bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
+{
+    AssertLockHeld(cs_main);
+    assert(pindex);
+    assert(*pindex->phashBlock == block.GetHash());
+    int64_t nTimeStart = GetTimeMicros();
 
-    if (!pindex->IsValid(BLOCK_VALID_SCRIPTS)) {
-        pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
-        setDirtyBlockIndex.insert(pindex);
+    // Check it again in case a previous version let a bad block in
+    // NOTE: We don't currently (re-)invoke ContextualCheckBlock() or
+    // ContextualCheckBlockHeader() here. This means that if we add a new
+    // consensus rule that is enforced in one of those two functions, then we
+    // may have let in a block that violates the rule prior to updating the
+    // software, and we would NOT be enforcing the rule here. Fully solving
+    // upgrade from one software version to the next after a consensus rule
+    // change is potentially tricky and issue-specific (see RewindBlockIndex()
+    // for one general approach that was used for BIP 141 deployment).
+    // Also, currently the rule against blocks more than 2 hours in the future
+    // is enforced in ContextualCheckBlockHeader(); we wouldn't want to
+    // re-enforce that rule here (at least until we make it impossible for
+    // GetAdjustedTime() to go backward).
+    if (!CheckBlock(block, state, chainparams.GetConsensus(), !fJustCheck, !fJustCheck)) {
+        if (state.CorruptionPossible()) {
+            // We don't write down blocks to disk if they may have been
+            // corrupted, so this should be impossible unless we're having hardware
+            // problems.
+            return AbortNode(state, "Corrupt block found indicating potential hardware failure; shutting down");
+        }
+        return error("%s: Consensus::CheckBlock: %s", __func__, FormatStateMessage(state));
     }
 
-    assert(pindex->phashBlock);
-    // add this block to the view's block chain
-    view.SetBestBlock(pindex->GetBlockHash());
-
-    int64_t nTime5 = GetTimeMicros(); nTimeIndex += nTime5 - nTime4;
-    LogPrint(BCLog::BENCH, "    - Index writing: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime5 - nTime4), nTimeIndex * MICRO, nTimeIndex * MILLI / nBlocksTotal);
+    // verify that the view's current state corresponds to the previous block
+    uint256 hashPrevBlock = pindex->pprev == nullptr ? uint256() : pindex->pprev->GetBlockHash();
+    assert(hashPrevBlock == view.GetBestBlock());
 
-    int64_t nTime6 = GetTimeMicros(); nTimeCallbacks += nTime6 - nTime5;
+    // Special case for the genesis block, skipping connection of its transactions
+    // (its coinbase is unspendable)
+    if (block.GetHash() == chainparams.GetConsensus().hashGenesisBlock) {
+        if (!fJustCheck)
+            view.SetBestBlock(pindex->GetBlockHash());
+        return true;
+    }
+
+    nBlocksTotal++;
+
+    int64_t nTime1 = GetTimeMicros(); nTimeCheck += nTime1 - nTimeStart;
+    LogPrint(BCLog::BENCH, "    - Sanity checks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime1 - nTimeStart), nTimeCheck * MICRO, nTimeCheck * MILLI / nBlocksTotal);
+
+    const BlockConnectRules rules = GetBlockConnectRules(pindex, chainparams);
+
+    int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
+    LogPrint(BCLog::BENCH, "    - Fork checks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime2 - nTime1), nTimeForks * MICRO, nTimeForks * MILLI / nBlocksTotal);
+
+    CBlockUndo blockundo;
+    int nInputs;
+    int64_t nTime3;
+    if (!ConnectBlockTransactions(block, state, pindex, view, chainparams, rules, fJustCheck, blockundo, nInputs, nTime3)) {
+        return false;
+    }
+    nTimeConnect += nTime3 - nTime2;
+    LogPrint(BCLog::BENCH, "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs (%.2fms/blk)]\n", (unsigned)block.vtx.size(), MILLI * (nTime3 - nTime2), MILLI * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : MILLI * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * MICRO, nTimeConnect * MILLI / nBlocksTotal);
+
+    int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2;
+    LogPrint(BCLog::BENCH, "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs (%.2fms/blk)]\n", nInputs - 1, MILLI * (nTime4 - nTime2), nInputs <= 1 ? 0 : MILLI * (nTime4 - nTime2) / (nInputs-1), nTimeVerify * MICRO, nTimeVerify * MILLI / nBlocksTotal);
+
+    if (fJustCheck)
+        return true;
+
+    if (!WriteUndoDataForBlock(blockundo, state, pindex, chainparams))
+        return false;
+
+    if (!pindex->IsValid(BLOCK_VALID_SCRIPTS)) {
+        pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+        setDirtyBlockIndex.insert(pindex);
+    }
+
+    assert(pindex->phashBlock);
+    // add this block to the view's block chain
+    view.SetBestBlock(pindex->GetBlockHash());
+
+    int64_t nTime5 = GetTimeMicros(); nTimeIndex += nTime5 - nTime4;
+    LogPrint(BCLog::BENCH, "    - Index writing: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime5 - nTime4), nTimeIndex * MICRO, nTimeIndex * MILLI / nBlocksTotal);
+
+    int64_t nTime6 = GetTimeMicros(); nTimeCallbacks += nTime6 - nTime5;
     LogPrint(BCLog::BENCH, "    - Callbacks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime6 - nTime5), nTimeCallbacks * MICRO, nTimeCallbacks * MILLI / nBlocksTotal);
 
     return true;
@@ -2190,10 +2508,14 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             nLastFlush = nNow;
         }
         int64_t nMempoolSizeMax = gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
-        int64_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+        // Coins still being written in the background count against the cache.
+        int64_t cacheSize = pcoinsTip->DynamicMemoryUsage() + pcoinsdbview->DynamicMemoryUsage();
         int64_t nTotalSpace = nCoinCacheUsage + std::max<int64_t>(nMempoolSizeMax - nMempoolUsage, 0);
+        // When the chainstate is written in the background, start doing so at half the space, leaving the
+        // other half for the blocks connected in the meantime.
+        int64_t nFlushSpace = pcoinsdbview->FlushesInBackground() ? nTotalSpace / 2 : nTotalSpace;
         // The cache is large and we're within 10% and 10 MiB of the limit, but we have time now (not in the middle of a block processing).
-        bool fCacheLarge = mode == FlushStateMode::PERIODIC && cacheSize > std::max((9 * nTotalSpace) / 10, nTotalSpace - MAX_BLOCK_COINSDB_USAGE * 1024 * 1024);
+        bool fCacheLarge = mode == FlushStateMode::PERIODIC && cacheSize > std::max((9 * nFlushSpace) / 10, nFlushSpace - MAX_BLOCK_COINSDB_USAGE * 1024 * 1024);
         // The cache is over the limit, we have to write now.
         bool fCacheCritical = mode == FlushStateMode::IF_NEEDED && cacheSize > nTotalSpace;
         // It's been a while since we wrote the block index to disk. Do this frequently, so we don't need to redownload after a crash.
@@ -2244,6 +2566,10 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             // Flush the chainstate (which may refer to block index entries).
             if (!pcoinsTip->Flush())
                 return AbortNode(state, "Failed to write to coin database");
+            // Callers asking for everything on disk, and pruning, which just
+            // deleted blocks a replay could otherwise need, wait for the write.
+            if ((mode == FlushStateMode::ALWAYS || fFlushForPrune) && !pcoinsdbview->Sync())
+                return AbortNode(state, "Failed to write to coin database");
             nLastFlush = nNow;
             full_flush_completed = true;
         }
@@ -2405,6 +2731,7 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
 }
 
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
@@ -2496,10 +2823,13 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
         pthisBlock = pblock;
     }
     const CBlock& blockConnecting = *pthisBlock;
+    int64_t nTimeLoaded = GetTimeMicros(); nTimeReadFromDisk += nTimeLoaded - nTime1;
+    LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTimeLoaded - nTime1) * MILLI, nTimeReadFromDisk * MICRO);
+    PrefetchInputs(blockConnecting);
     // Apply the block atomically to the chain state.
-    int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
+    int64_t nTime2 = GetTimeMicros(); nTimePrefetch += nTime2 - nTimeLoaded;
     int64_t nTime3;
-    LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * MILLI, nTimeReadFromDisk * MICRO);
+    LogPrint(BCLog::BENCH, "  - Prefetch inputs: %.2fms [%.2fs]\n", (nTime2 - nTimeLoaded) * MILLI, nTimePrefetch * MICRO);
     {
         CCoinsViewCache view(pcoinsTip.get());
         bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
@@ -2532,6 +2862,8 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     LogPrint(BCLog::BENCH, "  - Connect postprocess: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime6 - nTime5) * MILLI, nTimePostConnect * MICRO, nTimePostConnect * MILLI / nBlocksTotal);
     LogPrint(BCLog::BENCH, "- Connect block: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime6 - nTime1) * MILLI, nTimeTotal * MICRO, nTimeTotal * MILLI / nBlocksTotal);
 
+    // The new tip is what ZMQ, peers catching up and explorers ask for next.
+    g_block_cache.Insert(pindexNew->GetBlockHash(), pthisBlock);
     connectTrace.BlockConnected(pindexNew, std::move(pthisBlock));
     return true;
 }
@@ -2975,7 +3307,7 @@ CBlockIndex* CChainState::AddToBlockIndex(const CBlockHeader& block)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
+    CBlockIndex* pindexNew = m_block_index_arena.Create(block);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -3073,6 +3405,8 @@ static bool FindBlockPos(CDiskBlockPos &pos, unsigned int nAddSize, unsigned int
         }
         FlushBlockFile(!fKnown);
         nLastBlockFile = nFile;
+        if (!fKnown)
+            QueueBlockFileCompression();
     }
 
     vinfoBlockFile[nFile].AddBlock(nHeight, nTime);
@@ -3418,7 +3752,7 @@ static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, c
     return true;
 }
 
-bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fCheckPOW)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -3436,7 +3770,7 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), fCheckPOW))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get prev block index
@@ -3479,15 +3813,180 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
     return true;
 }
 
+/**
+ * Closure checking the scrypt proof of work of a group of headers, hashing them
+ * together through scrypt_1024_1_1_256_multi.
+ */
+class CHeaderPoWCheck
+{
+private:
+    std::vector<const CBlockHeader*> m_headers;
+    const Consensus::Params* m_params;
+
+public:
+    CHeaderPoWCheck(): m_params(nullptr) {}
+    CHeaderPoWCheck(std::vector<const CBlockHeader*>&& headers, const Consensus::Params& params) :
+        m_headers(std::move(headers)), m_params(&params) {}
+
+    bool operator()() {
+        std::vector<const char*> inputs(m_headers.size());
+        std::vector<uint256> hashes(m_headers.size());
+        std::vector<char*> outputs(m_headers.size());
+        for (size_t i = 0; i < m_headers.size(); i++) {
+            inputs[i] = BEGIN(m_headers[i]->nVersion);
+            outputs[i] = BEGIN(hashes[i]);
+        }
+        scrypt_1024_1_1_256_multi(inputs.data(), outputs.data(), m_headers.size());
+        for (size_t i = 0; i < m_headers.size(); i++) {
+            if (!CheckProofOfWork(hashes[i], m_headers[i]->nBits, *m_params))
+                return false;
+        }
+        return true;
+    }
+
+    void swap(CHeaderPoWCheck& check) {
+        m_headers.swap(check.m_headers);
+        std::swap(m_params, check.m_params);
+    }
+};
+
+/** Headers hashed per CHeaderPoWCheck; a full batch for the widest multi-buffer kernel. */
+static const size_t HEADER_POW_CHECK_GROUP = 16;
+
+static CCheckQueue<CHeaderPoWCheck> headerpowcheckqueue(1);
+
+void ThreadHeaderPoWCheck() {
+    RenameThread("earthcoin-powchk");
+    headerpowcheckqueue.Thread();
+}
+
+/** Headers per check queue run of ThreadCheckBlockIndexPoW, so header sync never waits long for the queue. */
+static const size_t BLOCK_INDEX_POW_CHECK_CHUNK = 1024;
+
+/** Verify the proof of work of the given headers on the header check threads, if any. */
+static bool RunHeaderPoWChecks(const std::vector<const CBlockHeader*>& headers, const Consensus::Params& consensusParams)
+{
+    std::vector<CHeaderPoWCheck> vChecks;
+    for (size_t i = 0; i < headers.size(); i += HEADER_POW_CHECK_GROUP) {
+        auto end = headers.begin() + std::min(headers.size(), i + HEADER_POW_CHECK_GROUP);
+        vChecks.emplace_back(std::vector<const CBlockHeader*>(headers.begin() + i, end), consensusParams);
+    }
+
+    if (nScriptCheckThreads == 0 || vChecks.size() < 2) {
+        for (CHeaderPoWCheck& check : vChecks) {
+            if (!check())
+                return false;
+        }
+        return true;
+    }
+    CCheckQueueControl<CHeaderPoWCheck> control(&headerpowcheckqueue);
+    control.Add(vChecks);
+    return control.Wait();
+}
+
+/**
+ * Verify the scrypt proof of work of all headers not yet in mapBlockIndex on the check
+ * threads, so that AcceptBlockHeader can skip it while cs_main is held. Returns false if
+ * any header fails; the caller then lets CheckBlockHeader find and report it.
+ */
+static bool CheckHeadersPoW(const std::vector<CBlockHeader>& headers, const Consensus::Params& consensusParams)
+{
+    std::vector<const CBlockHeader*> unknown;
+    {
+        LOCK(cs_main);
+        for (const CBlockHeader& header : headers) {
+            // The genesis block was not mined correctly; CheckBlockHeader skips it too.
+            if (!header.hashPrevBlock.IsNull() && !mapBlockIndex.count(header.GetHash()))
+                unknown.push_back(&header);
+        }
+    }
+
+    return RunHeaderPoWChecks(unknown, consensusParams);
+}
+
+void ThreadCheckBlockIndexPoW()
+{
+    RenameThread("earthcoin-idxpow");
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+
+    // Entries loaded from disk; those created later had their proof of work checked on arrival.
+    size_t nEntries;
+    {
+        LOCK(cs_main);
+        nEntries = g_chainstate.m_block_index_arena.Size();
+    }
+    LogPrintf("Checking proof of work of %u block index entries in the background\n", nEntries);
+
+    int64_t nStart = GetTimeMillis();
+    size_t nInvalid = 0;
+    int nReportDone = 0;
+    std::vector<const CBlockIndex*> entries;
+    std::vector<CBlockHeader> headers;
+    for (size_t pos = 0; pos < nEntries; pos += BLOCK_INDEX_POW_CHECK_CHUNK) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested())
+            return;
+
+        size_t end = std::min(nEntries, pos + BLOCK_INDEX_POW_CHECK_CHUNK);
+        entries.clear();
+        {
+            // Only the pointers are copied under cs_main: the header fields of an entry
+            // never change, and entries are not freed while the node runs.
+            LOCK(cs_main);
+            for (size_t i = pos; i < end; i++)
+                entries.push_back(g_chainstate.m_block_index_arena[i]);
+        }
+        headers.clear();
+        for (const CBlockIndex* pindex : entries) {
+            // The genesis block was not mined correctly; CheckBlockHeader skips it too.
+            if (pindex->pprev != nullptr)
+                headers.push_back(pindex->GetBlockHeader());
+        }
+        std::vector<const CBlockHeader*> chunk;
+        for (const CBlockHeader& header : headers)
+            chunk.push_back(&header);
+
+        bool fOk;
+        {
+            // Leaving the check queue half way would corrupt its state.
+            boost::this_thread::disable_interruption no_interrupt;
+            fOk = RunHeaderPoWChecks(chunk, consensusParams);
+        }
+        if (!fOk) {
+            for (const CBlockHeader* header : chunk) {
+                if (!CheckProofOfWork(header->GetPoWHash(), header->nBits, consensusParams)) {
+                    LogPrintf("ERROR: %s: block %s has an invalid proof of work\n", __func__, header->GetHash().ToString());
+                    nInvalid++;
+                }
+            }
+        }
+
+        int nPercentageDone = (int)(end * 100 / nEntries);
+        if (nPercentageDone / 10 > nReportDone / 10) {
+            LogPrintf("Block index proof of work check: %d%% done\n", nPercentageDone);
+            nReportDone = nPercentageDone;
+        }
+    }
+
+    if (nInvalid > 0) {
+        AbortNode(strprintf("Block index contains %u headers with invalid proof of work", nInvalid),
+                  _("Error: The block index contains invalid proof of work. Restart with -reindex to rebuild it."));
+        return;
+    }
+    LogPrintf("Block index proof of work check passed in %dms\n", GetTimeMillis() - nStart);
+}
+
 // Exposed wrapper for AcceptBlockHeader
 bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex, CBlockHeader *first_invalid)
 {
     if (first_invalid != nullptr) first_invalid->SetNull();
+    // Only hash whole headers messages up front; single announcements gain nothing from it.
+    bool fPoWChecked = headers.size() > 1 && CheckHeadersPoW(headers, chainparams.GetConsensus());
     {
         LOCK(cs_main);
         for (const CBlockHeader& header : headers) {
             CBlockIndex *pindex = nullptr; // Use a temp pindex instead of ppindex to avoid a const_cast
-            if (!g_chainstate.AcceptBlockHeader(header, state, chainparams, &pindex)) {
+            if (!g_chainstate.AcceptBlockHeader(header, state, chainparams, &pindex, !fPoWChecked)) {
                 if (first_invalid) *first_invalid = header;
                 return false;
             }
@@ -3530,7 +4029,8 @@ bool CChainState::AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CVali
     CBlockIndex *pindexDummy = nullptr;
     CBlockIndex *&pindex = ppindex ? *ppindex : pindexDummy;
 
-    if (!AcceptBlockHeader(block, state, chainparams, &pindex))
+    // A block that passed CheckBlock already had its proof of work verified.
+    if (!AcceptBlockHeader(block, state, chainparams, &pindex, !block.fChecked))
         return false;
 
     // Try to process all requested blocks that we don't have, but only
@@ -3661,14 +4161,24 @@ bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams,
  * BLOCK PRUNING CODE
  */
 
+/** Space a block file and its undo file take on disk, whether they are stored compressed or not. */
+static uint64_t BlockFileDiskUsage(int nFile) EXCLUSIVE_LOCKS_REQUIRED(cs_LastBlockFile)
+{
+    const CBlockFileInfo& info = vinfoBlockFile[nFile];
+    auto blk = mapCompressedFileSize.find(std::make_pair(nFile, false));
+    auto rev = mapCompressedFileSize.find(std::make_pair(nFile, true));
+    return (blk != mapCompressedFileSize.end() ? blk->second : info.nSize) +
+        (rev != mapCompressedFileSize.end() ? rev->second : info.nUndoSize);
+}
+
 /* Calculate the amount of disk space the block & undo files currently use */
 uint64_t CalculateCurrentUsage()
 {
     LOCK(cs_LastBlockFile);
 
     uint64_t retval = 0;
-    for (const CBlockFileInfo &file : vinfoBlockFile) {
-        retval += file.nSize + file.nUndoSize;
+    for (int nFile = 0; nFile < (int)vinfoBlockFile.size(); nFile++) {
+        retval += BlockFileDiskUsage(nFile);
     }
     return retval;
 }
@@ -3704,6 +4214,8 @@ void PruneOneBlockFile(const int fileNumber)
     }
 
     vinfoBlockFile[fileNumber].SetNull();
+    mapCompressedFileSize.erase(std::make_pair(fileNumber, false));
+    mapCompressedFileSize.erase(std::make_pair(fileNumber, true));
     setDirtyFileInfo.insert(fileNumber);
 }
 
@@ -3712,8 +4224,13 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 {
     for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        g_block_file_maps.Forget(*it);
+        g_compressed_block_maps.Forget(*it);
+        g_compressed_undo_maps.Forget(*it);
         fs::remove(GetBlockPosFilename(pos, "blk"));
         fs::remove(GetBlockPosFilename(pos, "rev"));
+        fs::remove(GetBlockPosFilename(pos, "blkz"));
+        fs::remove(GetBlockPosFilename(pos, "revz"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
     }
 }
@@ -3729,6 +4246,9 @@ static void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPr
 
     // last block to prune is the lesser of (user-specified height, MIN_BLOCKS_TO_KEEP from the tip)
     unsigned int nLastBlockWeCanPrune = std::min((unsigned)nManualPruneHeight, chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP);
+    // The history below a loaded UTXO snapshot is kept until it has been validated.
+    if (pindexSnapshotBase)
+        nLastBlockWeCanPrune = std::min(nLastBlockWeCanPrune, (unsigned)pindexSnapshotValidated->nHeight);
     int count=0;
     for (int fileNumber = 0; fileNumber < nLastBlockFile; fileNumber++) {
         if (vinfoBlockFile[fileNumber].nSize == 0 || vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
@@ -3776,6 +4296,9 @@ static void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfte
     }
 
     unsigned int nLastBlockWeCanPrune = chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP;
+    // The history below a loaded UTXO snapshot is kept until it has been validated.
+    if (pindexSnapshotBase)
+        nLastBlockWeCanPrune = std::min(nLastBlockWeCanPrune, (unsigned)pindexSnapshotValidated->nHeight);
     uint64_t nCurrentUsage = CalculateCurrentUsage();
     // We don't check to prune until after we've allocated new space for files
     // So we should leave a buffer under our target to account for another allocation
@@ -3795,7 +4318,7 @@ static void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfte
         }
 
         for (int fileNumber = 0; fileNumber < nLastBlockFile; fileNumber++) {
-            nBytesToPrune = vinfoBlockFile[fileNumber].nSize + vinfoBlockFile[fileNumber].nUndoSize;
+            nBytesToPrune = BlockFileDiskUsage(fileNumber);
 
             if (vinfoBlockFile[fileNumber].nSize == 0)
                 continue;
@@ -3832,6 +4355,45 @@ bool CheckDiskSpace(uint64_t nAdditionalBytes, bool blocks_dir)
     return true;
 }
 
+/**
+ * Restore a block or undo file stored compressed in place of its compressed
+ * copy, to write to it. Only done under cs_main. Readers do not need this:
+ * ReadBlockFileRange decompresses just the range they read.
+ */
+static FILE* RestoreCompressedDiskFile(int nFile, const char *prefix)
+{
+    const bool fUndo = strcmp(prefix, "rev") == 0;
+    BlockFileMapCache& maps = fUndo ? g_compressed_undo_maps : g_compressed_block_maps;
+    std::shared_ptr<const BlockFileMapping> mapping = maps.Get(nFile, 0);
+    if (!mapping)
+        return nullptr;
+    const fs::path path = GetBlockPosFilename(CDiskBlockPos(nFile, 0), prefix);
+    const fs::path tmp_path = path.string() + ".new";
+
+    FILE* file = fsbridge::fopen(tmp_path, "wb+");
+    if (!file)
+        return nullptr;
+    if (!DecompressBlockFile(mapping->Data(), file) || !FileCommit(file)) {
+        LogPrintf("Unable to decompress the compressed copy of %s\n", path.string());
+        fclose(file);
+        fs::remove(tmp_path);
+        return nullptr;
+    }
+
+    fclose(file);
+    if (!RenameOver(tmp_path, path))
+        return nullptr;
+    mapping.reset();
+    maps.Forget(nFile);
+    fs::remove(GetBlockPosFilename(CDiskBlockPos(nFile, 0), strprintf("%sz", prefix).c_str()));
+    {
+        LOCK(cs_LastBlockFile);
+        mapCompressedFileSize.erase(std::make_pair(nFile, fUndo));
+    }
+    LogPrintf("Restored %s from its compressed copy to write to it\n", path.filename().string());
+    return fsbridge::fopen(path, "rb+");
+}
+
 static FILE* OpenDiskFile(const CDiskBlockPos &pos, const char *prefix, bool fReadOnly)
 {
     if (pos.IsNull())
@@ -3839,6 +4401,14 @@ static FILE* OpenDiskFile(const CDiskBlockPos &pos, const char *prefix, bool fRe
     fs::path path = GetBlockPosFilename(pos, prefix);
     fs::create_directories(path.parent_path());
     FILE* file = fsbridge::fopen(path, fReadOnly ? "rb": "rb+");
+    if (!file && fs::exists(GetBlockPosFilename(pos, strprintf("%sz", prefix).c_str()))) {
+        if (fReadOnly) {
+            // Decompressing the whole file for a read would be far too costly.
+            LogPrintf("%s is stored compressed and cannot be opened for reading\n", path.string());
+            return nullptr;
+        }
+        file = RestoreCompressedDiskFile(pos.nFile, prefix);
+    }
     if (!file && !fReadOnly)
         file = fsbridge::fopen(path, "wb+");
     if (!file) {
@@ -3869,6 +4439,111 @@ fs::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix)
     return GetBlocksDir() / strprintf("%s%05u.dat", prefix, pos.nFile);
 }
 
+static boost::mutex g_compress_block_files_mutex;
+static boost::condition_variable g_compress_block_files_cond;
+static bool g_compress_block_files_pending = true;
+/** How often the compression thread looks for undo files that have aged enough, if no block file was sealed meanwhile. */
+static const int COMPRESS_BLOCK_FILES_INTERVAL = 60 * 60;
+
+/** Wake the compression thread to look for files it can compress, once a block file has been sealed. */
+static void QueueBlockFileCompression()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(g_compress_block_files_mutex);
+        g_compress_block_files_pending = true;
+    }
+    g_compress_block_files_cond.notify_one();
+}
+
+/**
+ * Replace a block or undo file by a compressed copy. The copy is made
+ * without locks, and swapped in under cs_main and cs_LastBlockFile only if
+ * nothing was written to the file meanwhile. Readers find the raw file until
+ * the compressed copy is in place.
+ */
+static void CompressBlockFile(int nFile, bool fUndo)
+{
+    const char* prefix = fUndo ? "rev" : "blk";
+    const CDiskBlockPos pos(nFile, 0);
+    const fs::path path = GetBlockPosFilename(pos, prefix);
+    const fs::path compressed_path = GetBlockPosFilename(pos, fUndo ? "revz" : "blkz");
+    const fs::path tmp_path = compressed_path.string() + ".new";
+    if (!fs::exists(path))
+        return;
+
+    unsigned int nSize;
+    {
+        LOCK2(cs_main, cs_LastBlockFile);
+        nSize = fUndo ? vinfoBlockFile[nFile].nUndoSize : vinfoBlockFile[nFile].nSize;
+    }
+    const int64_t nStart = GetTimeMicros();
+    if (!CompressBlockFile(path, tmp_path)) {
+        LogPrintf("%s: failed to compress %s\n", __func__, path.string());
+        fs::remove(tmp_path);
+        return;
+    }
+
+    uint64_t nCompressedSize;
+    {
+        LOCK2(cs_main, cs_LastBlockFile);
+        if (nSize != (fUndo ? vinfoBlockFile[nFile].nUndoSize : vinfoBlockFile[nFile].nSize) || !fs::exists(path)) {
+            fs::remove(tmp_path);
+            return;
+        }
+        if (!RenameOver(tmp_path, compressed_path)) {
+            LogPrintf("%s: failed to rename %s\n", __func__, tmp_path.string());
+            fs::remove(tmp_path);
+            return;
+        }
+        (fUndo ? g_compressed_undo_maps : g_compressed_block_maps).Forget(nFile);
+        fs::remove(path);
+        if (!fUndo)
+            g_block_file_maps.Forget(nFile);
+        nCompressedSize = fs::file_size(compressed_path);
+        mapCompressedFileSize[std::make_pair(nFile, fUndo)] = nCompressedSize;
+    }
+    LogPrint(BCLog::BENCH, "Compressed %s to %u bytes from %u (%.2fms)\n", path.filename().string(), nCompressedSize, nSize, (GetTimeMicros() - nStart) * MILLI);
+}
+
+/** Compress the block files sealed by FindBlockPos, and the undo files of blocks too deep to be disconnected any more. */
+static void CompressSealedBlockFiles()
+{
+    // Reindexing rewrites the block file information and the undo files.
+    if (fImporting || fReindex)
+        return;
+
+    std::vector<std::pair<int, bool>> vFiles;
+    {
+        LOCK2(cs_main, cs_LastBlockFile);
+        for (int nFile = 0; nFile < nLastBlockFile; nFile++) {
+            const CBlockFileInfo& info = vinfoBlockFile[nFile];
+            if (info.nBlocks == 0)
+                continue;
+            vFiles.emplace_back(nFile, false);
+            if (info.nHeightLast + MIN_BLOCKS_TO_KEEP < (unsigned int)std::max(chainActive.Height(), 0))
+                vFiles.emplace_back(nFile, true);
+        }
+    }
+    for (const std::pair<int, bool>& file : vFiles) {
+        boost::this_thread::interruption_point();
+        CompressBlockFile(file.first, file.second);
+    }
+}
+
+void ThreadCompressBlockFiles()
+{
+    RenameThread("earthcoin-compress");
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(g_compress_block_files_mutex);
+            if (!g_compress_block_files_pending)
+                g_compress_block_files_cond.timed_wait(lock, boost::posix_time::seconds(COMPRESS_BLOCK_FILES_INTERVAL));
+            g_compress_block_files_pending = false;
+        }
+        CompressSealedBlockFiles();
+    }
+}
+
 CBlockIndex * CChainState::InsertBlockIndex(const uint256& hash)
 {
     AssertLockHeld(cs_main);
@@ -3882,13 +4557,61 @@ CBlockIndex * CChainState::InsertBlockIndex(const uint256& hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
+    CBlockIndex* pindexNew = m_block_index_arena.Create();
     mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
     return pindexNew;
 }
 
+/** Computes the proof of work of a range of block index entries, storing it in their nChainWork. */
+class CBlockProofCheck
+{
+private:
+    const std::pair<int, CBlockIndex*>* m_begin;
+    const std::pair<int, CBlockIndex*>* m_end;
+
+public:
+    CBlockProofCheck() : m_begin(nullptr), m_end(nullptr) {}
+    CBlockProofCheck(const std::pair<int, CBlockIndex*>* begin, const std::pair<int, CBlockIndex*>* end) : m_begin(begin), m_end(end) {}
+
+    bool operator()() {
+        for (const std::pair<int, CBlockIndex*>* it = m_begin; it != m_end; ++it) {
+            it->second->nChainWork = GetBlockProof(*it->second);
+        }
+        return true;
+    }
+
+    void swap(CBlockProofCheck& check) {
+        std::swap(m_begin, check.m_begin);
+        std::swap(m_end, check.m_end);
+    }
+};
+
+/** Block index entries per CBlockProofCheck. */
+static const size_t BLOCK_PROOF_CHECK_ENTRIES = 4096;
+
+static CCheckQueue<CBlockProofCheck> blockproofcheckqueue(1);
+
+void ThreadBlockProofCheck() {
+    RenameThread("earthcoin-proof");
+    blockproofcheckqueue.Thread();
+}
+
+/**
+ * nChainTx for a BLOCK_ASSUMED_VALID entry that has not been downloaded: the
+ * snapshot's count at its base, and one coinbase per block below it.
+ */
+static unsigned int AssumedValidChainTx(const CBlockIndex* pindex)
+{
+    const MapAssumeutxo& assumeutxo = Params().Assumeutxo();
+    MapAssumeutxo::const_iterator it = assumeutxo.find(pindex->nHeight);
+    if (it != assumeutxo.end() && it->second.blockhash == pindex->GetBlockHash()) {
+        return it->second.nChainTx;
+    }
+    return pindex->pprev->nChainTx + 1;
+}
+
 bool CChainState::LoadBlockIndex(const Consensus::Params& consensus_params, CBlockTreeDB& blocktree)
 {
     if (!blocktree.LoadBlockIndexGuts(consensus_params, [this](const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return this->InsertBlockIndex(hash); }))
@@ -3905,10 +4628,28 @@ bool CChainState::LoadBlockIndex(const Consensus::Params& consensus_params, CBlo
         vSortedByHeight.push_back(std::make_pair(pindex->nHeight, pindex));
     }
     sort(vSortedByHeight.begin(), vSortedByHeight.end());
+
+    // The proof of each block, a 256-bit division, is the costly part; work it out on all
+    // cores first, so the pass below in height order only has to add them up.
+    std::vector<CBlockProofCheck> vChecks;
+    for (size_t i = 0; i < vSortedByHeight.size(); i += BLOCK_PROOF_CHECK_ENTRIES) {
+        const std::pair<int, CBlockIndex*>* begin = vSortedByHeight.data() + i;
+        vChecks.emplace_back(begin, begin + std::min(BLOCK_PROOF_CHECK_ENTRIES, vSortedByHeight.size() - i));
+    }
+    if (nScriptCheckThreads == 0 || vChecks.size() < 2) {
+        for (CBlockProofCheck& check : vChecks)
+            check();
+    } else {
+        CCheckQueueControl<CBlockProofCheck> control(&blockproofcheckqueue);
+        control.Add(vChecks);
+        control.Wait();
+    }
+
     for (const std::pair<int, CBlockIndex*>& item : vSortedByHeight)
     {
         CBlockIndex* pindex = item.second;
-        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
+        if (pindex->pprev)
+            pindex->nChainWork += pindex->pprev->nChainWork;
         pindex->nTimeMax = (pindex->pprev ? std::max(pindex->pprev->nTimeMax, pindex->nTime) : pindex->nTime);
         // We can link the chain of blocks for which we've received transactions at some point.
         // Pruned nodes may have deleted the block.
@@ -3923,6 +4664,8 @@ bool CChainState::LoadBlockIndex(const Consensus::Params& consensus_params, CBlo
             } else {
                 pindex->nChainTx = pindex->nTx;
             }
+        } else if (pindex->nStatus & BLOCK_ASSUMED_VALID) {
+            pindex->nChainTx = AssumedValidChainTx(pindex);
         }
         if (!(pindex->nStatus & BLOCK_FAILED_MASK) && pindex->pprev && (pindex->pprev->nStatus & BLOCK_FAILED_MASK)) {
             pindex->nStatus |= BLOCK_FAILED_CHILD;
@@ -3976,11 +4719,25 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams) EXCLUSIVE_LOCKS_RE
     for (std::set<int>::iterator it = setBlkDataFiles.begin(); it != setBlkDataFiles.end(); it++)
     {
         CDiskBlockPos pos(*it, 0);
-        if (CAutoFile(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION).IsNull()) {
+        if (!fs::exists(GetBlockPosFilename(pos, "blk")) && !fs::exists(GetBlockPosFilename(pos, "blkz"))) {
+            LogPrintf("Unable to open file %s\n", GetBlockPosFilename(pos, "blk").string());
             return false;
         }
     }
 
+    // Pruning counts the space files stored compressed actually take.
+    {
+        LOCK(cs_LastBlockFile);
+        mapCompressedFileSize.clear();
+        for (int nFile = 0; nFile < (int)vinfoBlockFile.size(); nFile++) {
+            for (bool fUndo : {false, true}) {
+                const fs::path path = GetBlockPosFilename(CDiskBlockPos(nFile, 0), fUndo ? "revz" : "blkz");
+                if (fs::exists(path))
+                    mapCompressedFileSize[std::make_pair(nFile, fUndo)] = fs::file_size(path);
+            }
+        }
+    }
+
     // Check whether we have ever pruned block & undo files
     pblocktree->ReadFlag("prunedblockfiles", fHavePruned);
     if (fHavePruned)
@@ -4071,6 +4828,12 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
             LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
             break;
         }
+        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_UNDO)) {
+            // Blocks up to the base of a loaded UTXO snapshot were only checked
+            // against the background chainstate, so they have no undo data.
+            LogPrintf("VerifyDB(): block verification stopping at height %d (no undo data)\n", pindex->nHeight);
+            break;
+        }
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
@@ -4332,6 +5095,8 @@ bool RewindBlockIndex(const CChainParams& params) {
 }
 
 void CChainState::UnloadBlockIndex() {
+    mapBlockIndex.clear();
+    m_block_index_arena.Clear();
     nBlockSequenceId = 1;
     m_failed_blocks.clear();
     setBlockIndexCandidates.clear();
@@ -4349,6 +5114,11 @@ void UnloadBlockIndex()
     mempool.clear();
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
+    mapCompressedFileSize.clear();
+    // The next block index loaded may be of other files under the same numbers.
+    g_block_file_maps.Clear();
+    g_compressed_block_maps.Clear();
+    g_compressed_undo_maps.Clear();
     nLastBlockFile = 0;
     setDirtyBlockIndex.clear();
     setDirtyFileInfo.clear();
@@ -4357,15 +5127,43 @@ void UnloadBlockIndex()
         warningcache[b].clear();
     }
 
-    for (BlockMap::value_type& entry : mapBlockIndex) {
-        delete entry.second;
-    }
-    mapBlockIndex.clear();
     fHavePruned = false;
 
     g_chainstate.UnloadBlockIndex();
 }
 
+CBlockIndex* InsertBlockIndex(const uint256& hash)
+{
+    return g_chainstate.InsertBlockIndex(hash);
+}
+
+bool WriteBlockIndexSnapshot()
+{
+    LOCK(cs_main);
+    if (!pblocktree || mapBlockIndex.empty())
+        return false;
+    // The snapshot has to match the database.
+    if (!setDirtyBlockIndex.empty())
+        return error("%s: the block index is not fully written to disk", __func__);
+
+    int64_t nStart = GetTimeMillis();
+    // In height order, so that loading places each entry after its parent.
+    std::vector<std::pair<int, const CBlockIndex*>> vSortedByHeight;
+    vSortedByHeight.reserve(mapBlockIndex.size());
+    for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex)
+        vSortedByHeight.emplace_back(item.second->nHeight, item.second);
+    std::sort(vSortedByHeight.begin(), vSortedByHeight.end());
+    std::vector<const CBlockIndex*> entries;
+    entries.reserve(vSortedByHeight.size());
+    for (const std::pair<int, const CBlockIndex*>& item : vSortedByHeight)
+        entries.push_back(item.second);
+
+    if (!pblocktree->WriteBlockIndexSnapshot(entries))
+        return false;
+    LogPrintf("Wrote a snapshot of %u block index entries in %dms\n", entries.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
 bool LoadBlockIndex(const CChainParams& chainparams)
 {
     // Load block index from databases
@@ -4418,33 +5216,228 @@ bool LoadGenesisBlock(const CChainParams& chainparams)
     return g_chainstate.LoadGenesisBlock(chainparams);
 }
 
-bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
+void CChainState::LoadSnapshotChain(CBlockIndex* pindexBase, const Consensus::Params& consensus_params)
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+    AssertLockHeld(cs_main);
 
-    int nLoaded = 0;
-    try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
+    // Blocks up to the base are taken as valid until the background
+    // validation gets to them; their transactions are not known yet.
+    std::vector<CBlockIndex*> vChain;
+    for (CBlockIndex* pindex = pindexBase; pindex; pindex = pindex->pprev) {
+        vChain.push_back(pindex);
+    }
+    for (CBlockIndex* pindex : reverse_iterate(vChain)) {
+        if (pindex->nStatus & BLOCK_HAVE_DATA) {
+            pindex->nChainTx = (pindex->pprev ? pindex->pprev->nChainTx : 0) + pindex->nTx;
+        } else {
+            pindex->nStatus |= BLOCK_ASSUMED_VALID;
+            pindex->nChainTx = AssumedValidChainTx(pindex);
+        }
+        if (IsWitnessEnabled(pindex->pprev, consensus_params)) {
+            pindex->nStatus |= BLOCK_OPT_WITNESS;
+        }
+        pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+        setDirtyBlockIndex.insert(pindex);
+    }
+    setBlockIndexCandidates.insert(pindexBase);
+}
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> buf;
-                if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
-                    continue;
-                // read size
+
+/** A block read by LoadExternalBlockFile, with where it is stored (null if it is not on disk yet). */
+struct ImportedBlock
+{
+    std::shared_ptr<CBlock> block;
+    CDiskBlockPos pos;
+    unsigned int size;
+};
+
+/** Context-free checks of an imported block, including the proof of work, ahead of AcceptBlock. */
+class CBlockImportCheck
+{
+private:
+    std::shared_ptr<CBlock> m_block;
+    const Consensus::Params* m_params;
+
+public:
+    CBlockImportCheck() : m_params(nullptr) {}
+    CBlockImportCheck(const std::shared_ptr<CBlock>& block, const Consensus::Params& params) : m_block(block), m_params(&params) {}
+
+    bool operator()() {
+        // On success this sets fChecked, which lets AcceptBlock skip these checks. Failures are
+        // left to AcceptBlock to find again and report.
+        CValidationState state;
+        CheckBlock(*m_block, state, *m_params);
+        return true;
+    }
+
+    void swap(CBlockImportCheck& check) {
+        m_block.swap(check.m_block);
+        std::swap(m_params, check.m_params);
+    }
+};
+
+static CCheckQueue<CBlockImportCheck> blockimportcheckqueue(1);
+
+void ThreadBlockImportCheck() {
+    RenameThread("earthcoin-impchk");
+    blockimportcheckqueue.Thread();
+}
+
+/** Blocks LoadExternalBlockFile reads before handing them to the check threads. */
+static const size_t IMPORT_BATCH_BLOCKS = 256;
+/** Memory for blocks with unknown parent; beyond it only their disk positions are kept. */
+static const size_t MAX_UNKNOWN_PARENT_MEMORY = 64 << 20;
+
+/** Blocks with unknown parent, by parent hash. Kept across block files, for reindex. */
+static std::multimap<uint256, ImportedBlock> mapBlocksUnknownParent;
+static size_t nUnknownParentMemory = 0;
+
+/** Hand an imported block to AcceptBlock, or keep it for later if its parent is not known yet. Returns false on a fatal error. */
+static bool AcceptImportedBlock(const CChainParams& chainparams, ImportedBlock& imported, int& nLoaded)
+{
+    const uint256 hash = imported.block->GetHash();
+    {
+        LOCK(cs_main);
+        // detect out of order blocks, and store them for later
+        if (hash != chainparams.GetConsensus().hashGenesisBlock && !LookupBlockIndex(imported.block->hashPrevBlock)) {
+            LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                    imported.block->hashPrevBlock.ToString());
+            if (nUnknownParentMemory + imported.size <= MAX_UNKNOWN_PARENT_MEMORY) {
+                nUnknownParentMemory += imported.size;
+                mapBlocksUnknownParent.emplace(imported.block->hashPrevBlock, imported);
+            } else if (!imported.pos.IsNull()) {
+                mapBlocksUnknownParent.emplace(imported.block->hashPrevBlock, ImportedBlock{nullptr, imported.pos, 0});
+            }
+            return true;
+        }
+
+        // process in case the block isn't known yet
+        CBlockIndex* pindex = LookupBlockIndex(hash);
+        if (!pindex || (pindex->nStatus & BLOCK_HAVE_DATA) == 0) {
+          CValidationState state;
+          if (g_chainstate.AcceptBlock(imported.block, state, chainparams, nullptr, true, imported.pos.IsNull() ? nullptr : &imported.pos, nullptr)) {
+              nLoaded++;
+          }
+          if (state.IsError()) {
+              return false;
+          }
+        } else if (hash != chainparams.GetConsensus().hashGenesisBlock && pindex->nHeight % 1000 == 0) {
+          LogPrint(BCLog::REINDEX, "Block Import: already had block %s at height %d\n", hash.ToString(), pindex->nHeight);
+        }
+    }
+
+    // Activate the genesis block so normal node progress can continue
+    if (hash == chainparams.GetConsensus().hashGenesisBlock) {
+        CValidationState state;
+        if (!ActivateBestChain(state, chainparams)) {
+            return false;
+        }
+    }
+
+    NotifyHeaderTip();
+
+    // Recursively process earlier encountered successors of this block
+    std::deque<uint256> queue;
+    queue.push_back(hash);
+    while (!queue.empty()) {
+        uint256 head = queue.front();
+        queue.pop_front();
+        std::pair<std::multimap<uint256, ImportedBlock>::iterator, std::multimap<uint256, ImportedBlock>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+        while (range.first != range.second) {
+            std::multimap<uint256, ImportedBlock>::iterator it = range.first;
+            std::shared_ptr<CBlock> pblockrecursive = it->second.block;
+            if (!pblockrecursive) {
+                pblockrecursive = std::make_shared<CBlock>();
+                // AcceptBlock checks the proof of work, no need to do it twice
+                if (!ReadBlockFromDisk(*pblockrecursive, it->second.pos, chainparams.GetConsensus(), false))
+                    pblockrecursive.reset();
+            }
+            if (pblockrecursive)
+            {
+                LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
+                        head.ToString());
+                LOCK(cs_main);
+                CValidationState dummy;
+                if (g_chainstate.AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, it->second.pos.IsNull() ? nullptr : &it->second.pos, nullptr))
+                {
+                    nLoaded++;
+                    queue.push_back(pblockrecursive->GetHash());
+                }
+            }
+            range.first++;
+            nUnknownParentMemory -= it->second.size;
+            mapBlocksUnknownParent.erase(it);
+            NotifyHeaderTip();
+        }
+    }
+    return true;
+}
+
+/**
+ * Blocks are imported in a pipeline: this thread reads and deserializes a
+ * batch of blocks while the check threads verify the proof of work, merkle
+ * root and other context-free rules of the previous batch, and accepts the
+ * batch before that, in file order. Reading stays on one thread, as
+ * resynchronizing after a corrupt block depends on where its deserialization
+ * stopped.
+ */
+bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
+{
+    int64_t nStart = GetTimeMillis();
+
+    int nLoaded = 0;
+    try {
+        // Blocks being read, being checked, and checked and waiting to be accepted
+        std::vector<ImportedBlock> vRead, vChecking, vChecked;
+        std::unique_ptr<CCheckQueueControl<CBlockImportCheck>> control;
+        // Move the blocks one stage down the pipeline; returns false on a fatal error.
+        auto advance = [&]() {
+            if (control) {
+                control->Wait();
+                control.reset();
+            }
+            vChecked.swap(vChecking);
+            vChecking.swap(vRead);
+            vRead.clear();
+            if (!vChecking.empty() && nScriptCheckThreads) {
+                std::vector<CBlockImportCheck> vChecks;
+                vChecks.reserve(vChecking.size());
+                for (const ImportedBlock& imported : vChecking) {
+                    vChecks.emplace_back(imported.block, chainparams.GetConsensus());
+                }
+                control.reset(new CCheckQueueControl<CBlockImportCheck>(&blockimportcheckqueue));
+                control->Add(vChecks);
+            }
+            for (ImportedBlock& imported : vChecked) {
+                boost::this_thread::interruption_point();
+                if (!AcceptImportedBlock(chainparams, imported, nLoaded)) {
+                    return false;
+                }
+            }
+            vChecked.clear();
+            return true;
+        };
+
+        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
+        uint64_t nRewind = blkdat.GetPos();
+        bool fFailed = false;
+        while (!blkdat.eof()) {
+            boost::this_thread::interruption_point();
+
+            blkdat.SetPos(nRewind);
+            nRewind++; // start one byte further next time, in case of failure
+            blkdat.SetLimit(); // remove former limit
+            unsigned int nSize = 0;
+            try {
+                // locate a header
+                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+                blkdat.FindByte(chainparams.MessageStart()[0]);
+                nRewind = blkdat.GetPos()+1;
+                blkdat >> buf;
+                if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
+                    continue;
+                // read size
                 blkdat >> nSize;
                 if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
                     continue;
@@ -4455,82 +5448,29 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
             try {
                 // read block
                 uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
+                CDiskBlockPos pos;
+                if (dbp) {
+                    pos = *dbp;
+                    pos.nPos = nBlockPos;
+                }
                 blkdat.SetLimit(nBlockPos + nSize);
                 blkdat.SetPos(nBlockPos);
                 std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
-                CBlock& block = *pblock;
-                blkdat >> block;
+                blkdat >> *pblock;
                 nRewind = blkdat.GetPos();
-
-                uint256 hash = block.GetHash();
-                {
-                    LOCK(cs_main);
-                    // detect out of order blocks, and store them for later
-                    if (hash != chainparams.GetConsensus().hashGenesisBlock && !LookupBlockIndex(block.hashPrevBlock)) {
-                        LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                                block.hashPrevBlock.ToString());
-                        if (dbp)
-                            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                        continue;
-                    }
-
-                    // process in case the block isn't known yet
-                    CBlockIndex* pindex = LookupBlockIndex(hash);
-                    if (!pindex || (pindex->nStatus & BLOCK_HAVE_DATA) == 0) {
-                      CValidationState state;
-                      if (g_chainstate.AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr)) {
-                          nLoaded++;
-                      }
-                      if (state.IsError()) {
-                          break;
-                      }
-                    } else if (hash != chainparams.GetConsensus().hashGenesisBlock && pindex->nHeight % 1000 == 0) {
-                      LogPrint(BCLog::REINDEX, "Block Import: already had block %s at height %d\n", hash.ToString(), pindex->nHeight);
-                    }
-                }
-
-                // Activate the genesis block so normal node progress can continue
-                if (hash == chainparams.GetConsensus().hashGenesisBlock) {
-                    CValidationState state;
-                    if (!ActivateBestChain(state, chainparams)) {
-                        break;
-                    }
-                }
-
-                NotifyHeaderTip();
-
-                // Recursively process earlier encountered successors of this block
-                std::deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
-                        if (ReadBlockFromDisk(*pblockrecursive, it->second, chainparams.GetConsensus()))
-                        {
-                            LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
-                                    head.ToString());
-                            LOCK(cs_main);
-                            CValidationState dummy;
-                            if (g_chainstate.AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second, nullptr))
-                            {
-                                nLoaded++;
-                                queue.push_back(pblockrecursive->GetHash());
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                        NotifyHeaderTip();
-                    }
-                }
+                vRead.push_back(ImportedBlock{pblock, pos, nSize});
             } catch (const std::exception& e) {
                 LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
+
+            if (vRead.size() >= IMPORT_BATCH_BLOCKS && !advance()) {
+                fFailed = true;
+                break;
+            }
+        }
+        // Drain the pipeline.
+        while (!fFailed && (!vRead.empty() || !vChecking.empty())) {
+            fFailed = !advance();
         }
     } catch (const std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
@@ -4576,7 +5516,7 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
     int nHeight = 0;
     CBlockIndex* pindexFirstInvalid = nullptr; // Oldest ancestor of pindex which is invalid.
     CBlockIndex* pindexFirstMissing = nullptr; // Oldest ancestor of pindex which does not have BLOCK_HAVE_DATA.
-    CBlockIndex* pindexFirstNeverProcessed = nullptr; // Oldest ancestor of pindex for which nTx == 0.
+    CBlockIndex* pindexFirstNeverProcessed = nullptr; // Oldest ancestor of pindex for which nTx == 0 (and that is not assumed valid).
     CBlockIndex* pindexFirstNotTreeValid = nullptr; // Oldest ancestor of pindex which does not have BLOCK_VALID_TREE (regardless of being valid or not).
     CBlockIndex* pindexFirstNotTransactionsValid = nullptr; // Oldest ancestor of pindex which does not have BLOCK_VALID_TRANSACTIONS (regardless of being valid or not).
     CBlockIndex* pindexFirstNotChainValid = nullptr; // Oldest ancestor of pindex which does not have BLOCK_VALID_CHAIN (regardless of being valid or not).
@@ -4585,7 +5525,7 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
         nNodes++;
         if (pindexFirstInvalid == nullptr && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
         if (pindexFirstMissing == nullptr && !(pindex->nStatus & BLOCK_HAVE_DATA)) pindexFirstMissing = pindex;
-        if (pindexFirstNeverProcessed == nullptr && pindex->nTx == 0) pindexFirstNeverProcessed = pindex;
+        if (pindexFirstNeverProcessed == nullptr && pindex->nTx == 0 && !(pindex->nStatus & BLOCK_ASSUMED_VALID)) pindexFirstNeverProcessed = pindex;
         if (pindex->pprev != nullptr && pindexFirstNotTreeValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TREE) pindexFirstNotTreeValid = pindex;
         if (pindex->pprev != nullptr && pindexFirstNotTransactionsValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TRANSACTIONS) pindexFirstNotTransactionsValid = pindex;
         if (pindex->pprev != nullptr && pindexFirstNotChainValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
@@ -4609,7 +5549,7 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
             if (pindex->nStatus & BLOCK_HAVE_DATA) assert(pindex->nTx > 0);
         }
         if (pindex->nStatus & BLOCK_HAVE_UNDO) assert(pindex->nStatus & BLOCK_HAVE_DATA);
-        assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0)); // This is pruning-independent.
+        assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0 || (pindex->nStatus & BLOCK_ASSUMED_VALID))); // This is pruning-independent.
         // All parents having had data (at some point) is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
         assert((pindexFirstNeverProcessed != nullptr) == (pindex->nChainTx == 0)); // nChainTx != 0 is used to signal that all parent blocks have been processed (but may have been pruned).
         assert((pindexFirstNotTransactionsValid != nullptr) == (pindex->nChainTx == 0));
@@ -4754,7 +5694,17 @@ int VersionBitsTipStateSinceHeight(const Consensus::Params& params, Consensus::D
     return VersionBitsStateSinceHeight(chainActive.Tip(), params, pos, versionbitscache);
 }
 
-static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+/** mempool.dat of a single list of transactions, in an order that puts parents first */
+static const uint64_t MEMPOOL_DUMP_VERSION_UNBATCHED = 1;
+/**
+ * mempool.dat of transactions in batches, none of which spends another from
+ * the same batch or a later one: after the version and the total number of
+ * transactions, each batch is its size followed by its transactions, and a
+ * batch of size 0 ends the list.
+ */
+static const uint64_t MEMPOOL_DUMP_VERSION = 2;
+/** Transactions checked in parallel at a time while loading mempool.dat */
+static const size_t MEMPOOL_LOAD_BATCH = 1000;
 
 bool LoadMempool(void)
 {
@@ -4776,48 +5726,86 @@ bool LoadMempool(void)
     try {
         uint64_t version;
         file >> version;
-        if (version != MEMPOOL_DUMP_VERSION) {
+        if (version != MEMPOOL_DUMP_VERSION && version != MEMPOOL_DUMP_VERSION_UNBATCHED) {
             return false;
         }
         uint64_t num;
         file >> num;
-        while (num--) {
-            CTransactionRef tx;
-            int64_t nTime;
-            int64_t nFeeDelta;
-            file >> tx;
-            file >> nTime;
-            file >> nFeeDelta;
-
-            CAmount amountdelta = nFeeDelta;
-            if (amountdelta) {
-                mempool.PrioritiseTransaction(tx->GetHash(), amountdelta);
+
+        uiInterface.ShowProgress(_("Loading mempool..."), 0, false);
+        uint64_t done = 0;
+        int nLastProgress = 0;
+        std::vector<TxMempoolInfo> vinfo;
+        std::vector<CTransactionRef> vtx;
+        while (true) {
+            // The unbatched format lists parents before children, so it is read as one batch
+            // checked MEMPOOL_LOAD_BATCH at a time; children whose parents are in the same
+            // chunk are only checked by AcceptToMemoryPool.
+            uint64_t batch_size = num - done;
+            if (version == MEMPOOL_DUMP_VERSION) {
+                file >> batch_size;
             }
-            CValidationState state;
-            if (nTime + nExpiryTimeout > nNow) {
-                LOCK(cs_main);
-                AcceptToMemoryPoolWithTime(chainparams, mempool, state, tx, nullptr /* pfMissingInputs */, nTime,
-                                           nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */,
-                                           false /* test_accept */);
-                if (state.IsValid()) {
-                    ++count;
-                } else {
-                    // mempool may contain the transaction already, e.g. from
-                    // wallet(s) having loaded it while we were processing
-                    // mempool transactions; consider these as valid, instead of
-                    // failed, but mark them as 'already there'
-                    if (mempool.exists(tx->GetHash())) {
-                        ++already_there;
+            if (batch_size == 0) break;
+
+            while (batch_size) {
+                const size_t chunk = std::min<uint64_t>(batch_size, MEMPOOL_LOAD_BATCH);
+                batch_size -= chunk;
+                vinfo.resize(chunk);
+                vtx.clear();
+                for (TxMempoolInfo& info : vinfo) {
+                    file >> info.tx;
+                    file >> info.nTime;
+                    file >> info.nFeeDelta;
+                    if (info.nTime + nExpiryTimeout > nNow) vtx.push_back(info.tx);
+                }
+                PreValidateTransactions(mempool, vtx);
+
+                for (const TxMempoolInfo& info : vinfo) {
+                    CAmount amountdelta = info.nFeeDelta;
+                    if (amountdelta) {
+                        mempool.PrioritiseTransaction(info.tx->GetHash(), amountdelta);
+                    }
+                    CValidationState state;
+                    if (info.nTime + nExpiryTimeout > nNow) {
+                        LOCK(cs_main);
+                        AcceptToMemoryPoolWithTime(chainparams, mempool, state, info.tx, nullptr /* pfMissingInputs */, info.nTime,
+                                                   nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */,
+                                                   false /* test_accept */);
+                        if (state.IsValid()) {
+                            ++count;
+                        } else {
+                            // mempool may contain the transaction already, e.g. from
+                            // wallet(s) having loaded it while we were processing
+                            // mempool transactions; consider these as valid, instead of
+                            // failed, but mark them as 'already there'
+                            if (mempool.exists(info.tx->GetHash())) {
+                                ++already_there;
+                            } else {
+                                ++failed;
+                            }
+                        }
                     } else {
-                        ++failed;
+                        ++expired;
                     }
                 }
-            } else {
-                ++expired;
+
+                done += chunk;
+                const int nProgress = std::min<uint64_t>(99, done * 100 / std::max<uint64_t>(num, 1));
+                if (nProgress / 10 > nLastProgress / 10) {
+                    LogPrintf("[%d%%]...mempool transactions %u/%u\n", nProgress, done, num);
+                }
+                if (nProgress > nLastProgress) {
+                    uiInterface.ShowProgress(_("Loading mempool..."), nProgress, false);
+                    nLastProgress = nProgress;
+                }
+                if (ShutdownRequested()) {
+                    uiInterface.ShowProgress("", 100, false);
+                    return false;
+                }
             }
-            if (ShutdownRequested())
-                return false;
         }
+        uiInterface.ShowProgress("", 100, false);
+
         std::map<uint256, CAmount> mapDeltas;
         file >> mapDeltas;
 
@@ -4825,6 +5813,7 @@ bool LoadMempool(void)
             mempool.PrioritiseTransaction(i.first, i.second);
         }
     } catch (const std::exception& e) {
+        uiInterface.ShowProgress("", 100, false);
         LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
         return false;
     }
@@ -4838,18 +5827,29 @@ bool DumpMempool(void)
     int64_t start = GetTimeMicros();
 
     std::map<uint256, CAmount> mapDeltas;
-    std::vector<TxMempoolInfo> vinfo;
+    // Transactions with the number of their in-mempool ancestors, which is
+    // larger than that of any of their parents.
+    std::vector<std::pair<uint64_t, TxMempoolInfo>> vinfo;
 
     {
         LOCK(mempool.cs);
         for (const auto &i : mempool.mapDeltas) {
             mapDeltas[i.first] = i.second;
         }
-        vinfo = mempool.infoAll();
+        vinfo.reserve(mempool.mapTx.size());
+        for (const CTxMemPoolEntry& e : mempool.mapTx) {
+            vinfo.emplace_back(e.GetCountWithAncestors(),
+                TxMempoolInfo{e.GetSharedTx(), e.GetTime(), CFeeRate(e.GetFee(), e.GetTxSize()), e.GetModifiedFee() - e.GetFee()});
+        }
     }
 
     int64_t mid = GetTimeMicros();
 
+    // Transactions with as many ancestors go in one batch.
+    std::stable_sort(vinfo.begin(), vinfo.end(), [](const std::pair<uint64_t, TxMempoolInfo>& a, const std::pair<uint64_t, TxMempoolInfo>& b) {
+        return a.first < b.first;
+    });
+
     try {
         FILE* filestr = fsbridge::fopen(GetDataDir() / "mempool.dat.new", "wb");
         if (!filestr) {
@@ -4862,12 +5862,19 @@ bool DumpMempool(void)
         file << version;
 
         file << (uint64_t)vinfo.size();
-        for (const auto& i : vinfo) {
-            file << *(i.tx);
-            file << (int64_t)i.nTime;
-            file << (int64_t)i.nFeeDelta;
-            mapDeltas.erase(i.tx->GetHash());
+        for (auto batch = vinfo.begin(); batch != vinfo.end();) {
+            auto batch_end = batch;
+            while (batch_end != vinfo.end() && batch_end->first == batch->first) ++batch_end;
+            file << (uint64_t)(batch_end - batch);
+            for (; batch != batch_end; ++batch) {
+                const TxMempoolInfo& i = batch->second;
+                file << *(i.tx);
+                file << (int64_t)i.nTime;
+                file << (int64_t)i.nFeeDelta;
+                mapDeltas.erase(i.tx->GetHash());
+            }
         }
+        file << (uint64_t)0;
 
         file << mapDeltas;
         if (!FileCommit(file.Get()))
@@ -4883,6 +5890,487 @@ bool DumpMempool(void)
     return true;
 }
 
+static const uint16_t UTXO_SNAPSHOT_VERSION = 1;
+static const unsigned char UTXO_SNAPSHOT_MAGIC[5] = {'u', 't', 'x', 'o', 0xff};
+/** Coins written to the chainstate per LevelDB batch while loading a snapshot */
+static const size_t UTXO_SNAPSHOT_LOAD_BATCH = 100000;
+
+/**
+ * Fixed-size header of a UTXO set snapshot. It is followed by the headers of
+ * blocks 1 up to the base block, then by the coins grouped per transaction in
+ * chainstate key order: txid, VARINT(count), count x (VARINT(n), Coin).
+ * coins_hash commits to that coin section byte for byte.
+ */
+struct SnapshotMetadata
+{
+    unsigned char magic[5];
+    uint16_t version;
+    CMessageHeader::MessageStartChars message_start;
+    uint256 base_blockhash;
+    int32_t base_height;
+    uint64_t chain_tx;
+    uint64_t coins_count;
+    uint256 coins_hash;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(magic);
+        READWRITE(version);
+        READWRITE(message_start);
+        READWRITE(base_blockhash);
+        READWRITE(base_height);
+        READWRITE(chain_tx);
+        READWRITE(coins_count);
+        READWRITE(coins_hash);
+    }
+};
+
+/**
+ * Serialize the coins under the cursor as the coin section of a snapshot,
+ * hashing them and, if file is not null, writing them to it.
+ */
+static bool WriteSnapshotCoins(CCoinsViewCursor& cursor, CAutoFile* file, uint256& coins_hash, uint64_t& coins_count)
+{
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    CDataStream entry(SER_DISK, CLIENT_VERSION);
+    uint256 prevkey;
+    std::vector<std::pair<uint32_t, Coin>> outputs;
+    coins_count = 0;
+    auto write_outputs = [&]() {
+        entry << prevkey << VARINT((uint64_t)outputs.size());
+        for (const std::pair<uint32_t, Coin>& output : outputs) {
+            entry << VARINT(output.first) << output.second;
+        }
+        if (file) {
+            file->write(entry.data(), entry.size());
+        }
+        ss.write(entry.data(), entry.size());
+        entry.clear();
+        coins_count += outputs.size();
+        outputs.clear();
+    };
+    while (cursor.Valid()) {
+        if (ShutdownRequested()) {
+            return error("%s: interrupted by shutdown", __func__);
+        }
+        COutPoint key;
+        Coin coin;
+        if (!cursor.GetKey(key) || !cursor.GetValue(coin)) {
+            return error("%s: unable to read coin", __func__);
+        }
+        if (!outputs.empty() && key.hash != prevkey) {
+            write_outputs();
+        }
+        prevkey = key.hash;
+        outputs.emplace_back(key.n, std::move(coin));
+        cursor.Next();
+    }
+    if (!outputs.empty()) {
+        write_outputs();
+    }
+    coins_hash = ss.GetHash();
+    return true;
+}
+
+bool DumpUTXOSnapshot(const fs::path& path, UTXOSnapshotInfo& info)
+{
+    int64_t start = GetTimeMicros();
+
+    // The LevelDB iterator behind the cursor reads a consistent snapshot, so
+    // only taking it needs cs_main; the chain may move on while we write.
+    std::unique_ptr<CCoinsViewCursor> pcursor;
+    const CBlockIndex* pindexBase;
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+        pcursor.reset(pcoinsdbview->Cursor());
+        pindexBase = LookupBlockIndex(pcursor->GetBestBlock());
+    }
+    if (!pindexBase) {
+        return error("%s: chainstate best block is not in the block index", __func__);
+    }
+
+    fs::path temppath = path;
+    temppath += ".incomplete";
+    try {
+        FILE* filestr = fsbridge::fopen(temppath, "wb");
+        if (!filestr) {
+            return error("%s: unable to open %s", __func__, temppath.string());
+        }
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        SnapshotMetadata metadata;
+        memcpy(metadata.magic, UTXO_SNAPSHOT_MAGIC, sizeof(metadata.magic));
+        metadata.version = UTXO_SNAPSHOT_VERSION;
+        memcpy(metadata.message_start, Params().MessageStart(), sizeof(metadata.message_start));
+        metadata.base_blockhash = pindexBase->GetBlockHash();
+        metadata.base_height = pindexBase->nHeight;
+        metadata.chain_tx = pindexBase->nChainTx;
+        metadata.coins_count = 0;
+        // Placeholder, rewritten once the coins have been counted and hashed.
+        file << metadata;
+
+        for (int nHeight = 1; nHeight <= pindexBase->nHeight; nHeight++) {
+            file << pindexBase->GetAncestor(nHeight)->GetBlockHeader();
+        }
+
+        if (!WriteSnapshotCoins(*pcursor, &file, metadata.coins_hash, metadata.coins_count)) {
+            return false;
+        }
+
+        if (fseek(file.Get(), 0, SEEK_SET) != 0) {
+            throw std::runtime_error("fseek failed");
+        }
+        file << metadata;
+        if (!FileCommit(file.Get()))
+            throw std::runtime_error("FileCommit failed");
+        file.fclose();
+        if (!RenameOver(temppath, path))
+            throw std::runtime_error("rename failed");
+
+        info.base_blockhash = metadata.base_blockhash;
+        info.base_height = metadata.base_height;
+        info.coins_count = metadata.coins_count;
+        info.coins_hash = metadata.coins_hash;
+    } catch (const std::exception& e) {
+        return error("%s: failed to write %s: %s", __func__, temppath.string(), e.what());
+    }
+    LogPrintf("Dumped UTXO snapshot at height %d (%u coins) to %s in %.2fs\n",
+        info.base_height, info.coins_count, path.string(), (GetTimeMicros() - start) * MICRO);
+    return true;
+}
+
+bool LoadUTXOSnapshot(const fs::path& path, CCoinsViewDB& coinsview, const CChainParams& chainparams)
+{
+    int64_t start = GetTimeMicros();
+
+    FILE* filestr = fsbridge::fopen(path, "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        return error("%s: unable to open %s", __func__, path.string());
+    }
+
+    try {
+        SnapshotMetadata metadata;
+        file >> metadata;
+        if (memcmp(metadata.magic, UTXO_SNAPSHOT_MAGIC, sizeof(metadata.magic)) != 0 || metadata.version != UTXO_SNAPSHOT_VERSION) {
+            return error("%s: %s is not a UTXO snapshot this version can read", __func__, path.string());
+        }
+        if (memcmp(metadata.message_start, chainparams.MessageStart(), sizeof(metadata.message_start)) != 0) {
+            return error("%s: snapshot was taken on a different network", __func__);
+        }
+        // Only snapshots this version knows the contents of are trusted.
+        const MapAssumeutxo& assumeutxo = chainparams.Assumeutxo();
+        MapAssumeutxo::const_iterator it = assumeutxo.find(metadata.base_height);
+        if (it == assumeutxo.end() || it->second.blockhash != metadata.base_blockhash ||
+            it->second.coins_hash != metadata.coins_hash || it->second.nChainTx != metadata.chain_tx) {
+            return error("%s: snapshot of block %s at height %d is not a known snapshot", __func__, metadata.base_blockhash.ToString(), metadata.base_height);
+        }
+        LogPrintf("Loading UTXO snapshot of block %s at height %d (%u coins)\n",
+            metadata.base_blockhash.ToString(), metadata.base_height, metadata.coins_count);
+
+        // The headers up to the base block go through the same checks as headers from a peer,
+        // with the chainstate at the genesis block as it is before any block is connected.
+        {
+            LOCK(cs_main);
+            if (!chainActive.Tip()) {
+                chainActive.SetTip(LookupBlockIndex(chainparams.GetConsensus().hashGenesisBlock));
+            }
+        }
+        std::vector<CBlockHeader> headers;
+        headers.reserve(MAX_HEADERS_RESULTS);
+        int nLastProgress = 0;
+        for (int nHeight = 1; nHeight <= metadata.base_height; nHeight++) {
+            headers.emplace_back();
+            file >> headers.back();
+            if (headers.size() == MAX_HEADERS_RESULTS || nHeight == metadata.base_height) {
+                CValidationState state;
+                if (!ProcessNewBlockHeaders(headers, state, chainparams)) {
+                    return error("%s: invalid header in snapshot: %s", __func__, FormatStateMessage(state));
+                }
+                headers.clear();
+                if (ShutdownRequested()) {
+                    return false;
+                }
+                int nProgress = nHeight * 10 / metadata.base_height;
+                if (nProgress > nLastProgress) {
+                    LogPrintf("[%d%%]...headers %d/%d\n", nProgress * 10, nHeight, metadata.base_height);
+                    nLastProgress = nProgress;
+                }
+            }
+        }
+
+        CBlockIndex* pindexBase;
+        {
+            LOCK(cs_main);
+            pindexBase = LookupBlockIndex(metadata.base_blockhash);
+        }
+        if (!pindexBase || pindexBase->nHeight != metadata.base_height) {
+            return error("%s: snapshot headers do not lead to its base block", __func__);
+        }
+
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        std::vector<std::pair<COutPoint, Coin>> batch;
+        batch.reserve(UTXO_SNAPSHOT_LOAD_BATCH);
+        uint64_t nCoins = 0;
+        nLastProgress = 0;
+        while (nCoins < metadata.coins_count) {
+            uint256 txid;
+            uint64_t nOutputs;
+            file >> txid >> VARINT(nOutputs);
+            if (nOutputs == 0 || nOutputs > metadata.coins_count - nCoins) {
+                return error("%s: snapshot coin count is inconsistent", __func__);
+            }
+            ss << txid << VARINT(nOutputs);
+            for (uint64_t i = 0; i < nOutputs; i++) {
+                uint32_t n;
+                Coin coin;
+                file >> VARINT(n) >> coin;
+                if (coin.IsSpent() || coin.nHeight > (uint32_t)metadata.base_height) {
+                    return error("%s: snapshot holds a coin that cannot exist at its base block", __func__);
+                }
+                ss << VARINT(n) << coin;
+                batch.emplace_back(COutPoint(txid, n), std::move(coin));
+            }
+            nCoins += nOutputs;
+            if (batch.size() >= UTXO_SNAPSHOT_LOAD_BATCH || nCoins == metadata.coins_count) {
+                if (!coinsview.WriteCoins(batch)) {
+                    return error("%s: failed to write coins", __func__);
+                }
+                batch.clear();
+                if (ShutdownRequested()) {
+                    return false;
+                }
+                int nProgress = nCoins * 10 / metadata.coins_count;
+                if (nProgress > nLastProgress) {
+                    LogPrintf("[%d%%]...coins %u/%u\n", nProgress * 10, nCoins, metadata.coins_count);
+                    nLastProgress = nProgress;
+                }
+            }
+        }
+        if (ss.GetHash() != it->second.coins_hash) {
+            return error("%s: coins do not match the snapshot hash %s", __func__, it->second.coins_hash.ToString());
+        }
+
+        {
+            LOCK(cs_main);
+            // Whatever a previous snapshot left behind is of no use to this one.
+            fs::remove_all(SnapshotValidationDir());
+            g_chainstate.LoadSnapshotChain(pindexBase, chainparams.GetConsensus());
+
+            FlushBlockFile();
+            std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
+            for (int nFile : setDirtyFileInfo) {
+                vFiles.push_back(std::make_pair(nFile, &vinfoBlockFile[nFile]));
+            }
+            setDirtyFileInfo.clear();
+            std::vector<const CBlockIndex*> vBlocks(setDirtyBlockIndex.begin(), setDirtyBlockIndex.end());
+            setDirtyBlockIndex.clear();
+            if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks) || !pblocktree->WriteFlag("prunedblockfiles", true) ||
+                !pblocktree->WriteSnapshotBase(pindexBase->GetBlockHash())) {
+                return error("%s: failed to write to block index database", __func__);
+            }
+            fHavePruned = true;
+        }
+
+        // Only now mark the chainstate as consistent with the base block, and
+        // wait for that to be on disk if it is written in the background.
+        CCoinsMap mapCoins;
+        if (!coinsview.BatchWrite(mapCoins, metadata.base_blockhash) || !coinsview.Sync()) {
+            return error("%s: failed to write best block", __func__);
+        }
+    } catch (const std::exception& e) {
+        return error("%s: failed to read %s: %s", __func__, path.string(), e.what());
+    }
+    LogPrintf("Loaded UTXO snapshot in %.2fs\n", (GetTimeMicros() - start) * MICRO);
+    return true;
+}
+
+/** LevelDB cache of the coins database used by the background validation of a snapshot */
+static const size_t SNAPSHOT_VALIDATION_DB_CACHE = 8 << 20;
+/** Coins the background validation of a snapshot caches in memory before writing them */
+static const size_t SNAPSHOT_VALIDATION_COINS_CACHE = 64 << 20;
+
+bool InitSnapshotValidation(const CChainParams& chainparams)
+{
+    LOCK(cs_main);
+    uint256 hashBase;
+    if (!pblocktree->ReadSnapshotBase(hashBase)) {
+        // Left over if the node stopped right after the validation completed.
+        fs::remove_all(SnapshotValidationDir());
+        return true;
+    }
+
+    CBlockIndex* pindexBase = LookupBlockIndex(hashBase);
+    const MapAssumeutxo& assumeutxo = chainparams.Assumeutxo();
+    MapAssumeutxo::const_iterator it = assumeutxo.find(pindexBase ? pindexBase->nHeight : -1);
+    if (it == assumeutxo.end() || it->second.blockhash != hashBase) {
+        return error("%s: UTXO snapshot base block %s is not a known snapshot", __func__, hashBase.ToString());
+    }
+
+    pcoinsSnapshotCheck.reset(new CCoinsViewDB(SnapshotValidationDir(), SNAPSHOT_VALIDATION_DB_CACHE, false, false, false));
+    uint256 hashValidated = pcoinsSnapshotCheck->GetBestBlock();
+    CBlockIndex* pindexValidated = hashValidated.IsNull() ? pindexBase->GetAncestor(0) : LookupBlockIndex(hashValidated);
+    if (!pindexValidated || pindexBase->GetAncestor(pindexValidated->nHeight) != pindexValidated) {
+        pcoinsSnapshotCheck.reset();
+        return error("%s: background chainstate is not on the way to the UTXO snapshot base", __func__);
+    }
+    pindexSnapshotBase = pindexBase;
+    pindexSnapshotValidated = pindexValidated;
+    LogPrintf("Validating the blocks below UTXO snapshot base %s in the background, from height %d\n",
+        hashBase.ToString(), pindexValidated->nHeight);
+    return true;
+}
+
+void UnloadSnapshotValidation()
+{
+    LOCK(cs_main);
+    pindexSnapshotBase = nullptr;
+    pindexSnapshotValidated = nullptr;
+    pcoinsSnapshotCheck.reset();
+}
+
+void ThreadSnapshotValidation()
+{
+    RenameThread("earthcoin-snapcheck");
+    const CChainParams& chainparams = Params();
+
+    CBlockIndex* pindexBase;
+    CBlockIndex* pindex;
+    {
+        LOCK(cs_main);
+        pindexBase = pindexSnapshotBase;
+        pindex = pindexSnapshotValidated;
+    }
+    if (!pindexBase) {
+        return;
+    }
+    const uint256 expected_coins_hash = chainparams.Assumeutxo().at(pindexBase->nHeight).coins_hash;
+
+    CCoinsViewCache view(pcoinsSnapshotCheck.get());
+    if (view.GetBestBlock().IsNull()) {
+        // The genesis block's coinbase is not spendable, so it adds no coins.
+        view.SetBestBlock(pindex->GetBlockHash());
+    }
+    // Blocks below pindexSnapshotValidated may be pruned, so it only moves
+    // once the coins they lead to are on disk.
+    CBlockIndex* pindexFlushed = pindex;
+    auto flush = [&]() {
+        if (!view.Flush()) {
+            return false;
+        }
+        pindexFlushed = pindex;
+        LOCK(cs_main);
+        pindexSnapshotValidated = pindex;
+        return true;
+    };
+
+    int64_t nStart = GetTimeMillis();
+    int nReportDone = pindex->nHeight * 100 / pindexBase->nHeight;
+    try {
+        while (pindex != pindexBase) {
+            boost::this_thread::interruption_point();
+            if (ShutdownRequested())
+                return;
+
+            CBlockIndex* pindexNext = pindexBase->GetAncestor(pindex->nHeight + 1);
+            bool fHaveData;
+            CDiskBlockPos pos;
+            BlockConnectRules rules;
+            {
+                LOCK(cs_main);
+                // Blocks below the base are fetched from peers while the node follows the tip.
+                fHaveData = pindexNext->nStatus & BLOCK_HAVE_DATA;
+                if (fHaveData) {
+                    pos = pindexNext->GetBlockPos();
+                    rules = GetBlockConnectRules(pindexNext, chainparams);
+                }
+            }
+            if (!fHaveData) {
+                // Write what we have while waiting, so the blocks already used can be pruned.
+                if (pindexFlushed != pindex && !flush()) {
+                    AbortNode("Failed to write the background chainstate");
+                    return;
+                }
+                MilliSleep(500);
+                continue;
+            }
+
+            // Nothing above pindexSnapshotValidated is pruned, so the block is
+            // read and checked against the background chainstate without cs_main.
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pos, chainparams.GetConsensus()) || block.GetHash() != pindexNext->GetBlockHash()) {
+                AbortNode(strprintf("Failed to read block %s", pindexNext->GetBlockHash().ToString()));
+                return;
+            }
+            CValidationState state;
+            CBlockUndo blockundo;
+            int nInputs;
+            int64_t nTimeConnected;
+            if (!CheckBlock(block, state, chainparams.GetConsensus(), false, false) ||
+                !ConnectBlockTransactions(block, state, pindexNext, view, chainparams, rules, true, blockundo, nInputs, nTimeConnected)) {
+                AbortNode(strprintf("Block %s below the UTXO snapshot is invalid: %s", pindexNext->GetBlockHash().ToString(), FormatStateMessage(state)),
+                          _("Error: The chain the UTXO snapshot was taken from is invalid. Delete the chainstate and restart to sync without it."));
+                return;
+            }
+            view.SetBestBlock(pindexNext->GetBlockHash());
+            {
+                LOCK(cs_main);
+                pindexNext->nStatus &= ~BLOCK_ASSUMED_VALID;
+                setDirtyBlockIndex.insert(pindexNext);
+            }
+
+            pindex = pindexNext;
+            if (view.DynamicMemoryUsage() > SNAPSHOT_VALIDATION_COINS_CACHE && !flush()) {
+                AbortNode("Failed to write the background chainstate");
+                return;
+            }
+
+            int nPercentageDone = pindex->nHeight * 100 / pindexBase->nHeight;
+            if (nPercentageDone / 10 > nReportDone / 10) {
+                LogPrintf("UTXO snapshot background validation: %d%% done\n", nPercentageDone);
+                nReportDone = nPercentageDone;
+            }
+        }
+    } catch (const boost::thread_interrupted&) {
+        flush();
+        throw;
+    }
+    if (!flush()) {
+        AbortNode("Failed to write the background chainstate");
+        return;
+    }
+
+    std::unique_ptr<CCoinsViewCursor> pcursor(pcoinsSnapshotCheck->Cursor());
+    uint256 coins_hash;
+    uint64_t coins_count;
+    if (!WriteSnapshotCoins(*pcursor, nullptr, coins_hash, coins_count)) {
+        return;
+    }
+    pcursor.reset();
+    if (coins_hash != expected_coins_hash) {
+        AbortNode(strprintf("UTXO set at block %s hashes to %s, not to the snapshot hash %s", pindexBase->GetBlockHash().ToString(), coins_hash.ToString(), expected_coins_hash.ToString()),
+                  _("Error: The loaded UTXO snapshot does not match the chain. Delete the chainstate and restart to sync without it."));
+        return;
+    }
+
+    {
+        LOCK(cs_main);
+        if (!pblocktree->EraseSnapshotBase()) {
+            AbortNode("Failed to write to block index database");
+            return;
+        }
+        pindexSnapshotBase = nullptr;
+        pindexSnapshotValidated = nullptr;
+        pcoinsSnapshotCheck.reset();
+    }
+    fs::remove_all(SnapshotValidationDir());
+    LogPrintf("UTXO snapshot background validation complete: %u coins at height %d match the snapshot (%dms)\n",
+        coins_count, pindexBase->nHeight, GetTimeMillis() - nStart);
+}
+
 //! Guess how far we are in the verification process at the given block index
 //! require cs_main if pindex has not been validated yet (because nChainTx might be unset)
 double GuessVerificationProgress(const ChainTxData& data, const CBlockIndex *pindex) {
@@ -4902,15 +6390,3 @@ double GuessVerificationProgress(const ChainTxData& data, const CBlockIndex *pin
     return pindex->nChainTx / fTxTotal;
 }
 
-class CMainCleanup
-{
-public:
-    CMainCleanup() {}
-    ~CMainCleanup() {
-        // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
-        mapBlockIndex.clear();
-    }
-} instance_of_cmaincleanup;
@@ -33,9 +33,12 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
 class CChainParams;
 class CCoinsViewDB;
 class CInv;
+class BlockCache;
+class MappedBlock;
 class CConnman;
 class CScriptCheck;
 class CBlockPolicyEstimator;
@@ -80,8 +83,16 @@ static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 
-/** Maximum number of script-checking threads allowed */
-static const int MAX_SCRIPTCHECK_THREADS = 16;
+/** Maximum number of threads checking blocks read by -reindex and -loadblock, on top of the -par threads */
+static const int MAX_BLOCK_IMPORT_CHECK_THREADS = 4;
+/** Maximum number of threads checking header proof of work, on top of the -par threads */
+static const int MAX_HEADER_POW_CHECK_THREADS = 8;
+/** Maximum number of threads reading the coins a block spends ahead of ConnectBlock */
+static const int MAX_COIN_PREFETCH_THREADS = 4;
+/** Maximum number of threads computing the chain work of the block index at startup */
+static const int MAX_BLOCK_PROOF_CHECK_THREADS = 2;
+/** Maximum number of threads pre-validating batches of relayed transactions */
+static const int MAX_TX_PREVALIDATION_THREADS = 2;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
 /** Number of blocks that can be requested at any given time from a single peer. */
@@ -119,7 +130,21 @@ static const int64_t MAX_FEE_ESTIMATION_TIP_AGE = 3 * 60 * 60;
 /** Default for -permitbaremultisig */
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
+/** Default for -checkblockreadpow, re-checking scrypt proof of work of indexed blocks read from disk */
+static const bool DEFAULT_CHECK_BLOCK_READ_POW = false;
+/** Default for -checkblockindexpow, verifying the proof of work of the whole block index after startup */
+static const bool DEFAULT_CHECK_BLOCK_INDEX_POW = false;
+/** Default for -scrypthugepages, backing the per-thread scrypt scratchpads with huge pages */
+static const bool DEFAULT_SCRYPT_HUGE_PAGES = false;
 static const bool DEFAULT_TXINDEX = false;
+/** Default for -coinstatsindex */
+static const bool DEFAULT_COINSTATSINDEX = false;
+/** Default for -blockindexsnapshot */
+static const bool DEFAULT_BLOCK_INDEX_SNAPSHOT = true;
+/** Default for -blockcache, in megabytes */
+static const unsigned int DEFAULT_BLOCK_CACHE_SIZE = 16;
+/** Default for -compressblockfiles */
+static const bool DEFAULT_COMPRESS_BLOCK_FILES = false;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 /** Default for -persistmempool */
 static const bool DEFAULT_PERSIST_MEMPOOL = true;
@@ -164,6 +189,7 @@ extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
+extern bool fCheckBlockReadPoW;
 extern size_t nCoinCacheUsage;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
@@ -182,6 +208,11 @@ extern arith_uint256 nMinimumChainWork;
 /** Best header we've seen so far (used for getheaders queries' starting points). */
 extern CBlockIndex *pindexBestHeader;
 
+/** Base block of a loaded UTXO snapshot whose history is still being validated, or null. */
+extern CBlockIndex *pindexSnapshotBase GUARDED_BY(cs_main);
+/** Block up to which that history has been validated and written to disk. */
+extern CBlockIndex *pindexSnapshotValidated GUARDED_BY(cs_main);
+
 /** Minimum disk space required - used in CheckDiskSpace() */
 static const uint64_t nMinDiskSpace = 52428800;
 
@@ -263,8 +294,26 @@ bool LoadBlockIndex(const CChainParams& chainparams) EXCLUSIVE_LOCKS_REQUIRED(cs
 bool LoadChainTip(const CChainParams& chainparams);
 /** Unload database information */
 void UnloadBlockIndex();
+/** Add an empty entry for a block hash to the block index, or return the existing one */
+CBlockIndex* InsertBlockIndex(const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+/** Write the block index to a snapshot the next startup loads it from. Call after the last flush at shutdown. */
+bool WriteBlockIndexSnapshot();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the header proof of work checking thread */
+void ThreadHeaderPoWCheck();
+/** Run an instance of the thread reading the coins spent by a block ahead of its connection */
+void ThreadCoinPrefetch();
+/** Run an instance of the thread checking blocks imported by LoadExternalBlockFile */
+void ThreadBlockImportCheck();
+/** Run an instance of the thread computing block proofs while the block index is loaded */
+void ThreadBlockProofCheck();
+/** Run an instance of the thread checking transactions for PreValidateTransactions */
+void ThreadTxPreValidation();
+/** Verify the proof of work of every block index entry, aborting the node if any fails */
+void ThreadCheckBlockIndexPoW();
+/** Run the thread replacing sealed block and undo files by compressed copies (-compressblockfiles) */
+void ThreadCompressBlockFiles();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
@@ -307,6 +356,15 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                         bool* pfMissingInputs, std::list<CTransactionRef>* plTxnReplaced,
                         bool bypass_limits, const CAmount nAbsurdFee, bool test_accept=false);
 
+/**
+ * Run the checks AcceptToMemoryPool can do without cs_main on a batch of
+ * transactions about to be passed to it, in parallel on the transaction
+ * checking threads. This fills the signature cache, so that the script checks
+ * of AcceptToMemoryPool, which holds cs_main, mostly find their results there.
+ * Transactions its cheaper checks would reject get no script checks.
+ */
+void PreValidateTransactions(CTxMemPool& pool, const std::vector<CTransactionRef>& txs);
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
 
@@ -392,10 +450,23 @@ void InitScriptExecutionCache();
 
 
 /** Functions for disk access for blocks */
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams, bool fCheckPOW = true);
+/** Read an indexed block. Its header passed the scrypt proof of work check before the index entry was
+ *  created (BLOCK_VALID_HEADER), so only the block hash is compared unless -checkblockreadpow is set. */
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
-bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& message_start);
-bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start);
+/** Recently read and connected blocks, shared by peers, RPC, REST, ZMQ, indexes and wallet rescans. */
+extern BlockCache g_block_cache;
+/**
+ * Read an indexed block through g_block_cache. Returns null if it cannot be read.
+ * Sequential scans of the chain (index sync, wallet rescans) pass fInsert = false:
+ * they use blocks the cache holds, but leave it to the recent blocks others ask for.
+ */
+std::shared_ptr<const CBlock> ReadBlockFromDiskCached(const CBlockIndex* pindex, const Consensus::Params& consensusParams, bool fInsert = true);
+/** Get the serialized data of a block as stored on disk, viewed in place in its mapped block file where possible. */
+bool ReadRawBlockFromDisk(MappedBlock& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& message_start);
+bool ReadRawBlockFromDisk(MappedBlock& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start);
+/** Read the undo data (the coins spent by its transactions) of an indexed, connected block. */
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -497,6 +568,34 @@ bool DumpMempool();
 /** Load the mempool from disk. */
 bool LoadMempool();
 
+/** Summary of a UTXO set snapshot written by DumpUTXOSnapshot. */
+struct UTXOSnapshotInfo
+{
+    uint256 base_blockhash;
+    int base_height;
+    uint64_t coins_count;
+    uint256 coins_hash;
+};
+
+/** Write the chainstate and the headers leading to its best block to a snapshot file. */
+bool DumpUTXOSnapshot(const fs::path& path, UTXOSnapshotInfo& info);
+
+/**
+ * Bootstrap an empty chainstate from a snapshot written by DumpUTXOSnapshot.
+ * Only snapshots listed in the chain parameters are accepted. The headers are
+ * validated as if received from a peer, the coins are checked against the
+ * listed hash, and blocks up to the base are then treated as pruned until
+ * ThreadSnapshotValidation has downloaded and validated them. Requires -prune.
+ */
+bool LoadUTXOSnapshot(const fs::path& path, CCoinsViewDB& coinsview, const CChainParams& chainparams);
+
+/** Resume the background validation of a loaded snapshot's history, if there is one. */
+bool InitSnapshotValidation(const CChainParams& chainparams);
+/** Validate the blocks below a loaded snapshot and check the coins they lead to against it */
+void ThreadSnapshotValidation();
+/** Close the background validation's coins database */
+void UnloadSnapshotValidation();
+
 //! Check whether the block associated with this index entry is pruned or not.
 inline bool IsBlockPruned(const CBlockIndex* pblockindex)
 {
@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+# Copyright (c) 2020 The Earthcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test gettxoutsetinfo served from -coinstatsindex.
+
+- node0 keeps the index, node1 computes the statistics by scanning its UTXO set.
+- Both must agree at the tip, historic heights must match what node1 reported
+  at the time, and the index must follow a reorg.
+"""
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.test_node import ErrorMatch
+from test_framework.util import assert_equal, assert_raises_rpc_error, sync_blocks
+
+ADDRESS = "mipcBbFg9gMiCh81Kj8tqqdgoZub1ZJRfn"
+
+
+class CoinStatsIndexTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [["-coinstatsindex"], []]
+
+    def assert_same_stats(self, height=None):
+        args = ["muhash"] if height is None else ["muhash", height]
+        index_stats = self.nodes[0].gettxoutsetinfo(*args)
+        scan_stats = self.nodes[1].gettxoutsetinfo("muhash")
+        for key in ["height", "bestblock", "txouts", "bogosize", "muhash", "total_amount"]:
+            assert_equal(index_stats[key], scan_stats[key])
+        return index_stats
+
+    def run_test(self):
+        node0, node1 = self.nodes
+
+        self.log.info("The index agrees with a scan of the UTXO set")
+        node0.generatetoaddress(50, ADDRESS)
+        sync_blocks(self.nodes)
+        stats_50 = self.assert_same_stats()
+        assert "transactions" not in stats_50
+        assert "disk_size" not in stats_50
+        assert stats_50["total_subsidy"] >= stats_50["total_amount"]
+
+        self.log.info("Historic heights are looked up")
+        node0.generatetoaddress(10, ADDRESS)
+        sync_blocks(self.nodes)
+        self.assert_same_stats()
+        assert_equal(node0.gettxoutsetinfo("muhash", 50), stats_50)
+        assert_equal(node0.gettxoutsetinfo("none", 50)["txouts"], stats_50["txouts"])
+        assert "muhash" not in node0.gettxoutsetinfo("none")
+        assert_raises_rpc_error(-8, "Block height out of range", node0.gettxoutsetinfo, "muhash", 61)
+        assert_raises_rpc_error(-8, "cannot be queried for a specific block", node0.gettxoutsetinfo, "hash_serialized_2", 50)
+        assert_raises_rpc_error(-8, "requires -coinstatsindex", node1.gettxoutsetinfo, "muhash", 50)
+        assert_raises_rpc_error(-8, "not a valid hash_type", node0.gettxoutsetinfo, "sha256")
+
+        self.log.info("The index follows a reorg")
+        node0.invalidateblock(node0.getblockhash(55))
+        node1.invalidateblock(node1.getblockhash(55))
+        node0.generatetoaddress(8, ADDRESS)
+        sync_blocks(self.nodes)
+        self.assert_same_stats()
+        assert_equal(node0.gettxoutsetinfo("muhash", 50), stats_50)
+
+        self.log.info("The index survives a restart")
+        self.restart_node(0, ["-coinstatsindex"])
+        self.assert_same_stats()
+
+        self.log.info("-coinstatsindex is incompatible with pruning")
+        self.stop_node(1)
+        self.nodes[1].assert_start_raises_init_error(["-coinstatsindex", "-prune=1"], "Error: Prune mode is incompatible with -coinstatsindex.", match=ErrorMatch.PARTIAL_REGEX)
+
+
+if __name__ == '__main__':
+    CoinStatsIndexTest().main()
@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+# Copyright (c) 2020 The Earthcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test dumptxoutset and bootstrapping a new node with -loadtxoutset.
+
+- node0 mines a chain and dumps its UTXO set.
+- node1 starts from an empty datadir with the snapshot, ends up with the same
+  UTXO set and tip, and then follows node0 from there while it validates the
+  blocks below the snapshot in the background.
+
+Only snapshots listed in the chain parameters load, so node0 mines the chain
+of the regtest entry: fixed time and a single mining thread.
+"""
+
+import os
+import shutil
+
+from test_framework.test_framework import BitcoinTestFramework, initialize_datadir
+from test_framework.test_node import ErrorMatch
+from test_framework.util import assert_equal, assert_raises_rpc_error, connect_nodes, sync_blocks, wait_until
+
+ADDRESS = "mipcBbFg9gMiCh81Kj8tqqdgoZub1ZJRfn"
+
+
+class UTXOSnapshotTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [["-mocktime=1388534400", "-genproclimit=1"], ["-prune=1"]]
+
+    def setup_network(self):
+        self.setup_nodes()
+
+    def run_test(self):
+        node0 = self.nodes[0]
+        node0.generatetoaddress(150, ADDRESS)
+
+        self.log.info("Dump the UTXO set of node0")
+        utxo_info = node0.gettxoutsetinfo()
+        result = node0.dumptxoutset("utxo.dat")
+        assert_equal(result["base_height"], utxo_info["height"])
+        assert_equal(result["base_hash"], utxo_info["bestblock"])
+        assert_equal(result["coins_written"], utxo_info["txouts"])
+        snapshot = result["path"]
+        assert os.path.isfile(snapshot)
+        assert_raises_rpc_error(-8, "already exists", node0.dumptxoutset, "utxo.dat")
+
+        self.log.info("-loadtxoutset requires pruning")
+        # The snapshot only goes into a chainstate that has never been written to.
+        self.stop_node(1)
+        shutil.rmtree(self.nodes[1].datadir)
+        initialize_datadir(self.options.tmpdir, 1)
+        self.nodes[1].assert_start_raises_init_error(["-loadtxoutset=" + snapshot], "Error: -loadtxoutset requires -prune", match=ErrorMatch.PARTIAL_REGEX)
+
+        self.log.info("Bootstrap node1 from the snapshot")
+        self.start_node(1, ["-prune=1", "-loadtxoutset=" + snapshot])
+        node1 = self.nodes[1]
+        assert_equal(node1.getbestblockhash(), node0.getbestblockhash())
+        assert_equal(node1.gettxoutsetinfo()["hash_serialized_2"], node0.gettxoutsetinfo()["hash_serialized_2"])
+        assert node1.getblockchaininfo()["pruned"]
+
+        self.log.info("node1 syncs new blocks on top of the snapshot")
+        connect_nodes(node1, 0)
+        node0.generatetoaddress(10, ADDRESS)
+        sync_blocks(self.nodes)
+        assert_equal(node1.gettxoutsetinfo()["hash_serialized_2"], node0.gettxoutsetinfo()["hash_serialized_2"])
+
+        self.log.info("node1 validates the blocks below the snapshot in the background")
+        background = os.path.join(node1.datadir, "regtest", "chainstate_background")
+        wait_until(lambda: not os.path.exists(background), timeout=60)
+        assert_equal(node1.getblock(node1.getblockhash(1))["height"], 1)
+
+        self.log.info("The snapshot is only loaded into an empty chainstate")
+        self.restart_node(1, ["-prune=1", "-loadtxoutset=" + snapshot])
+        assert_equal(self.nodes[1].getblockcount(), 160)
+
+
+if __name__ == '__main__':
+    UTXOSnapshotTest().main()
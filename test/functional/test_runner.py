@@ -153,6 +153,8 @@ BASE_SCRIPTS = [
     'feature_logging.py',
     'p2p_node_network_limited.py',
     'feature_blocksdir.py',
+    'feature_utxo_snapshot.py',
+    'feature_coinstatsindex.py',
     'feature_config_args.py',
     'rpc_help.py',
     'feature_help.py',